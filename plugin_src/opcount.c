@@ -0,0 +1,92 @@
+// Example plugin: executions and memory traffic per mnemonic
+// Without arguments every instruction is counted; given mnemonics
+// (-P plugin_opcount.so,lw,sw) only those are hooked and the rest run at full
+// speed. Printed when the run is over.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "plugin.h"
+#include "isa.h"
+
+int rv32_plugin_version = RV32_PLUGIN_VERSION;
+
+struct opcount
+{
+	const char *mnemonic;
+	uint64_t runs;
+	uint64_t loaded; // bytes
+	uint64_t stored;
+};
+
+static struct opcount counts[ISA_COUNT + 1]; // by instruction id, invalid ones last
+static char **wanted;
+static int wanted_count;
+
+static void on_exec(rv32core *core, uint32_t pc, void *data)
+{
+	(void)core;
+	(void)pc;
+	((struct opcount *)data)->runs++;
+}
+
+static void on_mem(rv32core *core, uint32_t pc, uint32_t addr, uint32_t value, int size, int store, void *data)
+{
+	(void)core;
+	(void)pc;
+	(void)addr;
+	(void)value;
+	struct opcount *c = data;
+	if (store)
+		c->stored += size;
+	else
+		c->loaded += size;
+}
+
+static void on_translate(rv32core *core, rv32plugin_insn *insns, int count, void *data)
+{
+	(void)core;
+	(void)data;
+	for (int i = 0; i < count; i++)
+	{
+		rv32plugin_insn *insn = &insns[i];
+		const char *mnemonic = insn->mnemonic ? insn->mnemonic : "invalid";
+
+		int want = wanted_count == 0;
+		for (int w = 0; w < wanted_count && !want; w++)
+			want = !strcmp(wanted[w], mnemonic);
+		if (!want)
+			continue;
+
+		struct opcount *c = &counts[insn->id];
+		c->mnemonic = mnemonic;
+		insn->exec = on_exec;
+		insn->mem = on_mem;
+		insn->data = c;
+	}
+}
+
+static void on_exit(rv32core *core, int fault, void *data)
+{
+	(void)core;
+	(void)fault;
+	(void)data;
+	printf("\n%-10s %14s %14s %14s\n", "mnemonic", "executions", "bytes loaded", "bytes stored");
+	for (int id = 0; id <= ISA_COUNT; id++)
+	{
+		struct opcount *c = &counts[id];
+		if (c->runs)
+			printf("%-10s %14llu %14llu %14llu\n", c->mnemonic, (unsigned long long)c->runs,
+				   (unsigned long long)c->loaded, (unsigned long long)c->stored);
+	}
+}
+
+int rv32_plugin_install(rv32plugin *p, int argc, char **argv)
+{
+	wanted = argv + 1;
+	wanted_count = argc - 1;
+	p->translate = on_translate;
+	p->exit = on_exit;
+	return 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+// Shared bits of the guest benchmarks
+// Every benchmark repeats its workload ITERATIONS times and ends by printing
+// one line: "<name> ok <checksum>", or "<name> FAIL <checksum> expected
+// <checksum>". Each iteration starts from bench_seed, which the compiler
+// can't assume constant, so nothing is hoisted out of the loop and every
+// iteration gives the same checksum whatever ITERATIONS is.
+// Data has to fit in 2K of RAM next to the stack.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+static volatile uint32_t bench_seed = 1;
+
+// Linear congruential generator, the top bits are the random ones
+static inline uint32_t bench_rand(uint32_t *state)
+{
+	*state = *state * 1664525u + 1013904223u;
+	return *state >> 8;
+}
+
+// FNV-1a step, folds a value into a checksum
+static inline uint32_t bench_hash(uint32_t h, uint32_t v)
+{
+	for (int i = 0; i < 4; i++, v >>= 8)
+		h = (h ^ (v & 0xFF)) * 16777619u;
+	return h;
+}
+
+static int bench_finish(const char *name, uint32_t got, uint32_t expected)
+{
+	if (got == expected)
+	{
+		printf("%s ok %08x\n", name, got);
+		return 0;
+	}
+	printf("%s FAIL %08x expected %08x\n", name, got, expected);
+	return 1;
+}
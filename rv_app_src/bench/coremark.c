@@ -0,0 +1,297 @@
+// CoreMark style kernels: linked list processing, small matrix arithmetic
+// and a number-scanning state machine, their results combined with CRC-16
+// Structured like CoreMark but sized for 2K of RAM, so the numbers aren't
+// comparable with real CoreMark scores.
+
+#include "bench.h"
+
+#ifndef ITERATIONS
+#define ITERATIONS 200
+#endif
+
+#define EXPECTED 0x0000cd4eu
+
+static uint16_t crc16_byte(uint8_t data, uint16_t crc)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		uint8_t x16 = (data & 1) ^ (crc & 1);
+		data >>= 1;
+		crc >>= 1;
+		if (x16)
+			crc ^= 0xA001;
+	}
+	return crc;
+}
+
+static uint16_t crc16(uint32_t v, uint16_t crc)
+{
+	for (int i = 0; i < 4; i++, v >>= 8)
+		crc = crc16_byte(v, crc);
+	return crc;
+}
+
+// Linked list
+
+#define LIST_NODES 32
+
+struct list_node
+{
+	struct list_node *next;
+	int16_t data;
+	int16_t idx;
+};
+typedef struct list_node list_node;
+
+static list_node nodes[LIST_NODES];
+
+static list_node *list_reverse(list_node *list)
+{
+	list_node *done = 0;
+	while (list)
+	{
+		list_node *next = list->next;
+		list->next = done;
+		done = list;
+		list = next;
+	}
+	return done;
+}
+
+static list_node *list_find(list_node *list, int16_t data)
+{
+	while (list && list->data != data)
+		list = list->next;
+	return list;
+}
+
+// Bottom-up merge sort, by data when by_data is set, by idx otherwise
+static list_node *list_sort(list_node *list, int by_data)
+{
+	for (int width = 1;; width *= 2)
+	{
+		list_node *p = list;
+		list_node *tail = 0;
+		int merges = 0;
+		list = 0;
+
+		while (p)
+		{
+			list_node *q = p;
+			int psize = 0;
+			merges++;
+			for (int i = 0; i < width && q; i++, q = q->next)
+				psize++;
+			int qsize = width;
+
+			while (psize || (qsize && q))
+			{
+				list_node *e;
+				if (!psize)
+					e = q, q = q->next, qsize--;
+				else if (!qsize || !q)
+					e = p, p = p->next, psize--;
+				else if (by_data ? p->data <= q->data : p->idx <= q->idx)
+					e = p, p = p->next, psize--;
+				else
+					e = q, q = q->next, qsize--;
+
+				if (tail)
+					tail->next = e;
+				else
+					list = e;
+				tail = e;
+			}
+			p = q;
+		}
+		tail->next = 0;
+		if (merges <= 1)
+			return list;
+	}
+}
+
+static uint16_t bench_list(uint32_t seed, uint16_t crc)
+{
+	for (int i = 0; i < LIST_NODES; i++)
+	{
+		nodes[i].next = i + 1 < LIST_NODES ? &nodes[i + 1] : 0;
+		nodes[i].data = bench_rand(&seed) & 0x3FF;
+		nodes[i].idx = i;
+	}
+	list_node *list = nodes;
+
+	for (int i = 0; i < 8; i++)
+	{
+		list_node *found = list_find(list, nodes[(i * 7) % LIST_NODES].data);
+		crc = crc16(found ? found->idx : -1, crc);
+		list = list_reverse(list);
+		crc = crc16(list->data, crc);
+	}
+
+	list = list_sort(list, 1);
+	for (list_node *p = list; p; p = p->next)
+		crc = crc16(p->data, crc);
+	list = list_sort(list, 0);
+	for (list_node *p = list; p; p = p->next)
+		crc = crc16(p->idx, crc);
+	return crc;
+}
+
+// Matrix
+
+#define MAT_N 8
+
+static int16_t mat_a[MAT_N][MAT_N];
+static int16_t mat_b[MAT_N][MAT_N];
+static int32_t mat_c[MAT_N][MAT_N];
+
+static uint32_t mat_sum(uint32_t h)
+{
+	for (int i = 0; i < MAT_N; i++)
+	{
+		for (int j = 0; j < MAT_N; j++)
+			h = h * 31 + mat_c[i][j];
+	}
+	return h;
+}
+
+static uint16_t bench_matrix(uint32_t seed, uint16_t crc)
+{
+	for (int i = 0; i < MAT_N; i++)
+	{
+		for (int j = 0; j < MAT_N; j++)
+		{
+			mat_a[i][j] = (bench_rand(&seed) & 0xFFF) - 0x800;
+			mat_b[i][j] = (bench_rand(&seed) & 0xFF) - 0x80;
+		}
+	}
+
+	// A += constant
+	for (int i = 0; i < MAT_N; i++)
+	{
+		for (int j = 0; j < MAT_N; j++)
+			mat_a[i][j] += 7;
+	}
+
+	// C = A * constant
+	for (int i = 0; i < MAT_N; i++)
+	{
+		for (int j = 0; j < MAT_N; j++)
+			mat_c[i][j] = mat_a[i][j] * -3;
+	}
+	uint32_t h = mat_sum(0);
+
+	// C = A * B
+	for (int i = 0; i < MAT_N; i++)
+	{
+		for (int j = 0; j < MAT_N; j++)
+		{
+			int32_t sum = 0;
+			for (int k = 0; k < MAT_N; k++)
+				sum += mat_a[i][k] * mat_b[k][j];
+			mat_c[i][j] = sum;
+		}
+	}
+	h = mat_sum(h);
+
+	// C = bits 2..5 of each A * B product, summed
+	for (int i = 0; i < MAT_N; i++)
+	{
+		for (int j = 0; j < MAT_N; j++)
+		{
+			int32_t sum = 0;
+			for (int k = 0; k < MAT_N; k++)
+				sum += ((mat_a[i][k] * mat_b[k][j]) >> 2) & 0xF;
+			mat_c[i][j] = sum;
+		}
+	}
+	h = mat_sum(h);
+
+	return crc16(h, crc);
+}
+
+// State machine
+
+enum
+{
+	STATE_START,
+	STATE_INVALID,
+	STATE_S1,
+	STATE_S2,
+	STATE_INT,
+	STATE_FLOAT,
+	STATE_EXPONENT,
+	STATE_SCIENTIFIC,
+	STATE_COUNT
+};
+
+static const char numbers[] = "5012,1234,-874,+122,35.54,-1.245,0.34e-2,-.5e+3,7.e1,1.2E,0x3F,--4,"
+							  "8192,+0,-110.7,3e7,9.99,abc,12e-,.,+12.5E-10,77,-0,4.4.4,";
+
+static int next_state(const char **p, int transitions[STATE_COUNT])
+{
+	int state = STATE_START;
+	for (char c; (c = **p) && c != ','; (*p)++)
+	{
+		int digit = c >= '0' && c <= '9';
+		int prev = state;
+		switch (state)
+		{
+		case STATE_START:
+			state = digit ? STATE_INT : c == '+' || c == '-' ? STATE_S1 : c == '.' ? STATE_FLOAT : STATE_INVALID;
+			break;
+		case STATE_S1:
+			state = digit ? STATE_INT : c == '.' ? STATE_FLOAT : STATE_INVALID;
+			break;
+		case STATE_INT:
+			state = digit ? STATE_INT : c == '.' ? STATE_FLOAT : c == 'e' || c == 'E' ? STATE_S2 : STATE_INVALID;
+			break;
+		case STATE_FLOAT:
+			state = digit ? STATE_FLOAT : c == 'e' || c == 'E' ? STATE_S2 : STATE_INVALID;
+			break;
+		case STATE_S2:
+			state = c == '+' || c == '-' ? STATE_EXPONENT : digit ? STATE_SCIENTIFIC : STATE_INVALID;
+			break;
+		case STATE_EXPONENT:
+		case STATE_SCIENTIFIC:
+			state = digit ? STATE_SCIENTIFIC : STATE_INVALID;
+			break;
+		default:
+			break;
+		}
+		if (state != prev)
+			transitions[state]++;
+	}
+	if (**p)
+		(*p)++;
+	return state;
+}
+
+static uint16_t bench_state(uint32_t seed, uint16_t crc)
+{
+	int finals[STATE_COUNT] = {0};
+	int transitions[STATE_COUNT] = {0};
+	const char *p = numbers + (seed - 1);
+
+	while (*p)
+		finals[next_state(&p, transitions)]++;
+	for (int i = 0; i < STATE_COUNT; i++)
+		crc = crc16(finals[i] << 16 | transitions[i], crc);
+	return crc;
+}
+
+int main()
+{
+	uint32_t h = 0;
+
+	for (int i = 0; i < ITERATIONS; i++)
+	{
+		uint16_t crc = 0;
+		crc = bench_list(bench_seed, crc);
+		crc = bench_matrix(bench_seed, crc);
+		crc = bench_state(bench_seed, crc);
+		h = crc;
+	}
+
+	return bench_finish("coremark", h, EXPECTED);
+}
@@ -0,0 +1,96 @@
+// CRC-32, CRC-16/CCITT and Adler-32 over a buffer of random bytes
+// CRC-32 is computed bit by bit and with a nibble table, which have to agree.
+
+#include "bench.h"
+
+#ifndef ITERATIONS
+#define ITERATIONS 300
+#endif
+
+#define EXPECTED 0x6bd7cb94u
+
+#define LEN 256
+
+static uint8_t data[LEN];
+
+static const uint32_t crc32_nibbles[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+static uint32_t crc32_bitwise(uint32_t crc, const uint8_t *p, int n)
+{
+	crc = ~crc;
+	while (n--)
+	{
+		crc ^= *p++;
+		for (int k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static uint32_t crc32_table(uint32_t crc, const uint8_t *p, int n)
+{
+	crc = ~crc;
+	while (n--)
+	{
+		crc ^= *p++;
+		crc = (crc >> 4) ^ crc32_nibbles[crc & 15];
+		crc = (crc >> 4) ^ crc32_nibbles[crc & 15];
+	}
+	return ~crc;
+}
+
+static uint16_t crc16_ccitt(uint16_t crc, const uint8_t *p, int n)
+{
+	while (n--)
+	{
+		crc ^= (uint16_t)(*p++ << 8);
+		for (int k = 0; k < 8; k++)
+			crc = crc & 0x8000 ? (uint16_t)(crc << 1) ^ 0x1021 : (uint16_t)(crc << 1);
+	}
+	return crc;
+}
+
+static uint32_t adler32(const uint8_t *p, int n)
+{
+	uint32_t a = 1;
+	uint32_t b = 0;
+	while (n--)
+	{
+		a = (a + *p++) % 65521;
+		b = (b + a) % 65521;
+	}
+	return b << 16 | a;
+}
+
+int main()
+{
+	static const uint8_t check[] = "123456789";
+	int ok = crc32_bitwise(0, check, 9) == 0xCBF43926 && crc32_table(0, check, 9) == 0xCBF43926 &&
+			 crc16_ccitt(0xFFFF, check, 9) == 0x29B1 && adler32(check, 9) == 0x091E01DE;
+
+	uint32_t h = 0;
+	for (int i = 0; i < ITERATIONS; i++)
+	{
+		uint32_t state = bench_seed;
+		for (int j = 0; j < LEN; j++)
+			data[j] = bench_rand(&state);
+
+		// Chained over growing prefixes, so the lengths vary too
+		uint32_t crc = 0;
+		uint32_t table = 0;
+		uint16_t crc16 = 0xFFFF;
+		for (int n = 1; n <= LEN; n += n)
+		{
+			crc = crc32_bitwise(crc, data, n);
+			table = crc32_table(table, data, n);
+			crc16 = crc16_ccitt(crc16, data + LEN - n, n);
+		}
+		ok &= crc == table;
+
+		h = bench_hash(bench_hash(bench_hash(2166136261u, crc), crc16), adler32(data, LEN));
+	}
+
+	return bench_finish("crc", ok ? h : 0, EXPECTED);
+}
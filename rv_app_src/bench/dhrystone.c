@@ -0,0 +1,259 @@
+// Dhrystone 2.1 style integer benchmark
+// The procedures follow Dhrystone, but the global arrays are cut from 50 to
+// 12 entries (and the offsets Proc_8 uses with them) to fit in RAM. Unlike
+// the other benchmarks state carries over from one run to the next, what is
+// checked are the final values Dhrystone says every run count leads to.
+
+#include "bench.h"
+
+#ifndef ITERATIONS
+#define ITERATIONS 50000
+#endif
+
+#define EXPECTED 0xe2cba827u
+
+#define ARR 12
+
+typedef enum
+{
+	Ident_1,
+	Ident_2,
+	Ident_3,
+	Ident_4,
+	Ident_5
+} Enumeration;
+
+typedef struct record
+{
+	struct record *Ptr_Comp;
+	Enumeration Discr;
+	Enumeration Enum_Comp;
+	int Int_Comp;
+	char Str_Comp[31];
+} Rec_Type;
+
+static Rec_Type Glob_Rec;
+static Rec_Type Next_Glob_Rec;
+static Rec_Type *Ptr_Glob;
+static Rec_Type *Next_Ptr_Glob;
+static int Int_Glob;
+static int Bool_Glob;
+static char Ch_1_Glob;
+static char Ch_2_Glob;
+static int Arr_1_Glob[ARR];
+static int Arr_2_Glob[ARR][ARR];
+
+static void Proc_7(int Int_1_Par_Val, int Int_2_Par_Val, int *Int_Par_Ref)
+{
+	int Int_Loc = Int_1_Par_Val + 2;
+	*Int_Par_Ref = Int_2_Par_Val + Int_Loc;
+}
+
+static void Proc_8(int Arr_1_Par_Ref[ARR], int Arr_2_Par_Ref[ARR][ARR], int Int_1_Par_Val, int Int_2_Par_Val)
+{
+	int Int_Loc = Int_1_Par_Val + 5;
+	Arr_1_Par_Ref[Int_Loc] = Int_2_Par_Val;
+	Arr_1_Par_Ref[Int_Loc + 1] = Arr_1_Par_Ref[Int_Loc];
+	Arr_1_Par_Ref[Int_Loc + 3] = Int_Loc;
+	for (int Int_Index = Int_Loc; Int_Index <= Int_Loc + 1; ++Int_Index)
+		Arr_2_Par_Ref[Int_Loc][Int_Index] = Int_Loc;
+	Arr_2_Par_Ref[Int_Loc][Int_Loc - 1] += 1;
+	Arr_2_Par_Ref[Int_Loc + 3][Int_Loc] = Arr_1_Par_Ref[Int_Loc];
+	Int_Glob = 5;
+}
+
+static Enumeration Func_1(char Ch_1_Par_Val, char Ch_2_Par_Val)
+{
+	char Ch_1_Loc = Ch_1_Par_Val;
+	char Ch_2_Loc = Ch_1_Loc;
+	if (Ch_2_Loc != Ch_2_Par_Val)
+		return Ident_1;
+	Ch_1_Glob = Ch_1_Loc;
+	return Ident_2;
+}
+
+static int Func_2(const char *Str_1_Par_Ref, const char *Str_2_Par_Ref)
+{
+	int Int_Loc = 2;
+	char Ch_Loc = 0;
+
+	while (Int_Loc <= 2)
+	{
+		if (Func_1(Str_1_Par_Ref[Int_Loc], Str_2_Par_Ref[Int_Loc + 1]) == Ident_1)
+		{
+			Ch_Loc = 'A';
+			Int_Loc += 1;
+		}
+	}
+	if (Ch_Loc >= 'W' && Ch_Loc < 'Z')
+		Int_Loc = 7;
+	if (Ch_Loc == 'R')
+		return 1;
+	if (strcmp(Str_1_Par_Ref, Str_2_Par_Ref) > 0)
+	{
+		Int_Loc += 7;
+		Int_Glob = Int_Loc;
+		return 1;
+	}
+	return 0;
+}
+
+static int Func_3(Enumeration Enum_Par_Val)
+{
+	Enumeration Enum_Loc = Enum_Par_Val;
+	return Enum_Loc == Ident_3;
+}
+
+static void Proc_6(Enumeration Enum_Val_Par, Enumeration *Enum_Ref_Par)
+{
+	*Enum_Ref_Par = Enum_Val_Par;
+	if (!Func_3(Enum_Val_Par))
+		*Enum_Ref_Par = Ident_4;
+	switch (Enum_Val_Par)
+	{
+	case Ident_1:
+		*Enum_Ref_Par = Ident_1;
+		break;
+	case Ident_2:
+		*Enum_Ref_Par = Int_Glob > 100 ? Ident_1 : Ident_4;
+		break;
+	case Ident_3:
+		*Enum_Ref_Par = Ident_2;
+		break;
+	case Ident_4:
+		break;
+	case Ident_5:
+		*Enum_Ref_Par = Ident_3;
+		break;
+	}
+}
+
+static void Proc_3(Rec_Type **Ptr_Ref_Par)
+{
+	if (Ptr_Glob != 0)
+		*Ptr_Ref_Par = Ptr_Glob->Ptr_Comp;
+	Proc_7(10, Int_Glob, &Ptr_Glob->Int_Comp);
+}
+
+static void Proc_1(Rec_Type *Ptr_Val_Par)
+{
+	Rec_Type *Next_Record = Ptr_Val_Par->Ptr_Comp;
+
+	*Ptr_Val_Par->Ptr_Comp = *Ptr_Glob;
+	Ptr_Val_Par->Int_Comp = 5;
+	Next_Record->Int_Comp = Ptr_Val_Par->Int_Comp;
+	Next_Record->Ptr_Comp = Ptr_Val_Par->Ptr_Comp;
+	Proc_3(&Next_Record->Ptr_Comp);
+	if (Next_Record->Discr == Ident_1)
+	{
+		Next_Record->Int_Comp = 6;
+		Proc_6(Ptr_Val_Par->Enum_Comp, &Next_Record->Enum_Comp);
+		Next_Record->Ptr_Comp = Ptr_Glob->Ptr_Comp;
+		Proc_7(Next_Record->Int_Comp, 10, &Next_Record->Int_Comp);
+	}
+	else
+		*Ptr_Val_Par = *Ptr_Val_Par->Ptr_Comp;
+}
+
+static void Proc_2(int *Int_Par_Ref)
+{
+	int Int_Loc = *Int_Par_Ref + 10;
+	Enumeration Enum_Loc = Ident_2;
+
+	do
+	{
+		if (Ch_1_Glob == 'A')
+		{
+			Int_Loc -= 1;
+			*Int_Par_Ref = Int_Loc - Int_Glob;
+			Enum_Loc = Ident_1;
+		}
+	} while (Enum_Loc != Ident_1);
+}
+
+static void Proc_4(void)
+{
+	int Bool_Loc = Ch_1_Glob == 'A';
+	Bool_Glob = Bool_Loc | Bool_Glob;
+	Ch_2_Glob = 'B';
+}
+
+static void Proc_5(void)
+{
+	Ch_1_Glob = 'A';
+	Bool_Glob = 0;
+}
+
+static uint32_t hash_string(uint32_t h, const char *s)
+{
+	for (; *s; s++)
+		h = (h ^ (uint8_t)*s) * 16777619u;
+	return h;
+}
+
+int main()
+{
+	int Int_1_Loc = 0;
+	int Int_2_Loc = 0;
+	int Int_3_Loc = 0;
+	Enumeration Enum_Loc = Ident_1;
+	char Str_1_Loc[31];
+	char Str_2_Loc[31];
+
+	Next_Ptr_Glob = &Next_Glob_Rec;
+	Ptr_Glob = &Glob_Rec;
+	Ptr_Glob->Ptr_Comp = Next_Ptr_Glob;
+	Ptr_Glob->Discr = Ident_1;
+	Ptr_Glob->Enum_Comp = Ident_3;
+	Ptr_Glob->Int_Comp = 40;
+	strcpy(Ptr_Glob->Str_Comp, "DHRYSTONE PROGRAM, SOME STRING");
+	strcpy(Str_1_Loc, "DHRYSTONE PROGRAM, 1'ST STRING");
+	Arr_2_Glob[8][7] = 10;
+
+	for (int Run_Index = 1; Run_Index <= ITERATIONS; ++Run_Index)
+	{
+		Proc_5();
+		Proc_4();
+		Int_1_Loc = 2;
+		Int_2_Loc = 3;
+		strcpy(Str_2_Loc, "DHRYSTONE PROGRAM, 2'ND STRING");
+		Enum_Loc = Ident_2;
+		Bool_Glob = !Func_2(Str_1_Loc, Str_2_Loc);
+		while (Int_1_Loc < Int_2_Loc)
+		{
+			Int_3_Loc = 5 * Int_1_Loc - Int_2_Loc;
+			Proc_7(Int_1_Loc, Int_2_Loc, &Int_3_Loc);
+			Int_1_Loc += 1;
+		}
+		Proc_8(Arr_1_Glob, Arr_2_Glob, Int_1_Loc, Int_3_Loc);
+		Proc_1(Ptr_Glob);
+		for (char Ch_Index = 'A'; Ch_Index <= Ch_2_Glob; ++Ch_Index)
+		{
+			if (Enum_Loc == Func_1(Ch_Index, 'C'))
+			{
+				Proc_6(Ident_1, &Enum_Loc);
+				strcpy(Str_2_Loc, "DHRYSTONE PROGRAM, 3'RD STRING");
+				Int_2_Loc = Run_Index;
+				Int_Glob = Run_Index;
+			}
+		}
+		Int_2_Loc = Int_2_Loc * Int_1_Loc;
+		Int_1_Loc = Int_2_Loc / Int_3_Loc;
+		Int_2_Loc = 7 * (Int_2_Loc - Int_3_Loc) - Int_1_Loc;
+		Proc_2(&Int_1_Loc);
+	}
+
+	// Everything Dhrystone prints at the end, with Arr_2_Glob[8][7] less the runs
+	uint32_t h = 2166136261u;
+	uint32_t values[] = {Int_Glob, Bool_Glob, Ch_1_Glob, Ch_2_Glob, Arr_1_Glob[8], Arr_2_Glob[8][7] - ITERATIONS,
+						 Ptr_Glob->Discr, Ptr_Glob->Enum_Comp, Ptr_Glob->Int_Comp, Next_Ptr_Glob->Discr,
+						 Next_Ptr_Glob->Enum_Comp, Next_Ptr_Glob->Int_Comp, Int_1_Loc, Int_2_Loc, Int_3_Loc, Enum_Loc};
+	for (unsigned i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+		h = bench_hash(h, values[i]);
+	h = hash_string(h, Ptr_Glob->Str_Comp);
+	h = hash_string(h, Next_Ptr_Glob->Str_Comp);
+	h = hash_string(h, Str_1_Loc);
+	h = hash_string(h, Str_2_Loc);
+
+	return bench_finish("dhrystone", h, EXPECTED);
+}
@@ -0,0 +1,50 @@
+// printf-style formatting of numbers and strings
+// Lines are formatted into a buffer with mini_snprintf, and a report is
+// printed to the UART through printf.
+
+#include "bench.h"
+
+#ifndef ITERATIONS
+#define ITERATIONS 200
+#endif
+
+#define EXPECTED 0x40c68b5bu
+
+#define LINES 32
+
+int mini_snprintf(char *buffer, unsigned int buffer_len, const char *fmt, ...);
+
+static const char *const names[8] = {"alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta"};
+
+static uint32_t hash_string(uint32_t h, const char *s)
+{
+	for (; *s; s++)
+		h = (h ^ (uint8_t)*s) * 16777619u;
+	return h;
+}
+
+int main()
+{
+	char line[96];
+	uint32_t h = 0;
+
+	for (int i = 0; i < ITERATIONS; i++)
+	{
+		uint32_t state = bench_seed;
+		h = 2166136261u;
+
+		for (int j = 0; j < LINES; j++)
+		{
+			uint32_t r = bench_rand(&state);
+			int v = (int)(r & 0xFFFF) - 0x8000;
+			int len = mini_snprintf(line, sizeof(line), "%3d|%s|%8d|%u|%08x|%X|%c|%8s|", j, names[r & 7], v, r,
+									r ^ 0xA5A5A5A5u, r >> 4, 'A' + (int)(r % 26), names[(r >> 3) & 7]);
+			h = bench_hash(hash_string(h, line), len);
+		}
+
+		// One line per iteration goes out through the UART
+		printf("%4d %08x %d\n", i, h, (int)(state & 0x3FF) - 512);
+	}
+
+	return bench_finish("format", h, EXPECTED);
+}
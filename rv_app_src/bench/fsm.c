@@ -0,0 +1,333 @@
+// Branchy state machines: a tokenizer for a small C-like language and a
+// parser for a framed, byte-stuffed serial protocol
+
+#include "bench.h"
+
+#ifndef ITERATIONS
+#define ITERATIONS 1500
+#endif
+
+#define EXPECTED 0x2de5a525u
+
+static const char source[] =
+	"/* blink the status led */\n"
+	"int count = 0x1F; int limit = 250;\n"
+	"while (count < limit) { count += 3; if (count == 42) led = !led; }\n"
+	"// checksum over the table\n"
+	"sum = sum * 31 + table[i] - 'a'; name = \"led \\\"two\\\"\";\n"
+	"for (i = 0; i <= 0777; i++) { x = (x << 2) ^ (y >> 1) && z || w; }\n"
+	"return sum != 0 ? sum : -1;\n";
+
+enum
+{
+	TOK_IDENT,
+	TOK_NUMBER,
+	TOK_STRING,
+	TOK_CHAR,
+	TOK_OP,
+	TOK_PUNCT,
+	TOK_KINDS
+};
+
+static int is_alpha(int c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static int is_digit(int c)
+{
+	return c >= '0' && c <= '9';
+}
+
+// Counts the tokens of each kind and hashes them
+static uint32_t tokenize(const char *p, int counts[TOK_KINDS])
+{
+	enum { START, IDENT, NUMBER, HEX, STRING, ESCAPE, CHAR, SLASH, LINE_COMMENT, BLOCK_COMMENT, BLOCK_STAR } state = START;
+	uint32_t h = 2166136261u;
+	uint32_t value = 0;
+	int kind = 0;
+	int c;
+
+	do
+	{
+		c = (uint8_t)*p++;
+		switch (state)
+		{
+		case START:
+			if (is_alpha(c))
+			{
+				state = IDENT;
+				value = c;
+			}
+			else if (c == '0' && *p == 'x')
+			{
+				state = HEX;
+				value = 0;
+				p++;
+			}
+			else if (is_digit(c))
+			{
+				state = NUMBER;
+				value = c - '0';
+			}
+			else if (c == '"')
+			{
+				state = STRING;
+				value = 0;
+			}
+			else if (c == '\'')
+				state = CHAR;
+			else if (c == '/')
+				state = SLASH;
+			else if (c == '{' || c == '}' || c == '(' || c == ')' || c == '[' || c == ']' || c == ';' || c == ',')
+			{
+				kind = TOK_PUNCT;
+				value = c;
+				goto token;
+			}
+			else if (c && c != ' ' && c != '\n')
+			{
+				// One or two character operators
+				kind = TOK_OP;
+				value = c;
+				if ((*p == '=' && c != '?') || (*p == c && (c == '<' || c == '>' || c == '&' || c == '|' || c == '+')))
+					value = value << 8 | (uint8_t)*p++;
+				goto token;
+			}
+			break;
+
+		case IDENT:
+			if (is_alpha(c) || is_digit(c))
+			{
+				value = value * 33 + c;
+				break;
+			}
+			kind = TOK_IDENT;
+			p--;
+			goto token;
+
+		case NUMBER:
+			if (is_digit(c))
+			{
+				value = value * 10 + c - '0';
+				break;
+			}
+			kind = TOK_NUMBER;
+			p--;
+			goto token;
+
+		case HEX:
+			if (is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))
+			{
+				value = value << 4 | (is_digit(c) ? c - '0' : (c | 0x20) - 'a' + 10);
+				break;
+			}
+			kind = TOK_NUMBER;
+			p--;
+			goto token;
+
+		case STRING:
+			if (c == '\\')
+				state = ESCAPE;
+			else if (c == '"')
+			{
+				kind = TOK_STRING;
+				goto token;
+			}
+			else
+				value = value * 31 + c;
+			break;
+
+		case ESCAPE:
+			value = value * 31 + c + 128;
+			state = STRING;
+			break;
+
+		case CHAR:
+			if (c == '\'')
+			{
+				kind = TOK_CHAR;
+				goto token;
+			}
+			value = c;
+			break;
+
+		case SLASH:
+			if (c == '/')
+				state = LINE_COMMENT;
+			else if (c == '*')
+				state = BLOCK_COMMENT;
+			else
+			{
+				kind = TOK_OP;
+				value = '/';
+				p--;
+				goto token;
+			}
+			break;
+
+		case LINE_COMMENT:
+			if (c == '\n')
+				state = START;
+			break;
+
+		case BLOCK_COMMENT:
+			if (c == '*')
+				state = BLOCK_STAR;
+			break;
+
+		case BLOCK_STAR:
+			state = c == '/' ? START : c == '*' ? BLOCK_STAR : BLOCK_COMMENT;
+			break;
+		}
+		continue;
+
+	token:
+		counts[kind]++;
+		h = bench_hash(h, value ^ (uint32_t)kind << 28);
+		state = START;
+	} while (c);
+
+	return h;
+}
+
+// Serial frames: 0x7E, length, payload, sum of the payload, 0x7E.
+// 0x7E and 0x7D in between are sent as 0x7D followed by the byte ^ 0x20.
+
+#define FRAME_FLAG 0x7E
+#define FRAME_ESCAPE 0x7D
+#define STREAM_LEN 320
+
+static uint8_t stream[STREAM_LEN];
+
+static int put_byte(int n, uint8_t b)
+{
+	if (b == FRAME_FLAG || b == FRAME_ESCAPE)
+	{
+		stream[n++] = FRAME_ESCAPE;
+		b ^= 0x20;
+	}
+	stream[n++] = b;
+	return n;
+}
+
+// Random frames with some corrupted, and noise between them
+static int make_stream(uint32_t seed)
+{
+	int n = 0;
+	while (n < STREAM_LEN - 2 * 20 - 8)
+	{
+		uint32_t r = bench_rand(&seed);
+		int len = r % 16 + 1;
+		uint8_t sum = 0;
+
+		if ((r & 0x700) == 0)
+			stream[n++] = r >> 12; // noise
+		stream[n++] = FRAME_FLAG;
+		n = put_byte(n, len);
+		for (int i = 0; i < len; i++)
+		{
+			uint8_t b = bench_rand(&seed) & ((r & 0x800) ? 0x7F : 0xFF);
+			sum += b;
+			n = put_byte(n, b);
+		}
+		n = put_byte(n, (r & 0x7000) == 0 ? sum + 1 : sum); // corrupt some
+		stream[n++] = FRAME_FLAG;
+	}
+	return n;
+}
+
+// Returns the number of good frames, bad ones are counted in *bad
+static int parse_stream(int n, uint32_t *h, int *bad)
+{
+	enum { HUNT, LENGTH, PAYLOAD, CHECK, END } state = HUNT;
+	int escape = 0;
+	int len = 0;
+	int got = 0;
+	int good = 0;
+	uint8_t sum = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		uint8_t b = stream[i];
+
+		if (b == FRAME_FLAG)
+		{
+			if (state == PAYLOAD || state == CHECK) // cut short
+				(*bad)++;
+			state = LENGTH;
+			escape = 0;
+			continue;
+		}
+		if (b == FRAME_ESCAPE)
+		{
+			escape = 1;
+			continue;
+		}
+		if (escape)
+		{
+			b ^= 0x20;
+			escape = 0;
+		}
+
+		switch (state)
+		{
+		case HUNT:
+			break;
+
+		case LENGTH:
+			len = b;
+			got = 0;
+			sum = 0;
+			state = len ? PAYLOAD : HUNT;
+			break;
+
+		case PAYLOAD:
+			sum += b;
+			*h = bench_hash(*h, b);
+			if (++got == len)
+				state = CHECK;
+			break;
+
+		case CHECK:
+			if (b == sum)
+			{
+				good++;
+				state = END;
+			}
+			else
+			{
+				(*bad)++;
+				state = HUNT;
+			}
+			break;
+
+		case END: // a frame ends with a flag
+			(*bad)++;
+			state = HUNT;
+			break;
+		}
+	}
+	return good;
+}
+
+int main()
+{
+	uint32_t h = 0;
+	int counts[TOK_KINDS];
+
+	for (int i = 0; i < ITERATIONS; i++)
+	{
+		memset(counts, 0, sizeof(counts));
+		h = tokenize(source + (bench_seed - 1), counts);
+		for (int k = 0; k < TOK_KINDS; k++)
+			h = bench_hash(h, counts[k]);
+
+		int bad = 0;
+		int n = make_stream(bench_seed);
+		int good = parse_stream(n, &h, &bad);
+		h = bench_hash(bench_hash(h, good), bad);
+	}
+
+	return bench_finish("fsm", h, EXPECTED);
+}
@@ -0,0 +1,91 @@
+// memcpy, memmove, memset and memcmp at every alignment, plus a word copy
+// Each result is checked against a plain byte loop.
+
+#include "bench.h"
+
+#ifndef ITERATIONS
+#define ITERATIONS 150
+#endif
+
+#define EXPECTED 0x1bba8edeu
+
+#define LEN 384
+
+static uint8_t src[LEN] __attribute__((aligned(4)));
+static uint8_t dst[LEN] __attribute__((aligned(4)));
+
+static void copy_words(uint32_t *d, const uint32_t *s, int n)
+{
+	for (; n >= 4; n -= 4, d += 4, s += 4)
+	{
+		d[0] = s[0];
+		d[1] = s[1];
+		d[2] = s[2];
+		d[3] = s[3];
+	}
+	while (n--)
+		*d++ = *s++;
+}
+
+static uint32_t sum_words(const uint32_t *p, int n)
+{
+	uint32_t sum = 0;
+	while (n--)
+		sum += *p++ ^ sum >> 7;
+	return sum;
+}
+
+// Plain byte loop comparison
+static int matches(const uint8_t *p, const uint8_t *expect, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		if (p[i] != expect[i])
+			return 0;
+	}
+	return 1;
+}
+
+int main()
+{
+	uint32_t h = 0;
+	int ok = 1;
+
+	for (int i = 0; i < ITERATIONS; i++)
+	{
+		uint32_t state = bench_seed;
+		for (int j = 0; j < LEN; j++)
+			src[j] = bench_rand(&state);
+		h = 2166136261u;
+
+		for (int len = 1; len <= LEN - 8; len += len / 2 + 1)
+		{
+			for (int off = 0; off < 4; off++)
+			{
+				memset(dst, off, LEN);
+				memcpy(dst + off, src + 3 - off, len);
+				ok &= matches(dst + off, src + 3 - off, len) && dst[off + len] == off;
+				ok &= !memcmp(dst + off, src + 3 - off, len);
+				h = bench_hash(h, dst[off + len - 1] | len << 8);
+			}
+		}
+
+		// Overlapping moves both ways undo each other
+		memcpy(dst, src, LEN);
+		memmove(dst + 5, dst, LEN - 5);
+		ok &= matches(dst + 5, src, LEN - 5);
+		memmove(dst, dst + 5, LEN - 5);
+		ok &= matches(dst, src, LEN - 5);
+
+		// memcmp sees the first difference
+		dst[LEN / 2] ^= 0x40;
+		h = bench_hash(h, memcmp(dst, src, LEN) < 0 ? 1 : 2);
+		h = bench_hash(h, memcmp(dst, src, LEN / 2));
+
+		copy_words((uint32_t *)dst, (const uint32_t *)src, LEN / 4);
+		ok &= !memcmp(dst, src, LEN);
+		h = bench_hash(h, sum_words((const uint32_t *)dst, LEN / 4));
+	}
+
+	return bench_finish("memops", ok ? h : 0, EXPECTED);
+}
@@ -0,0 +1,29 @@
+#!/bin/sh
+# Runs each benchmark on the emulator and prints a tab separated table:
+# benchmark, result (ok or FAIL), guest instructions, host seconds, MIPS.
+# Usage: run.sh "<emulator command>" name...
+# Each name runs bench_<name>.bin, the exit status is 1 if any failed.
+
+emulator=$1
+shift
+status=0
+
+printf 'benchmark\tresult\tinstructions\tseconds\tmips\n'
+for name in "$@"
+do
+	out=$($emulator "bench_$name.bin" 2>/dev/null)
+	row=$(printf '%s\n' "$out" | awk -v name="$name" '
+		$1 == name && ($2 == "ok" || $2 == "FAIL") { result = $2 }
+		/^Executed / { count = $2 }
+		/^Wall time / { seconds = $3; mips = $5 }
+		END {
+			if (result == "") result = "FAIL"
+			printf "%s\t%s\t%s\t%s\t%s", name, result, count, seconds, mips
+		}')
+	printf '%s\n' "$row"
+	case "$row" in
+	*"	ok	"*) ;;
+	*) status=1 ;;
+	esac
+done
+exit $status
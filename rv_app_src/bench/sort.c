@@ -0,0 +1,125 @@
+// Insertion sort, quicksort and heapsort of the same random keys
+// All three have to give the same ascending order.
+
+#include "bench.h"
+
+#ifndef ITERATIONS
+#define ITERATIONS 400
+#endif
+
+#define EXPECTED 0x357d6abau
+
+#define N 128
+
+static uint32_t keys[N];
+static uint32_t sorted[N];
+
+static void fill(uint32_t seed)
+{
+	for (int i = 0; i < N; i++)
+		keys[i] = bench_rand(&seed) % 1000; // plenty of duplicates
+}
+
+static void insertion_sort(uint32_t *a, int n)
+{
+	for (int i = 1; i < n; i++)
+	{
+		uint32_t v = a[i];
+		int j = i;
+		for (; j > 0 && a[j - 1] > v; j--)
+			a[j] = a[j - 1];
+		a[j] = v;
+	}
+}
+
+static void quick_sort(uint32_t *a, int lo, int hi)
+{
+	while (hi - lo > 8)
+	{
+		uint32_t pivot = a[lo + (hi - lo) / 2];
+		int i = lo;
+		int j = hi;
+		while (i <= j)
+		{
+			while (a[i] < pivot)
+				i++;
+			while (a[j] > pivot)
+				j--;
+			if (i <= j)
+			{
+				uint32_t t = a[i];
+				a[i++] = a[j];
+				a[j--] = t;
+			}
+		}
+
+		// Recurse into the smaller side, keeps the stack shallow
+		if (j - lo < hi - i)
+		{
+			quick_sort(a, lo, j);
+			lo = i;
+		}
+		else
+		{
+			quick_sort(a, i, hi);
+			hi = j;
+		}
+	}
+	insertion_sort(a + lo, hi - lo + 1);
+}
+
+static void sift_down(uint32_t *a, int root, int n)
+{
+	for (int child; (child = 2 * root + 1) < n; root = child)
+	{
+		if (child + 1 < n && a[child + 1] > a[child])
+			child++;
+		if (a[root] >= a[child])
+			return;
+		uint32_t t = a[root];
+		a[root] = a[child];
+		a[child] = t;
+	}
+}
+
+static void heap_sort(uint32_t *a, int n)
+{
+	for (int i = n / 2 - 1; i >= 0; i--)
+		sift_down(a, i, n);
+	for (int i = n - 1; i > 0; i--)
+	{
+		uint32_t t = a[0];
+		a[0] = a[i];
+		a[i] = t;
+		sift_down(a, 0, i);
+	}
+}
+
+int main()
+{
+	uint32_t h = 0;
+	int ok = 1;
+
+	for (int i = 0; i < ITERATIONS; i++)
+	{
+		fill(bench_seed);
+		insertion_sort(keys, N);
+		memcpy(sorted, keys, sizeof(keys));
+		for (int j = 1; j < N; j++)
+			ok &= sorted[j - 1] <= sorted[j];
+
+		fill(bench_seed);
+		quick_sort(keys, 0, N - 1);
+		ok &= !memcmp(sorted, keys, sizeof(keys));
+
+		fill(bench_seed);
+		heap_sort(keys, N);
+		ok &= !memcmp(sorted, keys, sizeof(keys));
+
+		h = 2166136261u;
+		for (int j = 0; j < N; j++)
+			h = bench_hash(h, sorted[j]);
+	}
+
+	return bench_finish("sort", ok ? h : 0, EXPECTED);
+}
@@ -0,0 +1,62 @@
+#!/bin/sh
+# Runs the benchmarks on several builds of the emulator and prints a tab
+# separated table of the MIPS each one reaches, with their geometric mean.
+# Usage: variants.sh "<emulator>..." name...
+# A FAIL result shows as - instead of the MIPS.
+
+emulators=$1
+shift
+dir=$(dirname "$0")
+tmp=${TMPDIR:-/tmp}/variants.$$
+status=0
+trap 'rm -f "$tmp".*' EXIT
+
+n=0
+for emulator in $emulators
+do
+	n=$((n + 1))
+	"$dir/run.sh" "./$emulator" "$@" > "$tmp.$n" || status=1
+done
+
+# One column per emulator, from the result and mips columns of run.sh
+files=
+i=1
+while [ $i -le $n ]
+do
+	files="$files $tmp.$i"
+	i=$((i + 1))
+done
+awk -v names="$emulators" '
+	BEGIN { count = split(names, emulator, " ") }
+	FNR == 1 { file++; next }
+	{
+		if (file == 1)
+			order[++rows] = $1
+		mips[$1, file] = $2 == "ok" ? $5 : "-"
+	}
+	END {
+		line = "benchmark"
+		for (e = 1; e <= count; e++)
+			line = line "\t" emulator[e]
+		print line
+		for (r = 1; r <= rows; r++)
+		{
+			line = order[r]
+			for (e = 1; e <= count; e++)
+			{
+				value = mips[order[r], e]
+				line = line "\t" value
+				if (value != "-" && value > 0)
+				{
+					logs[e] += log(value)
+					valid[e]++
+				}
+			}
+			print line
+		}
+		line = "geomean"
+		for (e = 1; e <= count; e++)
+			line = line "\t" (valid[e] ? sprintf("%.2f", exp(logs[e] / valid[e])) : "-")
+		print line
+	}' $files
+exit $status
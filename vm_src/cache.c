@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32i.h"
+#include "instructions.h"
+#include "isa.h"
+#include "elfsym.h"
+#include "profile.h"
+#include "cache.h"
+
+#ifdef RV32_STATS
+
+static const char *policy_options[3] = {"lru", "fifo", "random"};
+static const char *policy_names[3] = {"LRU", "FIFO", "random"};
+
+static int is_power_of_2(uint32_t n)
+{
+	return n && !(n & (n - 1));
+}
+
+// Set up a cache from a spec "size,ways,line[,policy]", size in bytes or
+// with a k suffix for KB and the policy lru (the default), fifo or random
+static int sim_start(cache_sim *s, const char *spec)
+{
+	memset(s, 0, sizeof(cache_sim));
+	if (spec == NULL)
+		return 0;
+
+	char *end;
+	s->size = strtoul(spec, &end, 0);
+	if (*end == 'k' || *end == 'K')
+	{
+		s->size *= 1024;
+		end++;
+	}
+	if (*end++ != ',')
+		return -1;
+	s->ways = strtoul(end, &end, 0);
+	if (*end++ != ',')
+		return -1;
+	s->line = strtoul(end, &end, 0);
+
+	s->policy = CACHE_LRU;
+	if (*end == ',')
+	{
+		for (s->policy = 0; s->policy < 3 && strcmp(end + 1, policy_options[s->policy]); s->policy++)
+			;
+		if (s->policy == 3)
+			return -1;
+	}
+	else if (*end)
+		return -1;
+
+	if (!is_power_of_2(s->line) || s->line < 4 || !s->ways || s->size % (s->ways * s->line) ||
+		!is_power_of_2(s->size / (s->ways * s->line)))
+		return -1;
+
+	s->sets = s->size / (s->ways * s->line);
+	while ((1u << s->line_bits) < s->line)
+		s->line_bits++;
+	s->seed = 0x2545F491;
+
+	s->tags = malloc(s->sets * s->ways * sizeof(uint32_t));
+	s->stamps = calloc(s->sets * s->ways, sizeof(uint64_t));
+	s->dirty = calloc(s->sets * s->ways, 1);
+	if (s->tags == NULL || s->stamps == NULL || s->dirty == NULL)
+		return -1;
+	memset(s->tags, 0xFF, s->sets * s->ways * sizeof(uint32_t)); // CACHE_INVALID
+	return 0;
+}
+
+static void sim_stop(cache_sim *s)
+{
+	free(s->tags);
+	free(s->stamps);
+	free(s->dirty);
+	s->tags = NULL;
+	s->stamps = NULL;
+	s->dirty = NULL;
+}
+
+// Look up the line holding addr, filling it on a miss
+// Returns 1 on a hit.
+static int sim_access(cache_sim *s, uint32_t addr, int store)
+{
+	uint32_t line = addr >> s->line_bits;
+	uint32_t first = (line & (s->sets - 1)) * s->ways;
+	uint32_t *tags = &s->tags[first];
+	uint64_t *stamps = &s->stamps[first];
+	uint8_t *dirty = &s->dirty[first];
+	uint32_t way;
+
+	s->clock++;
+	for (way = 0; way < s->ways; way++)
+	{
+		if (tags[way] == line)
+		{
+			if (s->policy == CACHE_LRU)
+				stamps[way] = s->clock;
+			dirty[way] |= store;
+			s->hits++;
+			return 1;
+		}
+	}
+
+	// Empty ways are filled first
+	for (way = 0; way < s->ways && tags[way] != CACHE_INVALID; way++)
+		;
+	if (way == s->ways && s->policy == CACHE_RANDOM)
+	{
+		s->seed ^= s->seed << 13; // xorshift32
+		s->seed ^= s->seed >> 17;
+		s->seed ^= s->seed << 5;
+		way = s->seed % s->ways;
+	}
+	else if (way == s->ways)
+	{
+		way = 0;
+		for (uint32_t i = 1; i < s->ways; i++)
+		{
+			if (stamps[i] < stamps[way])
+				way = i;
+		}
+	}
+
+	s->writebacks += dirty[way];
+	tags[way] = line;
+	stamps[way] = s->clock;
+	dirty[way] = store;
+	s->misses++;
+	return 0;
+}
+
+// Caches for the specs, NULL for a cache that isn't simulated
+// Returns -1 if a spec is invalid.
+int cache_start(rv32cache *c, const char *icache, const char *dcache)
+{
+	memset(c, 0, sizeof(rv32cache));
+	if (sim_start(&c->icache, icache) || sim_start(&c->dcache, dcache))
+	{
+		cache_stop(c);
+		return -1;
+	}
+	return 0;
+}
+
+// Add a pc range to report, "start-end" with end excluded
+// Returns -1 if it is invalid or there are too many.
+int cache_range_add(rv32cache *c, const char *range)
+{
+	char *end;
+	uint32_t start = strtoul(range, &end, 16);
+	if (*end++ != '-' || c->range_count == CACHE_RANGES)
+		return -1;
+	uint32_t stop = strtoul(end, &end, 16);
+	if (*end || stop <= start)
+		return -1;
+
+	c->ranges[c->range_count].start = start;
+	c->ranges[c->range_count].end = stop;
+	c->range_count++;
+	return 0;
+}
+
+void cache_stop(rv32cache *c)
+{
+	sim_stop(&c->icache);
+	sim_stop(&c->dcache);
+}
+
+// Fetch n instructions run in a row from pc
+// Only the first fetch from each line is looked up, the others hit it.
+void cache_fetch(rv32cache *c, uint32_t pc, uint64_t n)
+{
+	cache_sim *s = &c->icache;
+	int slot = profile_slot(pc);
+	if (!n || slot < 0)
+		return;
+	profile_range(&c->fetches, pc, n, 1);
+	if (!s->size)
+		return;
+
+	uint32_t end = pc + 4 * (uint32_t)n;
+	while (pc != end)
+	{
+		uint32_t next = (pc | (s->line - 1)) + 1;
+		if (next - pc > end - pc)
+			next = end;
+
+		if (!sim_access(s, pc, 0))
+			c->fetch_misses[slot]++;
+		s->hits += (next - pc) / 4 - 1;
+		slot += (next - pc) / 4;
+		pc = next;
+	}
+}
+
+// Load or store of size bytes at addr by the instruction at pc
+// Accesses crossing a line are two accesses.
+void cache_data(rv32cache *c, uint32_t pc, uint32_t addr, uint32_t size, int store)
+{
+	cache_sim *s = &c->dcache;
+	int slot = profile_slot(pc);
+	if (!s->size || !inMemory(addr) || (store && inROM(addr)))
+		return;
+
+	uint32_t last = (addr + size - 1) >> s->line_bits;
+	for (uint32_t line = addr >> s->line_bits;; line++)
+	{
+		int hit = sim_access(s, line << s->line_bits, store);
+		if (slot >= 0)
+		{
+			c->accesses[slot]++;
+			c->data_misses[slot] += !hit;
+		}
+		if (line == last)
+			break;
+	}
+}
+
+// The iterations of the loop at top the spin-loop skipper just skipped
+// Skippable loops don't store, and their loads go where they did last time.
+void cache_loop(rv32cache *c, rv32core *core, uint32_t top, uint64_t skipped)
+{
+	idle_loop *loop = idle_slot(&core->idle, top);
+	uint64_t iterations = skipped / loop->len;
+	uint32_t loads[IDLE_MAX_BODY], sizes[IDLE_MAX_BODY], pcs[IDLE_MAX_BODY];
+	int load_count = 0;
+
+	for (int i = 0; i < loop->len; i++)
+	{
+		uint32_t inst = mem_read_32(core, top + 4 * i);
+		if (isa_class(isa_decode(inst)) != ISA_CLASS_LOAD)
+			continue;
+		loads[load_count] = core->x[get_rs1(inst)] + signextend_12(imm_type_i(inst));
+		sizes[load_count] = 1 << (get_func3(inst) & 3);
+		pcs[load_count] = top + 4 * i;
+		load_count++;
+	}
+
+	uint64_t run = 0;
+	while (run < iterations)
+	{
+		uint64_t misses = c->icache.misses + c->dcache.misses;
+		cache_fetch(c, top, loop->len);
+		for (int i = 0; i < load_count; i++)
+			cache_data(c, pcs[i], loads[i], sizes[i], 0);
+		run++;
+		if (misses == c->icache.misses + c->dcache.misses)
+			break;
+	}
+
+	uint64_t rest = iterations - run;
+	if (!rest)
+		return;
+	profile_range(&c->fetches, top, loop->len, rest);
+	if (c->icache.size)
+		c->icache.hits += rest * loop->len;
+	for (int i = 0; i < load_count && c->dcache.size; i++)
+	{
+		int slot = profile_slot(pcs[i]);
+		uint32_t lines = ((loads[i] + sizes[i] - 1) >> c->dcache.line_bits) - (loads[i] >> c->dcache.line_bits) + 1;
+		if (!inMemory(loads[i]) || slot < 0)
+			continue;
+		c->dcache.hits += rest * lines;
+		c->accesses[slot] += rest * lines;
+	}
+}
+
+// Report
+
+// Fetches and data accesses of a function, a range or an address, and their misses
+struct miss_entry
+{
+	uint32_t addr;
+	const char *name;
+	uint64_t fetches;
+	uint64_t fetch_misses;
+	uint64_t accesses;
+	uint64_t data_misses;
+};
+typedef struct miss_entry miss_entry;
+
+static int more_misses(const void *a, const void *b)
+{
+	const miss_entry *x = a, *y = b;
+	uint64_t mx = x->fetch_misses + x->data_misses, my = y->fetch_misses + y->data_misses;
+	if (mx != my)
+		return mx < my ? 1 : -1;
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static double percent(uint64_t count, uint64_t total)
+{
+	return total ? 100.0 * count / total : 0.0;
+}
+
+static void add_entry(miss_entry *to, const miss_entry *from)
+{
+	to->fetches += from->fetches;
+	to->fetch_misses += from->fetch_misses;
+	to->accesses += from->accesses;
+	to->data_misses += from->data_misses;
+}
+
+static void print_header(FILE *out, const char *what)
+{
+	fprintf(out, "%14s %12s %7s %14s %12s %7s  %-8s  %s\n", "fetches", "i-misses", "%", "accesses", "d-misses", "%",
+			"address", what);
+}
+
+static void print_entry(FILE *out, const miss_entry *e)
+{
+	fprintf(out, "%14llu %12llu %6.2f%% %14llu %12llu %6.2f%%  %08x", (unsigned long long)e->fetches,
+			(unsigned long long)e->fetch_misses, percent(e->fetch_misses, e->fetches), (unsigned long long)e->accesses,
+			(unsigned long long)e->data_misses, percent(e->data_misses, e->accesses), e->addr);
+}
+
+static void print_cache(FILE *out, const char *what, cache_sim *s)
+{
+	if (!s->size)
+		return;
+	uint64_t total = s->hits + s->misses;
+	fprintf(out, "%s cache: %u bytes, %u way%s, %u byte lines, %s\n", what, s->size, s->ways, s->ways > 1 ? "s" : "",
+			s->line, policy_names[s->policy]);
+	fprintf(out, "  %llu accesses, %llu hits, %llu misses (%.2f%%)", (unsigned long long)total,
+			(unsigned long long)s->hits, (unsigned long long)s->misses, percent(s->misses, total));
+	if (s->writebacks)
+		fprintf(out, ", %llu write-backs", (unsigned long long)s->writebacks);
+	fprintf(out, "\n");
+}
+
+// Write the hit and miss counts, per function, per range and per address
+// Functions and addresses come most missing first.
+void cache_report(rv32cache *c, FILE *out, elf_symbols *syms)
+{
+	miss_entry *pcs = malloc(PROFILE_SLOTS * sizeof(miss_entry));
+	miss_entry *funcs = malloc(PROFILE_SLOTS * sizeof(miss_entry));
+	if (pcs == NULL || funcs == NULL)
+	{
+		free(pcs);
+		free(funcs);
+		return;
+	}
+
+	print_cache(out, "Instruction", &c->icache);
+	print_cache(out, "Data", &c->dcache);
+
+	// Back from differences to fetch counts, RAM first so addresses are in order
+	int n = 0;
+	for (int region = 0; region < 2; region++)
+	{
+		int64_t *diff = region ? c->fetches.rom : c->fetches.ram;
+		int first = region ? 0 : ROM_SIZE / 4;
+		int count = region ? ROM_SIZE / 4 : RAM_SIZE / 4;
+		int64_t fetches = 0;
+		for (int i = 0; i < count; i++)
+		{
+			fetches += diff[i];
+			if (fetches <= 0)
+				continue;
+			miss_entry *e = &pcs[n++];
+			e->addr = profile_slot_pc(first + i);
+			e->name = NULL;
+			e->fetches = fetches;
+			e->fetch_misses = c->fetch_misses[first + i];
+			e->accesses = c->accesses[first + i];
+			e->data_misses = c->data_misses[first + i];
+		}
+	}
+
+	// Addresses are in order here, so each function's are next to each other
+	int nfuncs = 0;
+	for (int i = 0; i < n; i++)
+	{
+		uint32_t offset = 0;
+		const char *name = syms ? elfsym_function(syms, pcs[i].addr, &offset) : NULL;
+		pcs[i].name = name;
+		if (name == NULL)
+			continue;
+		if (!nfuncs || funcs[nfuncs - 1].name != name || pcs[i].addr - offset != funcs[nfuncs - 1].addr)
+		{
+			memset(&funcs[nfuncs], 0, sizeof(miss_entry));
+			funcs[nfuncs].addr = pcs[i].addr - offset;
+			funcs[nfuncs].name = name;
+			nfuncs++;
+		}
+		add_entry(&funcs[nfuncs - 1], &pcs[i]);
+	}
+
+	if (nfuncs)
+	{
+		qsort(funcs, nfuncs, sizeof(miss_entry), more_misses);
+		fprintf(out, "\nFunctions\n");
+		print_header(out, "function");
+		for (int i = 0; i < nfuncs; i++)
+		{
+			print_entry(out, &funcs[i]);
+			fprintf(out, "  %s\n", funcs[i].name);
+		}
+	}
+
+	if (c->range_count)
+	{
+		fprintf(out, "\nRanges\n");
+		print_header(out, "range");
+		for (int r = 0; r < c->range_count; r++)
+		{
+			miss_entry range;
+			memset(&range, 0, sizeof(range));
+			range.addr = c->ranges[r].start;
+			for (int i = 0; i < n; i++)
+			{
+				if (pcs[i].addr - c->ranges[r].start < c->ranges[r].end - c->ranges[r].start)
+					add_entry(&range, &pcs[i]);
+			}
+			print_entry(out, &range);
+			fprintf(out, "  -%08x\n", c->ranges[r].end);
+		}
+	}
+
+	// Addresses that missed
+	qsort(pcs, n, sizeof(miss_entry), more_misses);
+	fprintf(out, "\nAddresses\n");
+	print_header(out, "location");
+	for (int i = 0; i < n && pcs[i].fetch_misses + pcs[i].data_misses; i++)
+	{
+		print_entry(out, &pcs[i]);
+
+		uint32_t offset;
+		const char *file;
+		if (syms && pcs[i].name && elfsym_function(syms, pcs[i].addr, &offset))
+			fprintf(out, "  %s+0x%x", pcs[i].name, offset);
+		int line = syms ? elfsym_line(syms, pcs[i].addr, &file) : 0;
+		if (line)
+			fprintf(out, "  %s:%d", file, line);
+		fprintf(out, "\n");
+	}
+
+	free(pcs);
+	free(funcs);
+}
+
+#endif
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "rv32i.h"
+#include "elfsym.h"
+#include "profile.h"
+
+// Cache simulation
+// Only built with -DRV32_STATS (make emulator_stats), like the instruction
+// mix. An instruction cache sees every fetch and a data cache every RAM and
+// ROM access of the loads and stores, MMIO isn't cached. Each cache is set
+// associative, with its size, ways, line size and replacement policy given
+// on the command line; stores allocate lines and dirty lines are written back
+// when evicted.
+//
+// Fetches are fed a run at a time, as the engines report what they executed:
+// the two caches are separate, so fetching a block after its loads and stores
+// doesn't change any outcome. Misses are counted per address of the
+// instruction causing them and reported per function and per pc range.
+// Iterations of spin loops fast-forwarded by the skipper are replayed until
+// one of them hits throughout, the rest would too and are counted as hits.
+
+#ifdef RV32_STATS
+
+#define CACHE_LRU 0	   // evict the least recently used line
+#define CACHE_FIFO 1   // evict the oldest line
+#define CACHE_RANDOM 2 // evict any line
+
+#define CACHE_RANGES 16 // pc ranges reported
+
+#define CACHE_INVALID 0xFFFFFFFF // tag of an empty line, no address has it
+
+// One set associative cache, size 0 when not simulated
+struct cache_sim
+{
+	uint32_t size;
+	uint32_t ways;
+	uint32_t line;
+	int policy;
+
+	uint32_t sets;
+	int line_bits;
+	uint32_t *tags;	  // line addresses, ways of a set next to each other
+	uint64_t *stamps; // last use for LRU, fill for FIFO
+	uint8_t *dirty;
+	uint64_t clock;
+	uint32_t seed; // random replacement
+
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t writebacks;
+};
+typedef struct cache_sim cache_sim;
+
+struct cache_range
+{
+	uint32_t start;
+	uint32_t end; // first address past the range
+};
+typedef struct cache_range cache_range;
+
+struct rv32cache
+{
+	cache_sim icache;
+	cache_sim dcache;
+
+	rv32profile fetches; // per pc, the fetch accesses
+	uint64_t fetch_misses[PROFILE_SLOTS];
+	uint64_t accesses[PROFILE_SLOTS]; // data cache lines accessed by each instruction
+	uint64_t data_misses[PROFILE_SLOTS];
+
+	cache_range ranges[CACHE_RANGES];
+	int range_count;
+};
+typedef struct rv32cache rv32cache;
+
+// Data access hook for the engines, a single test when not simulating
+#define CACHE_ACCESS(core, pc, addr, size, store) \
+	do { if ((core)->cache) cache_data((core)->cache, pc, addr, size, store); } while (0)
+
+int cache_start(rv32cache *c, const char *icache, const char *dcache);
+int cache_range_add(rv32cache *c, const char *range);
+void cache_stop(rv32cache *c);
+void cache_report(rv32cache *c, FILE *out, elf_symbols *syms);
+
+void cache_fetch(rv32cache *c, uint32_t pc, uint64_t n);
+void cache_data(rv32cache *c, uint32_t pc, uint32_t addr, uint32_t size, int store);
+void cache_loop(rv32cache *c, rv32core *core, uint32_t top, uint64_t skipped);
+
+#else
+
+#define CACHE_ACCESS(core, pc, addr, size, store) ((void)(pc)) // pc may be computed from otherwise unused arguments
+
+#endif
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32i.h"
+#include "instructions.h"
+#include "opcodes.h"
+#include "elfsym.h"
+#include "callstack.h"
+
+// x1 (ra) and x5 (t0) hold return addresses
+#define IS_LINK(r) ((r) == 1 || (r) == 5)
+
+static uint32_t node_hash(int parent, uint32_t func, int size)
+{
+	uint32_t h = (uint32_t)parent * 0x9e3779b1u ^ func * 0x85ebca6bu;
+	return (h ^ (h >> 15)) & (size - 1);
+}
+
+static int grow_hash(call_stacks *stacks)
+{
+	int size = stacks->hash_size ? stacks->hash_size * 2 : 1024;
+	int *hash = malloc(size * sizeof(int));
+	if (hash == NULL)
+		return 0;
+	memset(hash, -1, size * sizeof(int));
+
+	for (int i = 0; i < stacks->node_count; i++)
+	{
+		uint32_t h = node_hash(stacks->nodes[i].parent, stacks->nodes[i].func, size);
+		while (hash[h] >= 0)
+			h = (h + 1) & (size - 1);
+		hash[h] = i;
+	}
+
+	free(stacks->hash);
+	stacks->hash = hash;
+	stacks->hash_size = size;
+	return 1;
+}
+
+// Node for func called from parent, created on first use
+// Returns -1 when out of memory.
+static int child_node(call_stacks *stacks, int parent, uint32_t func)
+{
+	uint32_t h = node_hash(parent, func, stacks->hash_size);
+	for (; stacks->hash[h] >= 0; h = (h + 1) & (stacks->hash_size - 1))
+	{
+		call_node *n = &stacks->nodes[stacks->hash[h]];
+		if (n->parent == parent && n->func == func)
+			return stacks->hash[h];
+	}
+
+	if (stacks->node_count == stacks->node_cap)
+	{
+		int cap = stacks->node_cap ? stacks->node_cap * 2 : 1024;
+		call_node *nodes = realloc(stacks->nodes, cap * sizeof(call_node));
+		if (nodes == NULL)
+			return -1;
+		stacks->nodes = nodes;
+		stacks->node_cap = cap;
+	}
+
+	int i = stacks->node_count++;
+	stacks->nodes[i].func = func;
+	stacks->nodes[i].parent = parent;
+	stacks->nodes[i].self = 0;
+	stacks->nodes[i].total = 0;
+	stacks->hash[h] = i;
+
+	if (2 * stacks->node_count > stacks->hash_size && !grow_hash(stacks))
+		return -1;
+	return i;
+}
+
+// Start with a single frame at the reset vector
+int stacks_init(call_stacks *stacks, uint32_t entry, elf_symbols *syms)
+{
+	memset(stacks, 0, sizeof(call_stacks));
+	stacks->syms = syms;
+	if (!grow_hash(stacks))
+		return -1;
+
+	int root = child_node(stacks, -1, entry);
+	if (root < 0)
+		return -1;
+	stacks->stack[0].node = root;
+	stacks->stack[0].ret = 0;
+	stacks->stack[0].sp = UINT32_MAX;
+	stacks->depth = 1;
+	return 0;
+}
+
+void stacks_free(call_stacks *stacks)
+{
+	free(stacks->nodes);
+	free(stacks->hash);
+	stacks->nodes = NULL;
+	stacks->hash = NULL;
+}
+
+static void do_call(call_stacks *stacks, uint32_t func, uint32_t ret, uint32_t sp)
+{
+	if (stacks->depth == STACK_MAX_DEPTH)
+	{
+		stacks->lost++;
+		return;
+	}
+
+	int node = child_node(stacks, stacks->stack[stacks->depth - 1].node, func);
+	if (node < 0)
+		return;
+
+	call_frame *f = &stacks->stack[stacks->depth++];
+	f->node = node;
+	f->ret = ret;
+	f->sp = sp;
+}
+
+static void do_return(call_stacks *stacks, uint32_t target, uint32_t sp)
+{
+	if (stacks->lost)
+	{
+		stacks->lost--;
+		return;
+	}
+
+	// Usually the top frame, further down when frames are skipped
+	for (int i = stacks->depth - 1; i > 0; i--)
+	{
+		if (stacks->stack[i].ret == target)
+		{
+			stacks->depth = i;
+			return;
+		}
+	}
+
+	// Returning somewhere no call came from, e.g. longjmp: drop every frame
+	// called at or below the stack pointer the guest has gone back to
+	while (stacks->depth > 1 && stacks->stack[stacks->depth - 1].sp <= sp)
+		stacks->depth--;
+}
+
+// A plain jump to the start of another function is a tail call
+static void do_jump(call_stacks *stacks, uint32_t target)
+{
+	call_frame *f = &stacks->stack[stacks->depth - 1];
+	uint32_t offset;
+
+	if (stacks->syms == NULL || stacks->nodes[f->node].func == target)
+		return;
+	if (!elfsym_function(stacks->syms, target, &offset) || offset)
+		return;
+
+	int node = child_node(stacks, stacks->nodes[f->node].parent, target);
+	if (node >= 0)
+		f->node = node;
+}
+
+// Charge n instructions executed in a row from pc, then follow the control
+// transfer the last of them made, if it was a call, a return or a tail call
+void stacks_step(call_stacks *stacks, rv32core *core, uint32_t pc, uint64_t n)
+{
+	if (!n)
+		return;
+	stacks_count(stacks, n);
+
+	uint32_t last = pc + 4 * (uint32_t)(n - 1);
+	if (!inMemory(last))
+		return;
+
+	uint32_t inst = mem_read_32(core, last);
+	uint8_t rd = get_rd(inst);
+	uint8_t rs1 = get_rs1(inst);
+	uint32_t target = core->pc;
+	uint32_t sp = core->x[2];
+
+	switch (get_opcode(inst))
+	{
+
+	case OP_JAL:
+		if (IS_LINK(rd))
+			do_call(stacks, target, last + 4, sp);
+		else if (rd == 0)
+			do_jump(stacks, target);
+		break;
+
+	case OP_JALR:
+		// Return address stack hints, table 2.1 of the unprivileged spec
+		if (IS_LINK(rs1) && (!IS_LINK(rd) || rd != rs1))
+			do_return(stacks, target, sp);
+		if (IS_LINK(rd))
+			do_call(stacks, target, last + 4, sp);
+		else if (rd == 0 && !IS_LINK(rs1))
+			do_jump(stacks, target);
+		break;
+	}
+}
+
+// Function name for a node, or its address without symbols
+static void print_func(call_stacks *stacks, FILE *out, uint32_t func)
+{
+	uint32_t offset;
+	const char *name = stacks->syms ? elfsym_function(stacks->syms, func, &offset) : NULL;
+	if (name && !offset)
+		fprintf(out, "%s", name);
+	else if (name)
+		fprintf(out, "%s+0x%x", name, offset);
+	else
+		fprintf(out, "0x%08x", func);
+}
+
+static void print_path(call_stacks *stacks, FILE *out, int node)
+{
+	int path[STACK_MAX_DEPTH + 1];
+	int len = 0;
+	for (; node >= 0 && len <= STACK_MAX_DEPTH; node = stacks->nodes[node].parent)
+		path[len++] = node;
+
+	for (int i = len - 1; i >= 0; i--)
+	{
+		print_func(stacks, out, stacks->nodes[path[i]].func);
+		if (i)
+			fprintf(out, ";");
+	}
+}
+
+// Write one line per call path: the functions from the outermost in, separated
+// by semicolons, and the instructions executed in the innermost on that path.
+// This is the folded format flamegraph.pl and similar tools take.
+void stacks_write_folded(call_stacks *stacks, FILE *out)
+{
+	for (int i = 0; i < stacks->node_count; i++)
+	{
+		if (!stacks->nodes[i].self)
+			continue;
+		print_path(stacks, out, i);
+		fprintf(out, " %llu\n", (unsigned long long)stacks->nodes[i].self);
+	}
+}
+
+static call_stacks *sort_stacks;
+
+static int more_inclusive(const void *a, const void *b)
+{
+	const call_node *x = &sort_stacks->nodes[*(const int *)a];
+	const call_node *y = &sort_stacks->nodes[*(const int *)b];
+	if (x->total != y->total)
+		return x->total < y->total ? 1 : -1;
+	return *(const int *)a - *(const int *)b;
+}
+
+// Call paths with inclusive and exclusive counts, most inclusive first
+void stacks_report(call_stacks *stacks, FILE *out)
+{
+	// Children are always created after their parent
+	for (int i = 0; i < stacks->node_count; i++)
+		stacks->nodes[i].total = stacks->nodes[i].self;
+	for (int i = stacks->node_count - 1; i >= 0; i--)
+	{
+		if (stacks->nodes[i].parent >= 0)
+			stacks->nodes[stacks->nodes[i].parent].total += stacks->nodes[i].total;
+	}
+
+	int *order = malloc(stacks->node_count * sizeof(int));
+	if (order == NULL)
+		return;
+	for (int i = 0; i < stacks->node_count; i++)
+		order[i] = i;
+	sort_stacks = stacks;
+	qsort(order, stacks->node_count, sizeof(int), more_inclusive);
+
+	fprintf(out, "\nCall paths\n");
+	fprintf(out, "%14s %14s  %s\n", "inclusive", "exclusive", "path");
+	for (int i = 0; i < stacks->node_count; i++)
+	{
+		call_node *n = &stacks->nodes[order[i]];
+		fprintf(out, "%14llu %14llu  ", (unsigned long long)n->total, (unsigned long long)n->self);
+		print_path(stacks, out, order[i]);
+		fprintf(out, "\n");
+	}
+
+	free(order);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "rv32i.h"
+#include "elfsym.h"
+
+// Shadow call stack profiler
+// The last instruction of every executed run is checked for a call or a
+// return, using the link register conventions of the RISC-V spec (x1 and x5
+// as return address registers). The guest's call stack is mirrored as a path
+// in a call tree, and every instruction is charged to the path it ran under.
+//
+// A return pops down to the frame it returns to, so longjmp-style unwinds
+// that skip frames work, and frames whose stack pointer has been unwound are
+// dropped. With symbols, a plain jump to the start of another function is a
+// tail call and replaces the current frame.
+
+// Deepest guest call stack followed, anything deeper is charged to the last frame
+#define STACK_MAX_DEPTH 256
+
+struct call_node
+{
+	uint32_t func;	 // entry address
+	int parent;		 // -1 for the root
+	uint64_t self;	 // instructions executed in this function, on this path
+	uint64_t total;	 // including callees, filled in when reporting
+};
+typedef struct call_node call_node;
+
+struct call_frame
+{
+	int node;
+	uint32_t ret; // address the call returns to
+	uint32_t sp;  // stack pointer at the call
+};
+typedef struct call_frame call_frame;
+
+struct call_stacks
+{
+	call_node *nodes;
+	int node_count;
+	int node_cap;
+
+	int *hash; // (parent, func) -> node, -1 for empty slots
+	int hash_size;
+
+	call_frame stack[STACK_MAX_DEPTH];
+	int depth;
+	int lost; // calls made past STACK_MAX_DEPTH and not returned from yet
+
+	elf_symbols *syms; // names, and function starts for tail calls, may be NULL
+};
+typedef struct call_stacks call_stacks;
+
+int stacks_init(call_stacks *stacks, uint32_t entry, elf_symbols *syms);
+void stacks_free(call_stacks *stacks);
+
+void stacks_step(call_stacks *stacks, rv32core *core, uint32_t pc, uint64_t n);
+
+// Charge n more instructions to the current path
+static inline void stacks_count(call_stacks *stacks, uint64_t n)
+{
+	stacks->nodes[stacks->stack[stacks->depth - 1].node].self += n;
+}
+
+void stacks_write_folded(call_stacks *stacks, FILE *out);
+void stacks_report(call_stacks *stacks, FILE *out);
@@ -0,0 +1,151 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CODE_CACHE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "rv32i.h"
+#include "decode.h"
+#include "codecache.h"
+
+#define CODE_CACHE_MAGIC 0x45444f4332335652ull // "RV32CODE"
+
+// File header, padded so the op table that follows stays aligned
+struct code_cache_header
+{
+	uint64_t magic;
+	uint64_t key;
+	uint64_t size; // bytes of rv32code following the header
+	uint32_t version; // DECODE_VERSION
+	uint32_t op_size; // sizeof(rv32op)
+};
+
+// 64-bit FNV-1a
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	for (size_t i = 0; i < len; i++)
+	{
+		h ^= p[i];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+// Key identifying the ROM image, the emulator build that decoded it and the
+// decoded format
+static uint64_t code_cache_key(rv32core *core)
+{
+	static const char build[] = __DATE__ " " __TIME__;
+	uint32_t layout[4] = {DECODE_VERSION, sizeof(rv32op), sizeof(rv32code), OPK_COUNT};
+
+	uint64_t h = 0xcbf29ce484222325ull;
+	h = hash_bytes(h, build, sizeof(build));
+	h = hash_bytes(h, layout, sizeof(layout));
+	return hash_bytes(h, core->rom, ROM_SIZE);
+}
+
+static void code_cache_path(char *path, size_t len, const char *dir, uint64_t key)
+{
+	snprintf(path, len, "%s/%016llx.rv32code", dir, (unsigned long long)key);
+}
+
+// Look up the decoded program for the ROM in core
+// Returns NULL if there is no usable cache entry.
+rv32code *code_cache_open(const char *dir, rv32core *core)
+{
+	char path[1024];
+	uint64_t key = code_cache_key(core);
+	code_cache_path(path, sizeof(path), dir, key);
+
+	struct code_cache_header header;
+	size_t total = sizeof(header) + sizeof(rv32code);
+
+#ifdef CODE_CACHE_MMAP
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) || (size_t)st.st_size != total)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	// Private mapping, so anything patching ops later only touches its own copy
+	uint8_t *map = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	memcpy(&header, map, sizeof(header));
+	if (header.magic != CODE_CACHE_MAGIC || header.key != key || header.size != sizeof(rv32code) ||
+		header.version != DECODE_VERSION || header.op_size != sizeof(rv32op))
+	{
+		munmap(map, total);
+		return NULL;
+	}
+	return (rv32code *)(map + sizeof(header));
+#else
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return NULL;
+
+	rv32code *code = malloc(sizeof(rv32code));
+	int ok = code != NULL
+		&& fread(&header, sizeof(header), 1, file) == 1
+		&& header.magic == CODE_CACHE_MAGIC && header.key == key && header.size == sizeof(rv32code)
+		&& header.version == DECODE_VERSION && header.op_size == sizeof(rv32op)
+		&& fread(code, sizeof(rv32code), 1, file) == 1;
+	fclose(file);
+
+	if (!ok)
+	{
+		free(code);
+		return NULL;
+	}
+	return code;
+#endif
+}
+
+// Store the decoded program for the ROM in core
+// The file is written under a temporary name and renamed into place, so
+// concurrent runs never see a partial entry. Returns 0 on success.
+int code_cache_save(const char *dir, rv32code *code, rv32core *core)
+{
+	char path[1024];
+	char tmp[1100];
+	uint64_t key = code_cache_key(core);
+	code_cache_path(path, sizeof(path), dir, key);
+#ifdef CODE_CACHE_MMAP
+	snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+#else
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+#endif
+
+	struct code_cache_header header = {CODE_CACHE_MAGIC, key, sizeof(rv32code), DECODE_VERSION, sizeof(rv32op)};
+
+	FILE *file = fopen(tmp, "wb");
+	if (file == NULL)
+		return -1;
+
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(code, sizeof(rv32code), 1, file) == 1;
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok || rename(tmp, path))
+	{
+		remove(tmp);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include "rv32i.h"
+#include "decode.h"
+
+// Persistent cache of decoded programs
+// The decoded op table of a ROM image is saved to <dir>/<key>.rv32code, where
+// the key hashes the image together with the emulator build. Later runs of
+// the same image map that file instead of decoding again.
+
+rv32code *code_cache_open(const char *dir, rv32core *core);
+int code_cache_save(const char *dir, rv32code *code, rv32core *core);
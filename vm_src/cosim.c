@@ -0,0 +1,232 @@
+#define _CRT_SECURE_NO_WARNINGS // allow building on MSVC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32i.h"
+#include "instructions.h"
+#include "isa.h"
+#include "cosim.h"
+
+// Shadow core starting from the state core is in
+void cosim_start(rv32cosim *c, rv32core *core)
+{
+	memset(c, 0, sizeof(rv32cosim));
+	core_reset(&c->ref);
+	memcpy(c->ref.x, core->x, sizeof(core->x));
+	memcpy(c->ref.f, core->f, sizeof(core->f));
+	c->ref.fcsr = core->fcsr;
+	memcpy(c->ref.ram, core->ram, RAM_SIZE);
+	memcpy(c->ref.rom, core->rom, ROM_SIZE);
+	c->ref.pc = core->pc;
+	c->ref.inst_count = core->inst_count;
+	c->ref.idle.off = 1; // every instruction the checked core skips is run and checked
+	c->ref.cosim = c;
+	core->cosim = c;
+}
+
+void cosim_stop(rv32cosim *c, rv32core *core)
+{
+	core->cosim = NULL;
+	c->ref.cosim = NULL;
+	free(c->loads);
+	c->loads = NULL;
+}
+
+// Device read by the checked core
+void cosim_record(rv32cosim *c, uint32_t addr, uint64_t count, uint32_t value)
+{
+	if (c->load_count == c->load_cap)
+	{
+		int cap = c->load_cap ? 2 * c->load_cap : 64;
+		cosim_read *loads = realloc(c->loads, cap * sizeof(cosim_read));
+		if (loads == NULL)
+		{
+			c->load_mismatch = 1;
+			return;
+		}
+		c->loads = loads;
+		c->load_cap = cap;
+	}
+	c->loads[c->load_count].count = count;
+	c->loads[c->load_count].addr = addr;
+	c->loads[c->load_count].value = value;
+	c->load_count++;
+
+	int i;
+	for (i = 0; i < c->recent_count && c->recent[i].addr != addr; i++)
+		;
+	if (i == COSIM_RECENT)
+		i = count % COSIM_RECENT;
+	else if (i == c->recent_count)
+		c->recent_count++;
+	c->recent[i].addr = addr;
+	c->recent[i].value = value;
+}
+
+// Device read by the shadow core, answered with what the checked core read
+uint32_t cosim_load(rv32cosim *c, uint32_t addr, uint64_t count)
+{
+	// A fast-forwarded loop read the devices once, for all iterations
+	if (c->skipping && c->load_next == c->load_count)
+	{
+		for (int i = 0; i < c->recent_count; i++)
+		{
+			if (c->recent[i].addr == addr)
+				return c->recent[i].value;
+		}
+	}
+
+	if (c->load_next == c->load_count || c->loads[c->load_next].addr != addr || c->loads[c->load_next].count != count)
+	{
+		c->load_mismatch = 1;
+		return 0;
+	}
+	return c->loads[c->load_next++].value;
+}
+
+// Remember the instruction the shadow is about to run, and what it writes
+static void note(rv32cosim *c, rv32core *ref)
+{
+	uint32_t pc = ref->pc;
+	uint32_t inst = (pc & 3) || !inMemory(pc) ? 0 : mem_read_32(ref, pc);
+
+	c->history_pc[c->history_pos % COSIM_HISTORY] = pc;
+	c->history_inst[c->history_pos % COSIM_HISTORY] = inst;
+	c->history_pos++;
+
+	switch (isa_class(isa_decode(inst)))
+	{
+	case ISA_CLASS_ALU:
+	case ISA_CLASS_UPPER:
+	case ISA_CLASS_LOAD:
+	case ISA_CLASS_JUMP:
+	case ISA_CLASS_FTOX:
+	case ISA_CLASS_CSR:
+		c->reg_writer[get_rd(inst)] = pc;
+		break;
+
+	case ISA_CLASS_STORE:
+	case ISA_CLASS_FSTORE:
+	{
+		uint32_t addr = isa_imm(ISA_FMT_S, inst) + ref->x[get_rs1(inst)];
+		uint32_t last = addr + (1 << (get_func3(inst) & 3)) - 1;
+		if (addr - RAM_BASE < RAM_SIZE)
+			c->mem_writer[(addr - RAM_BASE) / 4] = pc;
+		if (last - RAM_BASE < RAM_SIZE)
+			c->mem_writer[(last - RAM_BASE) / 4] = pc;
+		break;
+	}
+	}
+}
+
+static int same_state(rv32core *a, rv32core *b)
+{
+	return a->pc == b->pc && a->inst_count == b->inst_count && !memcmp(&a->x[1], &b->x[1], 31 * sizeof(uint32_t)) &&
+		   !memcmp(a->f, b->f, sizeof(a->f)) && a->fcsr == b->fcsr && !memcmp(a->ram, b->ram, RAM_SIZE);
+}
+
+// Called after every step of the checked core, which started at pc and
+// ended with fault. skipped is set for fast-forwarded spin loops.
+// Returns fault, or COSIM_DIVERGED if the shadow ends up elsewhere.
+int cosim_step(rv32cosim *c, rv32core *core, uint32_t pc, int fault, int skipped)
+{
+	rv32core *ref = &c->ref;
+	int ref_fault = 0;
+
+	c->skipping = skipped;
+	while (!ref_fault && ref->inst_count < core->inst_count)
+	{
+		note(c, ref);
+		ref_fault = rv32_execute(ref);
+	}
+
+	// Stopping for the debugger isn't something the instruction did
+	int expected = fault == DEBUG_BREAK ? 0 : fault;
+
+	// Some faults stop before the instruction counts as run
+	if (expected && !ref_fault)
+	{
+		note(c, ref);
+		ref_fault = rv32_execute(ref);
+	}
+	c->steps++;
+	if (ref_fault == expected && !c->load_mismatch && c->load_next == c->load_count && same_state(core, ref))
+	{
+		c->load_count = 0;
+		c->load_next = 0;
+		return fault;
+	}
+
+	c->diverged_at = core->inst_count;
+	c->step_pc = pc;
+	c->fault = fault;
+	c->ref_fault = ref_fault;
+	return COSIM_DIVERGED;
+}
+
+void cosim_report(rv32cosim *c, rv32core *core, FILE *out)
+{
+	rv32core *ref = &c->ref;
+
+	if (!c->diverged_at)
+	{
+		fprintf(out, "Engines agreed over %llu steps\n", (unsigned long long)c->steps);
+		return;
+	}
+
+	fprintf(out, "Engines diverged at instruction %llu, %s at 0x%08x\n", (unsigned long long)c->diverged_at,
+			c->skipping ? "fast-forwarding the loop" : "in the block", c->step_pc);
+	fprintf(out, "                fast        reference\n");
+	if (ref->inst_count != core->inst_count)
+		fprintf(out, "  instructions  %-10llu  %llu\n", (unsigned long long)core->inst_count,
+				(unsigned long long)ref->inst_count);
+	if (c->ref_fault != (c->fault == DEBUG_BREAK ? 0 : c->fault))
+		fprintf(out, "  fault         %-10d  %d\n", c->fault, c->ref_fault);
+	if (c->load_mismatch || c->load_next != c->load_count)
+		fprintf(out, "  device reads  %-10d  %d%s\n", c->load_count, c->load_next,
+				c->load_mismatch ? ", then one the fast engine didn't do" : "");
+	if (ref->pc != core->pc)
+		fprintf(out, "  pc            0x%08x  0x%08x\n", core->pc, ref->pc);
+
+	for (int i = 1; i < 32; i++)
+	{
+		if (ref->x[i] != core->x[i])
+			fprintf(out, "  x%-2d           0x%08x  0x%08x  last written by 0x%08x\n", i, core->x[i], ref->x[i],
+					c->reg_writer[i]);
+	}
+	for (int i = 0; i < 32; i++)
+	{
+		if (ref->f[i] != core->f[i])
+			fprintf(out, "  f%-2d           0x%08x  0x%08x\n", i, core->f[i], ref->f[i]);
+	}
+	if (ref->fcsr != core->fcsr)
+		fprintf(out, "  fcsr          0x%08x  0x%08x\n", core->fcsr, ref->fcsr);
+
+	int listed = 0;
+	for (int i = 0; i < RAM_SIZE; i++)
+	{
+		if (ref->ram[i] == core->ram[i])
+			continue;
+		if (listed++ == COSIM_MAX_BYTES)
+		{
+			fprintf(out, "  ... more RAM differs\n");
+			break;
+		}
+		fprintf(out, "  0x%08x    0x%02x        0x%02x        last written by 0x%08x\n", RAM_BASE + i, core->ram[i],
+				ref->ram[i], c->mem_writer[i / 4]);
+	}
+
+	fprintf(out, "Last instructions run by the reference:\n");
+	unsigned n = c->history_pos < COSIM_HISTORY ? c->history_pos : COSIM_HISTORY;
+	for (unsigned i = c->history_pos - n; i != c->history_pos; i++)
+	{
+		char text[64];
+		uint32_t pc = c->history_pc[i % COSIM_HISTORY];
+		uint32_t inst = c->history_inst[i % COSIM_HISTORY];
+		isa_disasm(text, sizeof(text), inst, pc);
+		fprintf(out, "  0x%08x  %08x  %s\n", pc, inst, text);
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "rv32i.h"
+
+// Lockstep co-simulation
+// A shadow core runs the same program on the reference interpreter. After
+// every step of the checked core (a block on the fast engine, or a spin loop
+// fast-forwarded) the shadow runs up to the same instruction count, and pc,
+// registers, RAM and faults are compared. RAM is small enough to compare
+// whole every time instead of tracking what was written. The shadow doesn't
+// talk to the devices: its MMIO loads get what the checked core's loads
+// returned and its UART output is dropped. The first difference stops the
+// run with COSIM_DIVERGED.
+
+#define COSIM_HISTORY 16 // reference instructions listed in a report
+#define COSIM_MAX_BYTES 16 // differing RAM bytes listed in a report
+#define COSIM_RECENT 16 // device addresses whose last value is kept
+
+struct cosim_read
+{
+	uint64_t count;
+	uint32_t addr;
+	uint32_t value;
+};
+typedef struct cosim_read cosim_read;
+
+struct rv32cosim
+{
+	rv32core ref; // shadow core
+
+	// MMIO loads of the checked core in the current step, for the shadow
+	cosim_read *loads;
+	int load_count;
+	int load_cap;
+	int load_next;
+	int load_mismatch; // the shadow read another address, or at another count
+	cosim_read recent[COSIM_RECENT]; // latest value read from each address, repeated in skipped loops
+	int recent_count;
+	uint8_t skipping;
+
+	// Who wrote what, to point at the instruction behind a difference
+	uint32_t reg_writer[32];
+	uint32_t mem_writer[RAM_SIZE / 4];
+	uint32_t history_pc[COSIM_HISTORY];
+	uint32_t history_inst[COSIM_HISTORY];
+	unsigned history_pos;
+
+	uint64_t steps; // steps compared
+	uint64_t diverged_at; // inst_count of the step that differed, 0 if none
+	uint32_t step_pc;
+	int fault;
+	int ref_fault;
+};
+typedef struct rv32cosim rv32cosim;
+
+// The shadow core of a co-simulation
+static inline int cosim_shadow(rv32core *core)
+{
+	return core->cosim && core == &core->cosim->ref;
+}
+
+void cosim_start(rv32cosim *c, rv32core *core);
+void cosim_stop(rv32cosim *c, rv32core *core);
+void cosim_report(rv32cosim *c, rv32core *core, FILE *out);
+
+int cosim_step(rv32cosim *c, rv32core *core, uint32_t pc, int fault, int skipped);
+void cosim_record(rv32cosim *c, uint32_t addr, uint64_t count, uint32_t value);
+uint32_t cosim_load(rv32cosim *c, uint32_t addr, uint64_t count);
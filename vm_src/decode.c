@@ -0,0 +1,319 @@
+#include <stdint.h>
+
+#include "rv32i.h"
+#include "instructions.h"
+#include "decode.h"
+#include "gdbstub.h"
+#include "plugin.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DECODE_AVX2
+#include <immintrin.h>
+#endif
+
+// Field extraction, portable version
+static void decode_fields_scalar(const uint8_t *image, int n, decode_fields *f)
+{
+	for (int i = 0; i < n; i++)
+	{
+		const uint8_t *p = &image[4 * i];
+		uint32_t inst = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+
+		f->inst[i] = inst;
+		f->opcode[i] = get_opcode(inst);
+		f->rd[i] = get_rd(inst);
+		f->rs1[i] = get_rs1(inst);
+		f->rs2[i] = get_rs2(inst);
+		f->func3[i] = get_func3(inst);
+		f->func7[i] = get_func7(inst);
+		f->imm_i[i] = signextend_12(imm_type_i(inst));
+		f->imm_s[i] = signextend_12(((inst >> 7) & 0x1F) | ((inst & 0xFE000000) >> 20));
+		f->imm_b[i] = imm_type_b(inst);
+		f->imm_u[i] = inst & 0xFFFFF000;
+		f->imm_j[i] = imm_type_j(inst);
+	}
+}
+
+#ifdef DECODE_AVX2
+// Field extraction, 8 instructions per iteration
+// Immediates are sign extended by arithmetic shifts of the top bit into place.
+__attribute__((target("avx2"))) static void decode_fields_avx2(const uint8_t *image, int n, decode_fields *f)
+{
+	const __m256i m5 = _mm256_set1_epi32(0x1F);
+	const __m256i m3 = _mm256_set1_epi32(0x07);
+	const __m256i m7 = _mm256_set1_epi32(0x7F);
+
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)&image[4 * i]);
+		__m256i sign20 = _mm256_srai_epi32(v, 20); // inst[31:20], sign extended
+
+		_mm256_storeu_si256((__m256i *)&f->inst[i], v);
+		_mm256_storeu_si256((__m256i *)&f->opcode[i], _mm256_and_si256(v, m7));
+		_mm256_storeu_si256((__m256i *)&f->rd[i], _mm256_and_si256(_mm256_srli_epi32(v, 7), m5));
+		_mm256_storeu_si256((__m256i *)&f->rs1[i], _mm256_and_si256(_mm256_srli_epi32(v, 15), m5));
+		_mm256_storeu_si256((__m256i *)&f->rs2[i], _mm256_and_si256(_mm256_srli_epi32(v, 20), m5));
+		_mm256_storeu_si256((__m256i *)&f->func3[i], _mm256_and_si256(_mm256_srli_epi32(v, 12), m3));
+		_mm256_storeu_si256((__m256i *)&f->func7[i], _mm256_srli_epi32(v, 25));
+
+		// I: inst[31:20]
+		_mm256_storeu_si256((__m256i *)&f->imm_i[i], sign20);
+
+		// S: inst[31:25] | inst[11:7]
+		__m256i imm_s = _mm256_or_si256(_mm256_and_si256(sign20, _mm256_set1_epi32(0xFFFFFFE0)),
+										_mm256_and_si256(_mm256_srli_epi32(v, 7), m5));
+		_mm256_storeu_si256((__m256i *)&f->imm_s[i], imm_s);
+
+		// B: inst[31] -> [31:12], inst[7] -> [11], inst[30:25] -> [10:5], inst[11:8] -> [4:1]
+		__m256i imm_b = _mm256_and_si256(_mm256_srai_epi32(v, 19), _mm256_set1_epi32(0xFFFFF000));
+		imm_b = _mm256_or_si256(imm_b, _mm256_and_si256(_mm256_slli_epi32(v, 4), _mm256_set1_epi32(0x800)));
+		imm_b = _mm256_or_si256(imm_b, _mm256_and_si256(_mm256_srli_epi32(v, 20), _mm256_set1_epi32(0x7E0)));
+		imm_b = _mm256_or_si256(imm_b, _mm256_and_si256(_mm256_srli_epi32(v, 7), _mm256_set1_epi32(0x1E)));
+		_mm256_storeu_si256((__m256i *)&f->imm_b[i], imm_b);
+
+		// U: inst[31:12]
+		_mm256_storeu_si256((__m256i *)&f->imm_u[i], _mm256_and_si256(v, _mm256_set1_epi32(0xFFFFF000)));
+
+		// J: inst[31] -> [31:20], inst[19:12] -> [19:12], inst[20] -> [11], inst[30:21] -> [10:1]
+		__m256i imm_j = _mm256_and_si256(_mm256_srai_epi32(v, 11), _mm256_set1_epi32(0xFFF00000));
+		imm_j = _mm256_or_si256(imm_j, _mm256_and_si256(v, _mm256_set1_epi32(0x000FF000)));
+		imm_j = _mm256_or_si256(imm_j, _mm256_and_si256(_mm256_srli_epi32(v, 9), _mm256_set1_epi32(0x800)));
+		imm_j = _mm256_or_si256(imm_j, _mm256_and_si256(_mm256_srli_epi32(v, 20), _mm256_set1_epi32(0x7FE)));
+		_mm256_storeu_si256((__m256i *)&f->imm_j[i], imm_j);
+	}
+
+	if (i < n) // leftovers
+	{
+		decode_fields f_tail;
+		decode_fields_scalar(&image[4 * i], n - i, &f_tail);
+		for (int j = 0; i + j < n; j++)
+		{
+			f->inst[i + j] = f_tail.inst[j];
+			f->opcode[i + j] = f_tail.opcode[j];
+			f->rd[i + j] = f_tail.rd[j];
+			f->rs1[i + j] = f_tail.rs1[j];
+			f->rs2[i + j] = f_tail.rs2[j];
+			f->func3[i + j] = f_tail.func3[j];
+			f->func7[i + j] = f_tail.func7[j];
+			f->imm_i[i + j] = f_tail.imm_i[j];
+			f->imm_s[i + j] = f_tail.imm_s[j];
+			f->imm_b[i + j] = f_tail.imm_b[j];
+			f->imm_u[i + j] = f_tail.imm_u[j];
+			f->imm_j[i + j] = f_tail.imm_j[j];
+		}
+	}
+}
+#endif
+
+// Extract the fields of n (at most DECODE_CHUNK) little-endian instructions
+void decode_fields_bulk(const uint8_t *image, int n, decode_fields *f)
+{
+#ifdef DECODE_AVX2
+	static int has_avx2 = -1;
+	if (has_avx2 < 0)
+		has_avx2 = __builtin_cpu_supports("avx2");
+	if (has_avx2)
+	{
+		decode_fields_avx2(image, n, f);
+		return;
+	}
+#endif
+	decode_fields_scalar(image, n, f);
+}
+
+// Build the op for instruction i of a chunk of extracted fields, located at pc
+// Every invalid encoding becomes OPK_FALLBACK so that rv32_execute reports it,
+// and so does anything the fast engine has no case for.
+static void decode_classify(rv32op *op, const decode_fields *f, int i, uint32_t pc)
+{
+	int id = isa_decode(f->inst[i]);
+
+	op->kind = id == ISA_UNKNOWN ? OPK_FALLBACK : OPK_ISA_FIRST + id;
+	op->rd = f->rd[i];
+	op->rs1 = f->rs1[i];
+	op->rs2 = f->rs2[i];
+	op->imm = f->imm_i[i];
+	op->imm2 = 0;
+	op->rd2 = 0;
+	op->len = 1;
+	op->flags = 0;
+
+	if (op->rd == 0 && !isa_writes_frd(isa_class(id))) // f0 is a register like any other
+		op->rd = REG_SINK;
+
+	if (id == ISA_UNKNOWN)
+		return;
+
+	switch (isa_table[id].format)
+	{
+	case ISA_FMT_SH: op->imm &= 0x1F; break;
+	case ISA_FMT_S:
+	case ISA_FMT_FS: op->imm = f->imm_s[i]; break;
+	case ISA_FMT_B:	 op->imm = pc + f->imm_b[i]; break;
+	case ISA_FMT_U:	 op->imm = f->imm_u[i]; break;
+	case ISA_FMT_J:	 op->imm = pc + f->imm_j[i]; break;
+	case ISA_FMT_CSRI: op->imm = f->rs1[i]; break;
+	}
+
+	int cls = isa_class(id);
+	if (cls == ISA_CLASS_FARITH || cls == ISA_CLASS_FTOX || cls == ISA_CLASS_CSR) // rm, rs3, csr
+		op->imm2 = f->inst[i];
+
+	if (id == ISA_AUIPC) // a constant once the pc is known
+	{
+		op->kind = OPK_LUI;
+		op->imm += pc;
+	}
+}
+
+// Decode one instruction located at pc
+void decode_inst(rv32op *op, uint32_t inst, uint32_t pc)
+{
+	uint8_t image[4] = {inst, inst >> 8, inst >> 16, inst >> 24};
+	decode_fields f;
+
+	decode_fields_scalar(image, 1, &f);
+	decode_classify(op, &f, 0, pc);
+}
+
+// Try to fuse an instruction with the one following it
+// On success first becomes the fused op and 1 is returned. second is left
+// alone, so a jump landing on it still executes it on its own.
+int decode_fuse(rv32op *first, const rv32op *second)
+{
+	uint8_t rd = first->rd;
+
+	// The second instruction always consumes the first one's result
+	if (second->rs1 != rd)
+		return 0;
+
+	switch (first->kind)
+	{
+
+	case OPK_LUI: // lui/auipc + addi, jalr or lw
+		if (second->kind == OPK_ADDI)
+		{
+			first->kind = OPK_CONST2;
+			first->imm2 = first->imm + second->imm;
+		}
+		else if (second->kind == OPK_JALR)
+		{
+			first->kind = OPK_CALL;
+			first->imm2 = (first->imm + second->imm) & 0xFFFFFFFE;
+		}
+		else if (second->kind == OPK_LW)
+		{
+			first->kind = OPK_CONST_LW;
+			first->imm2 = first->imm + second->imm;
+		}
+		else
+			return 0;
+		first->rd2 = second->rd;
+		break;
+
+	case OPK_SLLI: // slli + srli/srai in place
+		if (second->rd != rd)
+			return 0;
+		if (second->kind == OPK_SRLI)
+			first->kind = OPK_SLLI_SRLI;
+		else if (second->kind == OPK_SRAI)
+			first->kind = OPK_SLLI_SRAI;
+		else
+			return 0;
+		first->imm2 = second->imm;
+		break;
+
+	case OPK_SLT:
+	case OPK_SLTU:
+	case OPK_SLTI:
+	case OPK_SLTIU: // set-less-than + beqz/bnez on the result
+		if ((second->kind != OPK_BEQ && second->kind != OPK_BNE) || second->rs2 != 0)
+			return 0;
+		switch (first->kind)
+		{
+		case OPK_SLT:	first->kind = OPK_SLT_BR; break;
+		case OPK_SLTU:	first->kind = OPK_SLTU_BR; break;
+		case OPK_SLTI:	first->kind = OPK_SLTI_BR; break;
+		case OPK_SLTIU: first->kind = OPK_SLTIU_BR; break;
+		}
+		first->flags = (second->kind == OPK_BNE);
+		first->imm2 = second->imm;
+		break;
+
+	default:
+		return 0;
+	}
+
+	first->len = 2;
+	return 1;
+}
+
+// Decode the whole ROM image in one pass, fusing instruction pairs where possible
+// RAM starts out undecoded.
+void code_load(rv32code *code, rv32core *core)
+{
+	decode_fields f;
+
+	for (int base = 0; base < ROM_SIZE / 4; base += DECODE_CHUNK)
+	{
+		decode_fields_bulk(&core->rom[4 * base], DECODE_CHUNK, &f);
+
+		for (int i = 0; i < DECODE_CHUNK; i++)
+		{
+			int index = base + i;
+			decode_classify(&code->rom[index], &f, i, ROM_BASE + 4 * index);
+			if (index)
+				decode_fuse(&code->rom[index - 1], &code->rom[index]);
+		}
+	}
+
+	for (int page = 0; page < CODE_PAGES; page++)
+		code_invalidate_page(code, page);
+
+	decode_inst(&code->rom[ROM_SIZE / 4], 0, ROM_END); // never valid, always falls back
+	decode_inst(&code->ram[RAM_SIZE / 4], 0, RAM_END);
+}
+
+// Decode the RAM page holding addr and mark it as containing code
+// Pairs are only fused within the page, so invalidating a page never leaves
+// a stale fused op behind in its neighbour.
+void code_decode_page(rv32code *code, rv32core *core, uint32_t addr)
+{
+	int page = (addr - RAM_BASE) / CODE_PAGE_SIZE;
+	int first = page * (CODE_PAGE_SIZE / 4);
+	uint8_t tier = core->tier;
+	decode_fields f;
+
+	core->tier = TIER_DECODE;
+
+	for (int base = 0; base < CODE_PAGE_SIZE / 4; base += DECODE_CHUNK)
+	{
+		decode_fields_bulk(&core->ram[4 * (first + base)], DECODE_CHUNK, &f);
+
+		for (int i = 0; i < DECODE_CHUNK; i++)
+		{
+			int index = first + base + i;
+			decode_classify(&code->ram[index], &f, i, RAM_BASE + 4 * index);
+			if (base + i)
+				decode_fuse(&code->ram[index - 1], &code->ram[index]);
+		}
+	}
+
+	code->ram_code[page] = 1;
+	if (core->plugins)
+		plugin_patch_page(core->plugins, core, page);
+	if (core->gdb)
+		gdb_patch_page(core->gdb, core, page);
+	core->tier = tier;
+}
+
+// Forget the decoded ops of a RAM page
+void code_invalidate_page(rv32code *code, int page)
+{
+	int first = page * (CODE_PAGE_SIZE / 4);
+	for (int i = 0; i < CODE_PAGE_SIZE / 4; i++)
+		code->ram[first + i].kind = OPK_DECODE;
+
+	code->ram_code[page] = 0;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdint.h>
+#include "rv32i.h"
+#include "isa.h"
+
+// Predecoded instructions
+// Every word of ROM is decoded once, up front, into an rv32op that the fast
+// engine executes directly. Register fields are extracted, immediates are
+// sign extended, pc-relative targets are turned into absolute addresses and
+// writes to x0 are redirected to a sink register, so nothing has to clear x0
+// after every instruction.
+
+// Register that receives writes to x0
+#define REG_SINK 32
+
+enum
+{
+	OPK_FALLBACK, // not handled by the fast engine, run through rv32_execute
+	OPK_DECODE,	  // RAM not decoded yet, or overwritten since
+	OPK_BREAK,	  // debugger breakpoint, stops before the instruction
+
+	// One kind per instruction of isa.h, OPK_<id>. Branches and jumps hold
+	// their absolute target in imm, auipc becomes an OPK_LUI of its result.
+#define ISA_OPK(id, mnemonic, format, class, match, mask, semantics) OPK_##id,
+	RV32_ISA(ISA_OPK)
+#undef ISA_OPK
+
+	// Fused pairs, executed as a single op
+	OPK_CONST2,	   // lui/auipc rd + addi rd2, rd: x[rd] = imm, x[rd2] = imm2
+	OPK_CALL,	   // auipc rd + jalr rd2, rd: x[rd] = imm, link in rd2, jump to imm2
+	OPK_CONST_LW,  // auipc rd + lw rd2, (rd): x[rd] = imm, x[rd2] = mem[imm2]
+	OPK_SLLI_SRLI, // slli rd + srli rd, rd: zero extension / bitfield extract
+	OPK_SLLI_SRAI, // slli rd + srai rd, rd: sign extension
+	OPK_SLT_BR,	   // slt/sltu/slti/sltiu rd + beqz/bnez rd, jump to imm2
+	OPK_SLTU_BR,
+	OPK_SLTI_BR,
+	OPK_SLTIU_BR,
+
+	OPK_COUNT
+};
+
+// Kinds of isa.h instructions start right after OPK_BREAK, in table order
+#define OPK_ISA_FIRST (OPK_BREAK + 1)
+
+// Instruction id an op kind stands for, ISA_UNKNOWN for fused and special kinds
+static inline int decode_kind_isa(uint8_t kind)
+{
+	return kind >= OPK_ISA_FIRST && kind < OPK_ISA_FIRST + ISA_COUNT ? kind - OPK_ISA_FIRST : ISA_UNKNOWN;
+}
+
+// Version of the decoded format, kept with cached programs. Bump it whenever
+// decoding or rv32op changes, so programs decoded by older builds are dropped.
+#define DECODE_VERSION 1
+
+struct rv32op
+{
+	uint8_t kind;
+	uint8_t rd;
+	uint8_t rs1;
+	uint8_t rs2;
+	uint32_t imm;
+	uint32_t imm2; // second immediate of a fused pair, the instruction of a floating point op
+	uint8_t rd2;   // second destination of a fused pair
+	uint8_t len;   // guest instructions covered (2 for fused pairs)
+	uint8_t flags; // fused compare and branch: 1 to branch on a nonzero result
+};
+typedef struct rv32op rv32op;
+
+// Instruction fields, extracted in bulk a chunk at a time
+#define DECODE_CHUNK 64
+
+struct decode_fields
+{
+	uint32_t inst[DECODE_CHUNK];
+	uint32_t opcode[DECODE_CHUNK];
+	uint32_t rd[DECODE_CHUNK];
+	uint32_t rs1[DECODE_CHUNK];
+	uint32_t rs2[DECODE_CHUNK];
+	uint32_t func3[DECODE_CHUNK];
+	uint32_t func7[DECODE_CHUNK];
+	uint32_t imm_i[DECODE_CHUNK]; // all immediates sign extended
+	uint32_t imm_s[DECODE_CHUNK];
+	uint32_t imm_b[DECODE_CHUNK];
+	uint32_t imm_u[DECODE_CHUNK];
+	uint32_t imm_j[DECODE_CHUNK];
+};
+typedef struct decode_fields decode_fields;
+
+// RAM-resident code is decoded a page at a time, when first executed
+#define CODE_PAGE_SIZE 256
+#define CODE_PAGES (RAM_SIZE / CODE_PAGE_SIZE)
+
+// Decoded program
+// Each table has a fallback entry at the end, stopping blocks that run off it.
+struct rv32code
+{
+	rv32op rom[ROM_SIZE / 4 + 1];
+	rv32op ram[RAM_SIZE / 4 + 1];
+	uint8_t ram_code[CODE_PAGES]; // 1 if the RAM page has decoded ops
+};
+typedef struct rv32code rv32code;
+
+void decode_fields_bulk(const uint8_t *image, int n, decode_fields *f);
+void decode_inst(rv32op *op, uint32_t inst, uint32_t pc);
+int decode_fuse(rv32op *first, const rv32op *second);
+
+void code_load(rv32code *code, rv32core *core);
+void code_decode_page(rv32code *code, rv32core *core, uint32_t addr);
+void code_invalidate_page(rv32code *code, int page);
+
+// Drop decoded ops overwritten by a store of len bytes at addr
+static inline void code_invalidate_store(rv32code *code, uint32_t addr, int len)
+{
+	uint32_t first = addr - RAM_BASE;
+	uint32_t last = first + len - 1;
+
+	if (first < RAM_SIZE && code->ram_code[first / CODE_PAGE_SIZE])
+		code_invalidate_page(code, first / CODE_PAGE_SIZE);
+	if (last < RAM_SIZE && code->ram_code[last / CODE_PAGE_SIZE])
+		code_invalidate_page(code, last / CODE_PAGE_SIZE);
+}
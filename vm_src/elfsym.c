@@ -0,0 +1,627 @@
+#define _CRT_SECURE_NO_WARNINGS // allow building on MSVC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "elfsym.h"
+
+// ELF32 section types and flags
+#define SHT_SYMTAB 2
+#define SHF_EXECINSTR 4
+
+// Symbol types
+#define STT_NOTYPE 0
+#define STT_FUNC 2
+
+// DWARF forms used by version 5 line table headers
+#define DW_FORM_block 0x09
+#define DW_FORM_data1 0x0b
+#define DW_FORM_data2 0x05
+#define DW_FORM_data4 0x06
+#define DW_FORM_data8 0x07
+#define DW_FORM_data16 0x1e
+#define DW_FORM_string 0x08
+#define DW_FORM_strp 0x0e
+#define DW_FORM_udata 0x0f
+#define DW_FORM_line_strp 0x1f
+
+#define DW_LNCT_path 1
+
+// Line number opcodes
+#define DW_LNS_copy 1
+#define DW_LNS_advance_pc 2
+#define DW_LNS_advance_line 3
+#define DW_LNS_set_file 4
+#define DW_LNS_const_add_pc 8
+#define DW_LNS_fixed_advance_pc 9
+#define DW_LNE_end_sequence 1
+#define DW_LNE_set_address 2
+
+// Most file entries a line table header may declare
+#define MAX_FILES 256
+
+// Bounds-checked little-endian reader
+struct reader
+{
+	const uint8_t *p;
+	const uint8_t *end;
+	int bad;
+};
+typedef struct reader reader;
+
+static const uint8_t *take(reader *r, uint32_t n)
+{
+	if (r->bad || (uint32_t)(r->end - r->p) < n)
+	{
+		r->bad = 1;
+		return NULL;
+	}
+	const uint8_t *p = r->p;
+	r->p += n;
+	return p;
+}
+
+static uint64_t read_u(reader *r, int n)
+{
+	const uint8_t *p = take(r, n);
+	uint64_t v = 0;
+	for (int i = n - 1; p && i >= 0; i--)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static uint64_t read_uleb(reader *r)
+{
+	uint64_t v = 0;
+	for (int shift = 0; ; shift += 7)
+	{
+		const uint8_t *p = take(r, 1);
+		if (!p)
+			return 0;
+		if (shift < 64)
+			v |= (uint64_t)(*p & 0x7f) << shift;
+		if (!(*p & 0x80))
+			return v;
+	}
+}
+
+static int64_t read_sleb(reader *r)
+{
+	int64_t v = 0;
+	int shift = 0;
+	for (;;)
+	{
+		const uint8_t *p = take(r, 1);
+		if (!p)
+			return 0;
+		if (shift < 64)
+			v |= (int64_t)(*p & 0x7f) << shift;
+		shift += 7;
+		if (!(*p & 0x80))
+		{
+			if (shift < 64 && (*p & 0x40))
+				v |= -((int64_t)1 << shift);
+			return v;
+		}
+	}
+}
+
+static const char *read_str(reader *r)
+{
+	const char *s = (const char *)r->p;
+	const uint8_t *nul = r->bad ? NULL : memchr(r->p, 0, r->end - r->p);
+	if (!nul)
+	{
+		r->bad = 1;
+		return NULL;
+	}
+	r->p = nul + 1;
+	return s;
+}
+
+// String at offset in a string section, NULL if out of range
+static const char *section_str(const uint8_t *sec, uint32_t size, uint64_t offset)
+{
+	if (!sec || offset >= size || !memchr(sec + offset, 0, size - offset))
+		return NULL;
+	return (const char *)sec + offset;
+}
+
+// ELF32 section header
+struct section
+{
+	uint32_t name;
+	uint32_t type;
+	uint32_t flags;
+	uint32_t offset;
+	uint32_t size;
+	uint32_t link;
+};
+typedef struct section section;
+
+static int get_section(elf_symbols *syms, int i, section *s)
+{
+	const uint8_t *e = syms->image;
+	uint32_t shoff = e[0x20] | (e[0x21] << 8) | (e[0x22] << 16) | ((uint32_t)e[0x23] << 24);
+	uint32_t shentsize = e[0x2e] | (e[0x2f] << 8);
+
+	reader r = {e, e + syms->size, 0};
+	if (shentsize < 40 || !take(&r, shoff) || !take(&r, i * shentsize))
+		return 0;
+	s->name = read_u(&r, 4);
+	s->type = read_u(&r, 4);
+	s->flags = read_u(&r, 4);
+	read_u(&r, 4); // address
+	s->offset = read_u(&r, 4);
+	s->size = read_u(&r, 4);
+	s->link = read_u(&r, 4);
+	if (r.bad || s->offset > syms->size || s->size > syms->size - s->offset)
+		return 0;
+	return 1;
+}
+
+static const uint8_t *find_section(elf_symbols *syms, int count, const char *shstr, uint32_t shstr_size,
+								   const char *name, uint32_t *size)
+{
+	section s;
+	for (int i = 1; i < count; i++)
+	{
+		const char *n = get_section(syms, i, &s) ? section_str((const uint8_t *)shstr, shstr_size, s.name) : NULL;
+		if (n && !strcmp(n, name))
+		{
+			*size = s.size;
+			return syms->image + s.offset;
+		}
+	}
+	*size = 0;
+	return NULL;
+}
+
+static int func_order(const void *a, const void *b)
+{
+	const elf_func *x = a, *y = b;
+	if (x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	return (x->size > y->size) - (x->size < y->size); // sized entries last, looked at first
+}
+
+// Function symbols, plus untyped labels in code (hand-written assembly)
+static void load_symbols(elf_symbols *syms, int count, section *symtab)
+{
+	section strtab, target;
+	if (!get_section(syms, symtab->link, &strtab))
+		return;
+
+	const uint8_t *strs = syms->image + strtab.offset;
+	int n = symtab->size / 16;
+	syms->funcs = malloc(n * sizeof(elf_func));
+	if (!syms->funcs)
+		return;
+
+	reader r = {syms->image + symtab->offset, syms->image + symtab->offset + symtab->size, 0};
+	for (int i = 0; i < n; i++)
+	{
+		uint32_t name = read_u(&r, 4);
+		uint32_t value = read_u(&r, 4);
+		uint32_t size = read_u(&r, 4);
+		uint8_t info = read_u(&r, 1);
+		read_u(&r, 1);
+		uint16_t shndx = read_u(&r, 2);
+
+		int type = info & 0xf;
+		if (type != STT_FUNC && type != STT_NOTYPE)
+			continue;
+		if (!shndx || shndx >= count || !get_section(syms, shndx, &target) || !(target.flags & SHF_EXECINSTR))
+			continue;
+
+		const char *s = section_str(strs, strtab.size, name);
+		if (!s || !*s || s[0] == '$' || s[0] == '.') // mapping symbols and local labels
+			continue;
+
+		elf_func *f = &syms->funcs[syms->func_count++];
+		f->addr = value;
+		f->size = size;
+		f->name = s;
+	}
+
+	qsort(syms->funcs, syms->func_count, sizeof(elf_func), func_order);
+}
+
+// Appends a row to the line table
+// A row at the same address as the previous one of its sequence replaces it.
+static void add_row(elf_symbols *syms, int *cap, int seq_start, uint32_t addr, uint32_t line, const char *file)
+{
+	if (syms->line_count > seq_start && syms->lines[syms->line_count - 1].addr == addr)
+	{
+		syms->lines[syms->line_count - 1].line = line;
+		syms->lines[syms->line_count - 1].file = file;
+		return;
+	}
+
+	if (syms->line_count == *cap)
+	{
+		int n = *cap ? *cap * 2 : 1024;
+		elf_line *rows = realloc(syms->lines, n * sizeof(elf_line));
+		if (!rows)
+			return;
+		syms->lines = rows;
+		*cap = n;
+	}
+
+	elf_line *l = &syms->lines[syms->line_count++];
+	l->addr = addr;
+	l->line = line;
+	l->file = file;
+}
+
+// Reads one attribute of a version 5 directory or file entry
+// Returns the string for path forms, NULL for anything else.
+static const char *read_form(reader *r, uint64_t form, int offset_size,
+							 const uint8_t *str, uint32_t str_size, const uint8_t *line_str, uint32_t line_str_size)
+{
+	switch (form)
+	{
+
+	case DW_FORM_string:
+		return read_str(r);
+
+	case DW_FORM_strp:
+		return section_str(str, str_size, read_u(r, offset_size));
+
+	case DW_FORM_line_strp:
+		return section_str(line_str, line_str_size, read_u(r, offset_size));
+
+	case DW_FORM_udata:
+		read_uleb(r);
+		return NULL;
+
+	case DW_FORM_data1:
+	case DW_FORM_data2:
+	case DW_FORM_data4:
+	case DW_FORM_data8:
+		take(r, form == DW_FORM_data1 ? 1 : form == DW_FORM_data2 ? 2 : form == DW_FORM_data4 ? 4 : 8);
+		return NULL;
+
+	case DW_FORM_data16:
+		take(r, 16);
+		return NULL;
+
+	case DW_FORM_block:
+		take(r, read_uleb(r));
+		return NULL;
+
+	default: // can't skip what we don't know
+		r->bad = 1;
+		return NULL;
+	}
+}
+
+// Reads a version 5 entry format description and its entries
+// Only the path of each entry is kept.
+static int read_entries(reader *r, int offset_size, const char **names, int max,
+						const uint8_t *str, uint32_t str_size, const uint8_t *line_str, uint32_t line_str_size)
+{
+	uint64_t format[16][2];
+	int format_count = read_u(r, 1);
+	if (format_count > 16)
+	{
+		r->bad = 1;
+		return 0;
+	}
+	for (int i = 0; i < format_count; i++)
+	{
+		format[i][0] = read_uleb(r);
+		format[i][1] = read_uleb(r);
+	}
+
+	int count = read_uleb(r);
+	for (int i = 0; i < count && !r->bad; i++)
+	{
+		const char *path = NULL;
+		for (int j = 0; j < format_count; j++)
+		{
+			const char *s = read_form(r, format[j][1], offset_size, str, str_size, line_str, line_str_size);
+			if (format[j][0] == DW_LNCT_path)
+				path = s;
+		}
+		if (i < max)
+			names[i] = path;
+	}
+	return count < max ? count : max;
+}
+
+// Runs the line number program of every unit in .debug_line
+static void load_lines(elf_symbols *syms, const uint8_t *debug_line, uint32_t size,
+					   const uint8_t *str, uint32_t str_size, const uint8_t *line_str, uint32_t line_str_size)
+{
+	static const char *files[MAX_FILES];
+	reader unit = {debug_line, debug_line + size, 0};
+	int cap = 0;
+	int seq_start = 0;
+
+	while (unit.p < unit.end && !unit.bad)
+	{
+		int offset_size = 4;
+		uint64_t length = read_u(&unit, 4);
+		if (length == 0xffffffff)
+		{
+			offset_size = 8;
+			length = read_u(&unit, 8);
+		}
+
+		const uint8_t *start = take(&unit, length);
+		if (!start)
+			return;
+
+		reader r = {start, start + length, 0};
+		int version = read_u(&r, 2);
+		if (version < 2 || version > 5)
+			continue;
+		if (version >= 5)
+			take(&r, 2); // address and segment selector sizes
+
+		uint64_t header_length = read_u(&r, offset_size);
+		reader h = {r.p, r.p, 0};
+		if (!take(&r, header_length))
+			continue;
+		h.end = r.p;
+
+		int min_inst = read_u(&h, 1);
+		if (version >= 4)
+			read_u(&h, 1); // max ops per instruction, VLIW only
+		read_u(&h, 1); // default is_stmt, every row is kept
+		int line_base = (int8_t)read_u(&h, 1);
+		int line_range = read_u(&h, 1);
+		int opcode_base = read_u(&h, 1);
+		const uint8_t *opcode_lengths = take(&h, opcode_base > 0 ? opcode_base - 1 : 0);
+		if (h.bad || !line_range || !opcode_base)
+			continue;
+
+		int file_count = 0;
+		int file_first = 0; // index of the first file entry
+		if (version >= 5)
+		{
+			const char *dirs[MAX_FILES];
+			read_entries(&h, offset_size, dirs, MAX_FILES, str, str_size, line_str, line_str_size);
+			file_count = read_entries(&h, offset_size, files, MAX_FILES, str, str_size, line_str, line_str_size);
+		}
+		else
+		{
+			while (!h.bad && h.p < h.end && *h.p)
+				read_str(&h); // include directories
+			take(&h, 1);
+
+			file_first = 1;
+			while (!h.bad && h.p < h.end && *h.p)
+			{
+				const char *name = read_str(&h);
+				read_uleb(&h); // directory
+				read_uleb(&h); // modification time
+				read_uleb(&h); // length
+				if (file_count < MAX_FILES)
+					files[file_count++] = name;
+			}
+		}
+		if (h.bad)
+			continue;
+
+		// State machine registers
+		seq_start = syms->line_count;
+		uint32_t addr = 0;
+		int64_t line = 1;
+		uint64_t file = 1;
+
+		while (r.p < r.end && !r.bad)
+		{
+			int op = read_u(&r, 1);
+			int emit = 0;
+
+			if (op >= opcode_base)
+			{
+				int adj = op - opcode_base;
+				addr += (adj / line_range) * min_inst;
+				line += line_base + adj % line_range;
+				emit = 1;
+			}
+			else if (op == 0)
+			{
+				uint64_t len = read_uleb(&r);
+				reader e = {r.p, r.p, 0};
+				if (!take(&r, len) || !len)
+					break;
+				e.end = r.p;
+
+				int sub = read_u(&e, 1);
+				if (sub == DW_LNE_end_sequence)
+				{
+					add_row(syms, &cap, seq_start, addr, 0, NULL);
+					seq_start = syms->line_count;
+					addr = 0;
+					line = 1;
+					file = 1;
+				}
+				else if (sub == DW_LNE_set_address)
+					addr = read_u(&e, len - 1 > 8 ? 8 : (int)len - 1);
+			}
+			else
+			{
+				switch (op)
+				{
+
+				case DW_LNS_copy:
+					emit = 1;
+					break;
+
+				case DW_LNS_advance_pc:
+					addr += read_uleb(&r) * min_inst;
+					break;
+
+				case DW_LNS_advance_line:
+					line += read_sleb(&r);
+					break;
+
+				case DW_LNS_set_file:
+					file = read_uleb(&r);
+					break;
+
+				case DW_LNS_const_add_pc:
+					addr += ((255 - opcode_base) / line_range) * min_inst;
+					break;
+
+				case DW_LNS_fixed_advance_pc:
+					addr += read_u(&r, 2);
+					break;
+
+				default: // skip the operands of anything else
+					for (int i = 0; i < opcode_lengths[op - 1]; i++)
+						read_uleb(&r);
+					break;
+				}
+			}
+
+			if (emit && line > 0)
+			{
+				uint64_t f = file - file_first;
+				add_row(syms, &cap, seq_start, addr, line, f < (uint64_t)file_count && files[f] ? files[f] : "??");
+			}
+		}
+	}
+}
+
+static int line_order(const void *a, const void *b)
+{
+	const elf_line *x = a, *y = b;
+	if (x->addr != y->addr)
+		return x->addr < y->addr ? -1 : 1;
+	if ((x->line == 0) != (y->line == 0))
+		return x->line == 0 ? -1 : 1; // the end of one sequence before the start of the next
+	return 0;
+}
+
+// Load the symbols and line tables of an ELF32 file, NULL if it can't be read
+elf_symbols *elfsym_load(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return NULL;
+
+	elf_symbols *syms = calloc(1, sizeof(elf_symbols));
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (syms && size > 0x34)
+		syms->image = malloc(size);
+	if (!syms || !syms->image || fread(syms->image, 1, size, f) != (size_t)size)
+	{
+		fclose(f);
+		elfsym_free(syms);
+		return NULL;
+	}
+	fclose(f);
+	syms->size = size;
+
+	// 32-bit little-endian ELF only
+	const uint8_t *e = syms->image;
+	if (memcmp(e, "\x7f" "ELF", 4) || e[4] != 1 || e[5] != 1)
+	{
+		elfsym_free(syms);
+		return NULL;
+	}
+
+	int count = e[0x30] | (e[0x31] << 8);
+	int shstrndx = e[0x32] | (e[0x33] << 8);
+	section shstr, s;
+	if (!get_section(syms, shstrndx, &shstr))
+	{
+		elfsym_free(syms);
+		return NULL;
+	}
+	const char *shstrs = (const char *)syms->image + shstr.offset;
+
+	for (int i = 1; i < count; i++)
+	{
+		if (get_section(syms, i, &s) && s.type == SHT_SYMTAB)
+		{
+			load_symbols(syms, count, &s);
+			break;
+		}
+	}
+
+	uint32_t line_size, str_size, line_str_size;
+	const uint8_t *debug_line = find_section(syms, count, shstrs, shstr.size, ".debug_line", &line_size);
+	const uint8_t *str = find_section(syms, count, shstrs, shstr.size, ".debug_str", &str_size);
+	const uint8_t *line_str = find_section(syms, count, shstrs, shstr.size, ".debug_line_str", &line_str_size);
+	if (debug_line)
+		load_lines(syms, debug_line, line_size, str, str_size, line_str, line_str_size);
+	if (syms->lines)
+		qsort(syms->lines, syms->line_count, sizeof(elf_line), line_order);
+
+	return syms;
+}
+
+void elfsym_free(elf_symbols *syms)
+{
+	if (syms == NULL)
+		return;
+	free(syms->funcs);
+	free(syms->lines);
+	free(syms->image);
+	free(syms);
+}
+
+// Name of the function containing addr, NULL if there is none
+// offset is set to the distance from the start of the function.
+const char *elfsym_function(elf_symbols *syms, uint32_t addr, uint32_t *offset)
+{
+	int lo = 0, hi = syms->func_count; // find the last symbol at or below addr
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (syms->funcs[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	// A sized symbol covering addr wins over labels inside it, otherwise
+	// the nearest label is used
+	elf_func *found = NULL;
+	for (int i = lo - 1; i >= 0; i--)
+	{
+		elf_func *f = &syms->funcs[i];
+		if (f->size)
+		{
+			if (addr - f->addr < f->size)
+				found = f;
+			break;
+		}
+		if (!found)
+			found = f;
+	}
+
+	if (found == NULL)
+		return NULL;
+	*offset = addr - found->addr;
+	return found->name;
+}
+
+// Source line of addr, 0 if the line tables don't cover it
+int elfsym_line(elf_symbols *syms, uint32_t addr, const char **file)
+{
+	int lo = 0, hi = syms->line_count;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (syms->lines[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0 || syms->lines[lo - 1].line == 0)
+		return 0;
+	*file = syms->lines[lo - 1].file;
+	return syms->lines[lo - 1].line;
+}
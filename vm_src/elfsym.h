@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+// Guest symbols
+// Function names come from the ELF symbol table and source lines from the
+// DWARF line tables (.debug_line, versions 2 to 5) of the image the ROM was
+// built from, so guest addresses can be reported the way objdump -S shows them.
+
+struct elf_func
+{
+	uint32_t addr;
+	uint32_t size;
+	const char *name;
+};
+typedef struct elf_func elf_func;
+
+struct elf_line
+{
+	uint32_t addr;
+	uint32_t line; // 0 ends a sequence, the address has no line
+	const char *file;
+};
+typedef struct elf_line elf_line;
+
+struct elf_symbols
+{
+	uint8_t *image; // whole file, names point into it
+	uint32_t size;
+
+	elf_func *funcs; // sorted by address
+	int func_count;
+
+	elf_line *lines; // sorted by address
+	int line_count;
+};
+typedef struct elf_symbols elf_symbols;
+
+elf_symbols *elfsym_load(const char *path);
+void elfsym_free(elf_symbols *syms);
+
+const char *elfsym_function(elf_symbols *syms, uint32_t addr, uint32_t *offset);
+int elfsym_line(elf_symbols *syms, uint32_t addr, const char **file);
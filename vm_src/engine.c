@@ -0,0 +1,229 @@
+#include <stdint.h>
+
+#include "rv32i.h"
+#include "decode.h"
+#include "engine.h"
+#include "fpu.h"
+
+// Cases of the engine's switch generated from isa.h, one macro per class
+// Upper immediates and jumps depend on the pc, they are written out below.
+// Floating point ops and csr accesses keep their instruction word in imm2,
+// for rm, rs3 and the csr number.
+#define RS1 x[op->rs1]
+#define RS2 x[op->rs2]
+#define IMM op->imm
+#define F1 fpu_float(core->f[op->rs1])
+#define F2 fpu_float(core->f[op->rs2])
+#define F3 fpu_float(core->f[op->imm2 >> 27])
+#define FB1 core->f[op->rs1]
+#define FB2 core->f[op->rs2]
+#define RM rm
+#define CSR csr
+
+#define ENGINE_ALU(id, semantics) \
+	case OPK_##id: x[op->rd] = (semantics); op++; continue;
+#define ENGINE_UPPER(id, semantics)
+#define ENGINE_LOAD(id, semantics) \
+	case OPK_##id: x[op->rd] = engine_load(core, RS1 + IMM, OPK_##id, op - start); op++; continue;
+#define ENGINE_STORE(id, semantics)								\
+	case OPK_##id:												\
+		fault = engine_store(core, RS1 + IMM, RS2, OPK_##id, op - start);	\
+		if (fault)												\
+		{														\
+			next = OP_PC(op) + 4;								\
+			goto exit_fault;									\
+		}														\
+		op++;													\
+		continue;
+#define ENGINE_BRANCH(id, semantics) \
+	case OPK_##id: t = (semantics); goto branch;
+#define ENGINE_JUMP(id, semantics)
+#define ENGINE_FLOAD(id, semantics) \
+	case OPK_##id: core->f[op->rd] = engine_load(core, RS1 + IMM, OPK_##semantics, op - start); op++; continue;
+#define ENGINE_FSTORE(id, semantics)								\
+	case OPK_##id:													\
+		fault = engine_store(core, RS1 + IMM, FB2, OPK_##semantics, op - start);	\
+		if (fault)													\
+		{															\
+			next = OP_PC(op) + 4;									\
+			goto exit_fault;										\
+		}															\
+		op++;														\
+		continue;
+#define ENGINE_FARITH(id, semantics)					\
+	case OPK_##id:										\
+	{													\
+		int rm = fpu_rm(core, (op->imm2 >> 12) & 7);	\
+		if (rm < 0)										\
+			goto fallback;								\
+		uint32_t env = fpu_enter(rm);					\
+		volatile float result = (semantics);			\
+		fpu_leave(core, env);							\
+		core->f[op->rd] = fpu_bits(result);				\
+		op++;											\
+		continue;										\
+	}
+#define ENGINE_FBITS(id, semantics) \
+	case OPK_##id: core->f[op->rd] = (semantics); op++; continue;
+#define ENGINE_FTOX(id, semantics)						\
+	case OPK_##id:										\
+	{													\
+		int rm = fpu_rm(core, (op->imm2 >> 12) & 7);	\
+		if (rm < 0)										\
+			goto fallback;								\
+		x[op->rd] = (semantics);						\
+		op++;											\
+		continue;										\
+	}
+#define ENGINE_CSR(id, semantics)						\
+	case OPK_##id:										\
+	{													\
+		uint32_t csr;									\
+		uint32_t number = op->imm2 >> 20;				\
+		if (fpu_csr_read(core, number, &csr) ||			\
+			fpu_csr_write(core, number, (semantics)))	\
+			goto fallback;								\
+		x[op->rd] = csr;								\
+		op++;											\
+		continue;										\
+	}
+
+#define ENGINE_CASE(id, mnemonic, format, class, match, mask, semantics) ENGINE_##class(id, semantics)
+
+// Address of a predecoded instruction
+#define OP_PC(op) (base_pc + (uint32_t)((op) - base) * 4)
+
+// Run from core->pc to the end of its basic block, or until budget
+// instructions have run so an event is not dispatched late
+// Writes to x0 land in the sink register, instructions are counted once per
+// block and pc is only written back when the block exits or faults. Code
+// outside memory and anything the decoder left as OPK_FALLBACK goes through
+// rv32_execute, which also takes care of reporting faults. budget is at least 1.
+int engine_block(rv32core *core, uint64_t budget)
+{
+	uint32_t pc = core->pc;
+	uint32_t base_pc;
+	rv32op *base;
+	uint32_t size;
+
+	if (pc - ROM_BASE < ROM_SIZE)
+	{
+		base_pc = ROM_BASE;
+		base = core->code->rom;
+		size = ROM_SIZE;
+	}
+	else if (pc - RAM_BASE < RAM_SIZE)
+	{
+		base_pc = RAM_BASE;
+		base = core->code->ram;
+		size = RAM_SIZE;
+	}
+	else
+		return rv32_execute(core);
+
+	if (pc & 0b11)
+		return rv32_execute(core);
+
+	rv32op *start = &base[(pc - base_pc) >> 2];
+	rv32op *op = start;
+	rv32op *end = &base[size >> 2];
+	rv32op *stop = budget < (uint64_t)(end - start) ? start + budget : end;
+	uint32_t *x = core->x;
+	uint32_t next;
+	uint32_t t;
+	int fault;
+
+	for (;;)
+	{
+		if (op + op->len > stop) // out of budget
+		{
+			if (op < stop) // a fused pair the budget ends inside, run its first half alone
+				goto fallback;
+			core->pc = OP_PC(op);
+			core->inst_count += op - start;
+			return 0;
+		}
+
+		switch (op->kind)
+		{
+
+		RV32_ISA(ENGINE_CASE)
+
+		case OPK_LUI: x[op->rd] = op->imm; op++; continue;
+
+		// Fused pairs
+		case OPK_CONST2:
+			x[op->rd] = op->imm;
+			x[op->rd2] = op->imm2;
+			op += 2;
+			continue;
+
+		case OPK_CONST_LW:
+			x[op->rd] = op->imm;
+			x[op->rd2] = engine_load(core, op->imm2, OPK_LW, op - start + 1);
+			op += 2;
+			continue;
+
+		case OPK_SLLI_SRLI: x[op->rd] = (x[op->rs1] << op->imm) >> op->imm2; op += 2; continue;
+		case OPK_SLLI_SRAI: x[op->rd] = (int32_t)(x[op->rs1] << op->imm) >> op->imm2; op += 2; continue;
+
+		// Block terminators
+		case OPK_JAL:
+			x[op->rd] = OP_PC(op) + 4;
+			next = op->imm;
+			goto exit;
+
+		case OPK_JALR:
+			next = (x[op->rs1] + op->imm) & 0xFFFFFFFE;
+			x[op->rd] = OP_PC(op) + 4;
+			goto exit;
+
+		case OPK_CALL:
+			x[op->rd] = op->imm;
+			x[op->rd2] = OP_PC(op) + 8;
+			next = op->imm2;
+			goto exit;
+
+		branch: // from the branch cases generated above
+			next = t ? op->imm : OP_PC(op) + 4;
+			goto exit;
+
+		case OPK_SLT_BR:   t = (int32_t)x[op->rs1] < (int32_t)x[op->rs2]; goto set_branch;
+		case OPK_SLTU_BR:  t = x[op->rs1] < x[op->rs2]; goto set_branch;
+		case OPK_SLTI_BR:  t = (int32_t)x[op->rs1] < (int32_t)op->imm; goto set_branch;
+		case OPK_SLTIU_BR: t = x[op->rs1] < op->imm; goto set_branch;
+		set_branch:
+			x[op->rd] = t;
+			next = (t == op->flags) ? op->imm2 : OP_PC(op) + 8;
+			goto exit;
+
+		case OPK_DECODE: // RAM code reached for the first time since it was written
+			code_decode_page(core->code, core, OP_PC(op));
+			continue;
+
+		case OPK_BREAK:
+			core->pc = OP_PC(op);
+			core->inst_count += op - start;
+			return DEBUG_BREAK;
+
+		default: // OPK_FALLBACK, finish the block here and let the reference run it
+		fallback: // from the cases generated above, for the faults rv32_execute reports
+			core->pc = OP_PC(op);
+			core->inst_count += op - start;
+			core->tier = TIER_REFERENCE;
+			fault = rv32_execute(core);
+			core->tier = TIER_FAST;
+			return fault;
+		}
+	}
+
+exit:
+	core->pc = next;
+	core->inst_count += (op - start) + op->len;
+	return 0;
+
+exit_fault:
+	core->pc = next;
+	core->inst_count += (op - start) + 1;
+	return fault;
+}
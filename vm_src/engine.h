@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+#include "rv32i.h"
+#include "decode.h"
+#include "stats.h"
+#include "cache.h"
+#include "trace.h"
+
+// Fast execution engine, runs predecoded instructions from core->code
+
+int engine_block(rv32core *core, uint64_t budget);
+
+// Memory access, shared with the batch engine
+// RAM and ROM are read directly when the access fits inside them; anything
+// else takes the same path as exec_load and exec_store.
+
+static inline uint32_t engine_read(rv32core *core, uint32_t addr, uint8_t kind, uint32_t ahead)
+{
+	uint8_t *p = 0;
+	if (addr - RAM_BASE <= RAM_SIZE - 4)
+	{
+		p = &core->ram[addr - RAM_BASE];
+		STATS_COUNT(core, ram_loads);
+	}
+	else if (addr - ROM_BASE <= ROM_SIZE - 4)
+	{
+		p = &core->rom[addr - ROM_BASE];
+		STATS_COUNT(core, rom_loads);
+	}
+
+	if (p)
+	{
+		switch (kind)
+		{
+		case OPK_LB:  return (int8_t)p[0];
+		case OPK_LBU: return p[0];
+		case OPK_LH:  return (int16_t)(p[0] | (p[1] << 8));
+		case OPK_LHU: return p[0] | (p[1] << 8);
+		default:	  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+		}
+	}
+
+	if (!inMemory(addr)) // MMIO
+	{
+		STATS_COUNT(core, mmio_loads);
+		return mmio_load(core, addr, core->inst_count + ahead);
+	}
+
+	if (inROM(addr))
+		STATS_COUNT(core, rom_loads);
+	else
+		STATS_COUNT(core, ram_loads);
+
+	switch (kind)
+	{
+	case OPK_LB:  return (int8_t)mem_read_8(core, addr);
+	case OPK_LBU: return mem_read_8(core, addr);
+	case OPK_LH:  return (int16_t)mem_read_16(core, addr);
+	case OPK_LHU: return mem_read_16(core, addr);
+	default:	  return mem_read_32(core, addr);
+	}
+}
+
+// log2 of the access size
+#define KIND_SIZE(kind) ((kind) == OPK_LW || (kind) == OPK_SW ? 2 : (kind) == OPK_LB || (kind) == OPK_LBU || (kind) == OPK_SB ? 0 : 1)
+
+// ahead is the number of instructions run since the block started, pc still
+// holds where it started
+static inline uint32_t engine_load(rv32core *core, uint32_t addr, uint8_t kind, uint32_t ahead)
+{
+	uint32_t value = engine_read(core, addr, kind, ahead);
+	TRACE_ACCESS(core, addr, value, TRACE_LOAD | KIND_SIZE(kind));
+	CACHE_ACCESS(core, core->pc + 4 * ahead, addr, 1 << KIND_SIZE(kind), 0);
+	return value;
+}
+
+static inline int engine_store(rv32core *core, uint32_t addr, uint32_t value, uint8_t kind, uint32_t ahead)
+{
+	TRACE_ACCESS(core, addr, kind == OPK_SW ? value : kind == OPK_SH ? value & 0xFFFF : value & 0xFF,
+				 TRACE_STORE | KIND_SIZE(kind));
+	CACHE_ACCESS(core, core->pc + 4 * ahead, addr, 1 << KIND_SIZE(kind), 1);
+
+	if (addr - RAM_BASE <= RAM_SIZE - 4)
+	{
+		uint8_t *p = &core->ram[addr - RAM_BASE];
+		p[0] = value;
+		if (kind != OPK_SB)
+			p[1] = value >> 8;
+		if (kind == OPK_SW)
+		{
+			p[2] = value >> 16;
+			p[3] = value >> 24;
+		}
+		code_invalidate_store(core->code, addr, kind == OPK_SW ? 4 : kind == OPK_SH ? 2 : 1);
+		STATS_COUNT(core, ram_stores);
+		return 0;
+	}
+
+	if (!inMemory(addr)) // MMIO
+	{
+		STATS_COUNT(core, mmio_stores);
+		return mmio_store(core, addr, value);
+	}
+
+	if (inROM(addr))
+		return WRITE_ROM;
+	STATS_COUNT(core, ram_stores);
+
+	switch (kind)
+	{
+	case OPK_SB: mem_store_8(core, addr, value); break;
+	case OPK_SH: mem_store_16(core, addr, value); break;
+	default:	 mem_store_32(core, addr, value); break;
+	}
+	return 0;
+}
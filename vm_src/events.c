@@ -0,0 +1,128 @@
+#include <stdint.h>
+
+#include "rv32i.h"
+#include "events.h"
+
+// Returns 1 if event a is due before event b
+static int event_before(rv32event *a, rv32event *b)
+{
+	if (a->deadline != b->deadline)
+		return a->deadline < b->deadline;
+	return a->seq < b->seq;
+}
+
+static void event_swap(rv32event *a, rv32event *b)
+{
+	rv32event t = *a;
+	*a = *b;
+	*b = t;
+}
+
+static void sift_up(event_queue *q, int i)
+{
+	while (i > 0)
+	{
+		int parent = (i - 1) / 2;
+		if (!event_before(&q->heap[i], &q->heap[parent]))
+			break;
+		event_swap(&q->heap[i], &q->heap[parent]);
+		i = parent;
+	}
+}
+
+static void sift_down(event_queue *q, int i)
+{
+	for (;;)
+	{
+		int l = 2 * i + 1;
+		int r = l + 1;
+		int min = i;
+
+		if (l < q->count && event_before(&q->heap[l], &q->heap[min]))
+			min = l;
+		if (r < q->count && event_before(&q->heap[r], &q->heap[min]))
+			min = r;
+		if (min == i)
+			break;
+		event_swap(&q->heap[i], &q->heap[min]);
+		i = min;
+	}
+}
+
+static void update_next(event_queue *q)
+{
+	q->next = q->count ? q->heap[0].deadline : NO_DEADLINE;
+}
+
+static void remove_at(event_queue *q, int i)
+{
+	q->count--;
+	if (i != q->count)
+	{
+		q->heap[i] = q->heap[q->count];
+		sift_up(q, i);
+		sift_down(q, i);
+	}
+	update_next(q);
+}
+
+// Drop all pending events
+void events_clear(event_queue *q)
+{
+	q->count = 0;
+	q->seq = 0;
+	update_next(q);
+}
+
+// Schedule callback to run once inst_count reaches deadline
+int events_schedule(event_queue *q, uint64_t deadline, event_callback callback, void *ctx)
+{
+	if (q->count == MAX_EVENTS)
+		return EVENT_QUEUE_FULL;
+
+	rv32event *e = &q->heap[q->count];
+	e->deadline = deadline;
+	e->seq = q->seq++;
+	e->callback = callback;
+	e->ctx = ctx;
+
+	sift_up(q, q->count++);
+	update_next(q);
+	return 0;
+}
+
+// Remove every pending event matching callback and ctx, returns how many were removed
+int events_cancel(event_queue *q, event_callback callback, void *ctx)
+{
+	int kept = 0;
+	for (int i = 0; i < q->count; i++)
+	{
+		if (q->heap[i].callback != callback || q->heap[i].ctx != ctx)
+			q->heap[kept++] = q->heap[i];
+	}
+
+	int removed = q->count - kept;
+	q->count = kept;
+	for (int i = kept / 2 - 1; i >= 0; i--)
+		sift_down(q, i);
+	update_next(q);
+	return removed;
+}
+
+// Run the callbacks of every event that is due
+// Callbacks may schedule new events, including ones that are already due.
+int events_dispatch(rv32core *core)
+{
+	event_queue *q = &core->events;
+
+	while (q->count && q->heap[0].deadline <= core->inst_count)
+	{
+		rv32event e = q->heap[0];
+		remove_at(q, 0);
+
+		int fault = e.callback(core, e.ctx);
+		if (fault)
+			return fault;
+	}
+	return 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+// Device event scheduler
+// Events are kept in a min-heap keyed on the instruction count at which they
+// are due, so the run loop only has to compare against the earliest deadline.
+
+struct rv32core;
+
+// Maximum number of pending events
+#define MAX_EVENTS 32
+
+// No event pending
+#define NO_DEADLINE UINT64_MAX
+
+// Event callback, returns a fault code (0 to keep running)
+typedef int (*event_callback)(struct rv32core *core, void *ctx);
+
+struct rv32event
+{
+	uint64_t deadline; // inst_count at which the event fires
+	uint64_t seq;	   // insertion order, breaks ties between equal deadlines
+	event_callback callback;
+	void *ctx;
+};
+typedef struct rv32event rv32event;
+
+struct event_queue
+{
+	uint64_t next; // deadline of the earliest event, NO_DEADLINE if empty
+	rv32event heap[MAX_EVENTS];
+	int count;
+	uint64_t seq;
+};
+typedef struct event_queue event_queue;
+
+void events_clear(event_queue *q);
+
+int events_schedule(event_queue *q, uint64_t deadline, event_callback callback, void *ctx);
+int events_cancel(event_queue *q, event_callback callback, void *ctx);
+
+// Instruction count at which the next event is due
+static inline uint64_t events_next_deadline(event_queue *q)
+{
+	return q->next;
+}
+
+int events_dispatch(struct rv32core *core);
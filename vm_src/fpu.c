@@ -0,0 +1,197 @@
+#include <stdint.h>
+#include <math.h>
+
+#include "rv32i.h"
+#include "fpu.h"
+
+// Instructions that set fflags themselves rather than through the host:
+// comparisons, min/max and conversions to integers, and the corner of fma
+// the host gets wrong
+
+static int is_nan(uint32_t a)
+{
+	return (a & 0x7FFFFFFF) > 0x7F800000;
+}
+
+static int is_signaling(uint32_t a)
+{
+	return is_nan(a) && !(a & 0x00400000);
+}
+
+// a * b + c rounded once
+// Infinity times zero is invalid even when c is a quiet NaN, which the host
+// doesn't flag.
+float fpu_fma(rv32core *core, float a, float b, float c)
+{
+	if ((isinf(a) && b == 0) || (a == 0 && isinf(b)))
+		core->fcsr |= FPU_NV;
+	return fmaf(a, b, c);
+}
+
+// With one NaN operand the other one is the result, -0 is less than +0
+uint32_t fpu_min(rv32core *core, uint32_t a, uint32_t b)
+{
+	if (is_signaling(a) || is_signaling(b))
+		core->fcsr |= FPU_NV;
+	if (is_nan(a) && is_nan(b))
+		return FPU_CANONICAL_NAN;
+	if (is_nan(a))
+		return b;
+	if (is_nan(b))
+		return a;
+	if (((a | b) & 0x7FFFFFFF) == 0)
+		return a | b;
+	return fpu_float(a) < fpu_float(b) ? a : b;
+}
+
+uint32_t fpu_max(rv32core *core, uint32_t a, uint32_t b)
+{
+	if (is_signaling(a) || is_signaling(b))
+		core->fcsr |= FPU_NV;
+	if (is_nan(a) && is_nan(b))
+		return FPU_CANONICAL_NAN;
+	if (is_nan(a))
+		return b;
+	if (is_nan(b))
+		return a;
+	if (((a | b) & 0x7FFFFFFF) == 0)
+		return a & b;
+	return fpu_float(a) > fpu_float(b) ? a : b;
+}
+
+// feq is a quiet comparison, only signaling NaNs are invalid; flt and fle
+// are invalid for any NaN
+uint32_t fpu_eq(rv32core *core, uint32_t a, uint32_t b)
+{
+	if (is_nan(a) || is_nan(b))
+	{
+		if (is_signaling(a) || is_signaling(b))
+			core->fcsr |= FPU_NV;
+		return 0;
+	}
+	return fpu_float(a) == fpu_float(b);
+}
+
+uint32_t fpu_lt(rv32core *core, uint32_t a, uint32_t b)
+{
+	if (is_nan(a) || is_nan(b))
+	{
+		core->fcsr |= FPU_NV;
+		return 0;
+	}
+	return fpu_float(a) < fpu_float(b);
+}
+
+uint32_t fpu_le(rv32core *core, uint32_t a, uint32_t b)
+{
+	if (is_nan(a) || is_nan(b))
+	{
+		core->fcsr |= FPU_NV;
+		return 0;
+	}
+	return fpu_float(a) <= fpu_float(b);
+}
+
+// One bit per kind of value: -inf, -normal, -subnormal, -0, +0, +subnormal,
+// +normal, +inf, signaling NaN, quiet NaN
+uint32_t fpu_class(uint32_t a)
+{
+	int negative = a >> 31;
+	uint32_t exponent = (a >> 23) & 0xFF;
+	uint32_t mantissa = a & 0x7FFFFF;
+
+	if (exponent == 0xFF)
+	{
+		if (!mantissa)
+			return negative ? 1 << 0 : 1 << 7;
+		return mantissa & 0x400000 ? 1 << 9 : 1 << 8;
+	}
+	if (exponent)
+		return negative ? 1 << 1 : 1 << 6;
+	if (mantissa)
+		return negative ? 1 << 2 : 1 << 5;
+	return negative ? 1 << 3 : 1 << 4;
+}
+
+// f rounded to an integer in mode rm
+// Runs in the host's default rounding mode, to nearest even.
+static float round_to_integer(float f, int rm)
+{
+	switch (rm)
+	{
+	case FPU_RTZ: return truncf(f);
+	case FPU_RDN: return floorf(f);
+	case FPU_RUP: return ceilf(f);
+	case FPU_RMM: return roundf(f);
+	default:	  return nearbyintf(f);
+	}
+}
+
+// Out of range values and NaNs saturate and are invalid, NaNs to the largest
+// integer
+uint32_t fpu_to_int32(rv32core *core, float f, int rm)
+{
+	if (isnan(f))
+	{
+		core->fcsr |= FPU_NV;
+		return 0x7FFFFFFF;
+	}
+
+	float r = round_to_integer(f, rm);
+	if (r < -2147483648.0f || r >= 2147483648.0f)
+	{
+		core->fcsr |= FPU_NV;
+		return r < 0 ? 0x80000000 : 0x7FFFFFFF;
+	}
+	if (r != f)
+		core->fcsr |= FPU_NX;
+	return (uint32_t)(int32_t)r;
+}
+
+uint32_t fpu_to_uint32(rv32core *core, float f, int rm)
+{
+	if (isnan(f))
+	{
+		core->fcsr |= FPU_NV;
+		return 0xFFFFFFFF;
+	}
+
+	float r = round_to_integer(f, rm);
+	if (r < 0.0f || r >= 4294967296.0f)
+	{
+		core->fcsr |= FPU_NV;
+		return r < 0 ? 0 : 0xFFFFFFFF;
+	}
+	if (r != f)
+		core->fcsr |= FPU_NX;
+	return (uint32_t)r;
+}
+
+// Control and status registers
+// Only the floating point ones exist; anything else is UNDEF_CSR.
+
+#define CSR_FFLAGS 0x001
+#define CSR_FRM 0x002
+#define CSR_FCSR 0x003
+
+int fpu_csr_read(rv32core *core, uint32_t csr, uint32_t *value)
+{
+	switch (csr)
+	{
+	case CSR_FFLAGS: *value = core->fcsr & 0x1F; return 0;
+	case CSR_FRM:	 *value = (core->fcsr >> 5) & 0x7; return 0;
+	case CSR_FCSR:	 *value = core->fcsr & 0xFF; return 0;
+	default:		 return UNDEF_CSR;
+	}
+}
+
+int fpu_csr_write(rv32core *core, uint32_t csr, uint32_t value)
+{
+	switch (csr)
+	{
+	case CSR_FFLAGS: core->fcsr = (core->fcsr & ~0x1F) | (value & 0x1F); return 0;
+	case CSR_FRM:	 core->fcsr = (core->fcsr & 0x1F) | (value & 0x7) << 5; return 0;
+	case CSR_FCSR:	 core->fcsr = value & 0xFF; return 0;
+	default:		 return UNDEF_CSR;
+	}
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#define FPU_SSE
+#include <xmmintrin.h>
+#else
+#include <fenv.h>
+#endif
+
+#include "rv32i.h"
+
+// F extension
+// Single precision instructions run on the host FPU: the guest's rounding
+// mode is loaded into the host before the operation, and the exception flags
+// the host raises are accrued into fflags after it. Results that are NaN are
+// replaced by the canonical NaN, which the host doesn't produce. RMM (round
+// to nearest, ties to max magnitude) has no host equivalent, arithmetic in
+// that mode rounds to nearest even; conversions to integers honor it.
+
+// fflags bits
+#define FPU_NX 0x01 // inexact
+#define FPU_UF 0x02 // underflow
+#define FPU_OF 0x04 // overflow
+#define FPU_DZ 0x08 // divide by zero
+#define FPU_NV 0x10 // invalid
+
+// Rounding modes
+#define FPU_RNE 0 // to nearest, ties to even
+#define FPU_RTZ 1 // toward zero
+#define FPU_RDN 2 // down
+#define FPU_RUP 3 // up
+#define FPU_RMM 4 // to nearest, ties to max magnitude
+#define FPU_DYN 7 // the mode in frm
+
+#define FPU_CANONICAL_NAN 0x7FC00000
+
+static inline float fpu_float(uint32_t bits)
+{
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+// Bit pattern of a result, with NaNs made canonical
+static inline uint32_t fpu_bits(float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return isnan(f) ? FPU_CANONICAL_NAN : bits;
+}
+
+// Rounding mode of an instruction's rm field, resolving DYN through frm
+// Returns -1 for the reserved modes, which make the instruction illegal.
+static inline int fpu_rm(rv32core *core, uint32_t rm)
+{
+	if (rm == FPU_DYN)
+		rm = (core->fcsr >> 5) & 7;
+	return rm <= FPU_RMM ? (int)rm : -1;
+}
+
+// Load rounding mode rm into the host with its exception flags clear
+// Returns the host state to give to fpu_leave.
+static inline uint32_t fpu_enter(int rm)
+{
+#ifdef FPU_SSE
+	static const uint32_t rounding[5] = {_MM_ROUND_NEAREST, _MM_ROUND_TOWARD_ZERO, _MM_ROUND_DOWN, _MM_ROUND_UP,
+										 _MM_ROUND_NEAREST};
+	uint32_t saved = _mm_getcsr();
+	_mm_setcsr((saved & ~(_MM_ROUND_MASK | _MM_EXCEPT_MASK)) | rounding[rm]);
+#else
+	static const int rounding[5] = {FE_TONEAREST, FE_TOWARDZERO, FE_DOWNWARD, FE_UPWARD, FE_TONEAREST};
+	uint32_t saved = fegetround();
+	fesetround(rounding[rm]);
+	feclearexcept(FE_ALL_EXCEPT);
+#endif
+#ifdef __GNUC__
+	__asm__ volatile("" ::: "memory"); // operands are read after this
+#endif
+	return saved;
+}
+
+// Accrue the exception flags the host raised into fflags and restore it
+static inline void fpu_leave(rv32core *core, uint32_t saved)
+{
+#ifdef __GNUC__
+	__asm__ volatile("" ::: "memory");
+#endif
+#ifdef FPU_SSE
+	uint32_t raised = _mm_getcsr();
+	core->fcsr |= (raised & _MM_EXCEPT_INVALID ? FPU_NV : 0) | (raised & _MM_EXCEPT_DIV_ZERO ? FPU_DZ : 0) |
+				  (raised & _MM_EXCEPT_OVERFLOW ? FPU_OF : 0) | (raised & _MM_EXCEPT_UNDERFLOW ? FPU_UF : 0) |
+				  (raised & _MM_EXCEPT_INEXACT ? FPU_NX : 0);
+	_mm_setcsr(saved);
+#else
+	int raised = fetestexcept(FE_ALL_EXCEPT);
+	core->fcsr |= (raised & FE_INVALID ? FPU_NV : 0) | (raised & FE_DIVBYZERO ? FPU_DZ : 0) |
+				  (raised & FE_OVERFLOW ? FPU_OF : 0) | (raised & FE_UNDERFLOW ? FPU_UF : 0) |
+				  (raised & FE_INEXACT ? FPU_NX : 0);
+	fesetround(saved);
+#endif
+}
+
+float fpu_fma(rv32core *core, float a, float b, float c);
+uint32_t fpu_min(rv32core *core, uint32_t a, uint32_t b);
+uint32_t fpu_max(rv32core *core, uint32_t a, uint32_t b);
+uint32_t fpu_eq(rv32core *core, uint32_t a, uint32_t b);
+uint32_t fpu_lt(rv32core *core, uint32_t a, uint32_t b);
+uint32_t fpu_le(rv32core *core, uint32_t a, uint32_t b);
+uint32_t fpu_class(uint32_t a);
+uint32_t fpu_to_int32(rv32core *core, float f, int rm);
+uint32_t fpu_to_uint32(rv32core *core, float f, int rm);
+
+int fpu_csr_read(rv32core *core, uint32_t csr, uint32_t *value);
+int fpu_csr_write(rv32core *core, uint32_t csr, uint32_t value);
@@ -0,0 +1,909 @@
+#define _CRT_SECURE_NO_WARNINGS // allow building on MSVC
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+
+#include "rv32i.h"
+#include "events.h"
+#include "decode.h"
+#include "gdbstub.h"
+#include "plugin.h"
+#include "profile.h"
+
+#ifndef _WIN32
+
+// What the debugger asked for once it is done looking at a stopped core
+#define GDB_CONTINUE 0
+#define GDB_STEP 1
+#define GDB_DETACH 2
+#define GDB_KILL 3
+
+static const char *reg_names[32] = {
+	"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "fp", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+	"a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+// Breakpoints and watchpoints
+
+static int find_break(gdb_stub *g, uint32_t addr)
+{
+	for (int i = 0; i < g->break_count; i++)
+	{
+		if (g->breaks[i] == addr)
+			return i;
+	}
+	return -1;
+}
+
+static int is_memory_op(uint8_t kind)
+{
+	int cls = isa_class(decode_kind_isa(kind));
+	return cls == ISA_CLASS_LOAD || cls == ISA_CLASS_STORE || cls == ISA_CLASS_FLOAD || cls == ISA_CLASS_FSTORE ||
+		   kind == OPK_CONST_LW;
+}
+
+// Patch the breakpoints and watchpoints into count decoded ops starting at pc
+static void patch_ops(gdb_stub *g, rv32core *core, rv32op *ops, uint32_t pc, int count)
+{
+	for (int b = 0; b < g->break_count; b++)
+	{
+		uint32_t offset = g->breaks[b] - pc;
+		if (offset >= 4 * (uint32_t)count || (offset & 3))
+			continue;
+
+		// A pair fused across the breakpoint is split, so the second
+		// instruction can stop on its own
+		int i = offset / 4;
+		if (i > 0 && ops[i - 1].len == 2)
+			decode_inst(&ops[i - 1], mem_read_32(core, pc + 4 * (i - 1)), pc + 4 * (i - 1));
+		ops[i].kind = OPK_BREAK;
+		ops[i].len = 1; // not split again by a breakpoint after it
+	}
+
+	if (g->watch_count)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			if (is_memory_op(ops[i].kind))
+				ops[i].kind = OPK_FALLBACK;
+		}
+	}
+}
+
+// Called when a RAM page has just been decoded
+void gdb_patch_page(gdb_stub *g, rv32core *core, int page)
+{
+	int first = page * (CODE_PAGE_SIZE / 4);
+	patch_ops(g, core, &core->code->ram[first], RAM_BASE + 4 * first, CODE_PAGE_SIZE / 4);
+}
+
+// Fast-forwarded loop iterations would run past breakpoints and accesses
+static void update_idle(gdb_stub *g, rv32core *core)
+{
+	core->idle.off = g->idle_off || g->break_count || g->watch_count;
+}
+
+// Decode op i of count ops starting at pc again, as a full reload and patch
+// would leave it: fused with the next op unless that one stops or falls back
+static void redecode(gdb_stub *g, rv32core *core, rv32op *ops, uint32_t pc, int i, int count)
+{
+	uint32_t at = pc + 4 * i;
+	decode_inst(&ops[i], mem_read_32(core, at), at);
+	if (i + 1 < count && ops[i + 1].kind != OPK_BREAK && ops[i + 1].kind != OPK_FALLBACK)
+	{
+		rv32op next;
+		decode_inst(&next, mem_read_32(core, at + 4), at + 4);
+		decode_fuse(&ops[i], &next);
+	}
+
+	if (find_break(g, at) >= 0)
+	{
+		ops[i].kind = OPK_BREAK;
+		ops[i].len = 1;
+	}
+	else if ((core->plugins && core->plugins->hooked[profile_slot(at)]) ||
+			 (g->watch_count && is_memory_op(ops[i].kind)))
+	{
+		ops[i].kind = OPK_FALLBACK;
+		ops[i].len = 1;
+	}
+}
+
+// Patch a breakpoint just set or cleared at addr into the decoded program
+// Only its op and the one before, which may fuse with it, change. RAM that
+// isn't decoded is patched when it gets decoded.
+static void update_break(gdb_stub *g, rv32core *core, uint32_t addr)
+{
+	update_idle(g, core);
+	if (core->code == NULL || (addr & 3))
+		return;
+
+	rv32op *ops;
+	uint32_t pc;
+	int count;
+	if (addr - ROM_BASE < ROM_SIZE)
+	{
+		ops = core->code->rom;
+		pc = ROM_BASE;
+		count = ROM_SIZE / 4;
+	}
+	else if (addr - RAM_BASE < RAM_SIZE && core->code->ram_code[(addr - RAM_BASE) / CODE_PAGE_SIZE])
+	{
+		int first = (addr - RAM_BASE) / CODE_PAGE_SIZE * (CODE_PAGE_SIZE / 4); // pairs don't cross pages
+		ops = &core->code->ram[first];
+		pc = RAM_BASE + 4 * first;
+		count = CODE_PAGE_SIZE / 4;
+	}
+	else
+		return;
+
+	int i = (addr - pc) / 4;
+	redecode(g, core, ops, pc, i, count);
+	if (i > 0)
+		redecode(g, core, ops, pc, i - 1, count);
+}
+
+// Bring the decoded program in line with the watchpoints, and breakpoints
+// Everything is decoded again, for changes to the watchpoints.
+static void update(gdb_stub *g, rv32core *core)
+{
+	update_idle(g, core);
+
+	memset(g->watch_pages, 0, sizeof(g->watch_pages));
+	for (int i = 0; i < g->watch_count; i++)
+	{
+		gdb_watch *w = &g->watches[i];
+		for (uint32_t page = w->addr / CODE_PAGE_SIZE; page <= (w->addr + w->len - 1) / CODE_PAGE_SIZE; page++)
+		{
+			g->watch_pages[page % 256]++;
+			if (page - w->addr / CODE_PAGE_SIZE >= 255)
+				break;
+		}
+	}
+
+	if (core->code == NULL)
+		return;
+	code_load(core->code, core); // plain ops again, RAM is decoded and patched when next run
+	if (core->plugins)
+		plugin_patch(core->plugins, core);
+	patch_ops(g, core, core->code->rom, ROM_BASE, ROM_SIZE / 4);
+}
+
+// For the reference interpreter, which has no decoded ops to patch
+// The breakpoint a step starts from is passed over.
+int gdb_breakpoint(gdb_stub *g, rv32core *core)
+{
+	return g->break_count && core->inst_count != g->resume_count && find_break(g, core->pc) >= 0;
+}
+
+static int watch_hit(rv32core *core, void *ctx)
+{
+	(void)core;
+	(void)ctx;
+	return DEBUG_BREAK;
+}
+
+// Called by rv32_execute for every load and store of size bytes at addr
+// A hit stops the core once the instruction has finished.
+void gdb_access(gdb_stub *g, rv32core *core, uint32_t addr, int size, int store)
+{
+	if (!g->watch_count)
+		return;
+	if (!g->watch_pages[(addr / CODE_PAGE_SIZE) % 256] && !g->watch_pages[((addr + size - 1) / CODE_PAGE_SIZE) % 256])
+		return;
+
+	for (int i = 0; i < g->watch_count; i++)
+	{
+		gdb_watch *w = &g->watches[i];
+		if (addr + size <= w->addr || addr >= w->addr + w->len)
+			continue;
+		if ((w->kind == GDB_WATCH_WRITE && !store) || (w->kind == GDB_WATCH_READ && store))
+			continue;
+
+		g->stop = GDB_STOP_WATCH;
+		g->stop_addr = w->addr;
+		g->stop_kind = w->kind;
+		events_schedule(&core->events, core->inst_count, watch_hit, g);
+		return;
+	}
+}
+
+static int set_point(gdb_stub *g, rv32core *core, int type, uint32_t addr, uint32_t len)
+{
+	if (type <= 1) // software and hardware breakpoints
+	{
+		if (find_break(g, addr) >= 0)
+			return 0;
+		if (g->break_count == GDB_MAX_BREAKS)
+			return -1;
+		g->breaks[g->break_count++] = addr;
+		update_break(g, core, addr);
+	}
+	else
+	{
+		if (g->watch_count == GDB_MAX_WATCHES || len == 0)
+			return -1;
+		g->watches[g->watch_count].addr = addr;
+		g->watches[g->watch_count].len = len;
+		g->watches[g->watch_count].kind = type;
+		g->watch_count++;
+		update(g, core);
+	}
+	return 0;
+}
+
+static int clear_point(gdb_stub *g, rv32core *core, int type, uint32_t addr, uint32_t len)
+{
+	if (type <= 1)
+	{
+		int i = find_break(g, addr);
+		if (i < 0)
+			return -1;
+		g->breaks[i] = g->breaks[--g->break_count];
+		update_break(g, core, addr);
+	}
+	else
+	{
+		int i;
+		for (i = 0; i < g->watch_count; i++)
+		{
+			gdb_watch *w = &g->watches[i];
+			if (w->addr == addr && w->len == len && w->kind == type)
+				break;
+		}
+		if (i == g->watch_count)
+			return -1;
+		g->watches[i] = g->watches[--g->watch_count];
+		update(g, core);
+	}
+	return 0;
+}
+
+// Connection
+
+static void drop_connection(gdb_stub *g, rv32core *core)
+{
+	if (g->conn >= 0)
+		close(g->conn);
+	g->conn = -1;
+	while (g->break_count)
+	{
+		uint32_t addr = g->breaks[--g->break_count];
+		update_break(g, core, addr);
+	}
+	if (g->watch_count)
+	{
+		g->watch_count = 0;
+		update(g, core);
+	}
+}
+
+static int send_all(gdb_stub *g, const char *data, size_t len)
+{
+	while (len)
+	{
+		ssize_t n = send(g->conn, data, len, MSG_NOSIGNAL);
+		if (n <= 0)
+			return -1;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int get_char(gdb_stub *g)
+{
+	unsigned char c;
+	if (recv(g->conn, &c, 1, 0) != 1)
+		return -1;
+	return c;
+}
+
+static int hex_value(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static uint32_t parse_hex(const char **p)
+{
+	uint32_t v = 0;
+	for (; hex_value(**p) >= 0; (*p)++)
+		v = v << 4 | hex_value(**p);
+	return v;
+}
+
+// Register value in target byte order
+static char *put_reg(char *out, uint32_t v)
+{
+	for (int i = 0; i < 4; i++, v >>= 8)
+		out += sprintf(out, "%02x", v & 0xFF);
+	return out;
+}
+
+static uint32_t parse_reg(const char **p)
+{
+	uint32_t v = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		int hi = hex_value((*p)[0]);
+		int lo = hi < 0 ? -1 : hex_value((*p)[1]);
+		if (lo < 0)
+			break;
+		v |= (uint32_t)(hi << 4 | lo) << (8 * i);
+		*p += 2;
+	}
+	return v;
+}
+
+// Send a packet, again until the debugger acknowledges it
+static int put_packet(gdb_stub *g, const char *data)
+{
+	char buf[GDB_PACKET_SIZE + 8];
+	uint8_t sum = 0;
+	size_t len = strlen(data);
+	for (size_t i = 0; i < len; i++)
+		sum += (uint8_t)data[i];
+	int n = snprintf(buf, sizeof(buf), "$%s#%02x", data, sum);
+
+	for (;;)
+	{
+		if (send_all(g, buf, n))
+			return -1;
+		int c;
+		do
+			c = get_char(g);
+		while (c >= 0 && c != '+' && c != '-');
+		if (c < 0)
+			return -1;
+		if (c == '+')
+			return 0;
+	}
+}
+
+// Read a packet into g->packet and acknowledge it
+// Returns -1 once the debugger has gone.
+static int get_packet(gdb_stub *g)
+{
+	for (;;)
+	{
+		int c;
+		do // skips acknowledgements and interrupts sent while already stopped
+			c = get_char(g);
+		while (c >= 0 && c != '$');
+		if (c < 0)
+			return -1;
+
+		int len = 0;
+		uint8_t sum = 0;
+		while ((c = get_char(g)) >= 0 && c != '#')
+		{
+			if (len < GDB_PACKET_SIZE)
+				g->packet[len++] = c;
+			sum += c;
+		}
+		int hi = get_char(g);
+		int lo = get_char(g);
+		if (c < 0 || hi < 0 || lo < 0)
+			return -1;
+		g->packet[len] = 0;
+
+		if ((hex_value(hi) << 4 | hex_value(lo)) == sum)
+			return send_all(g, "+", 1) ? -1 : len;
+		if (send_all(g, "-", 1))
+			return -1;
+	}
+}
+
+// Packets
+
+static void stop_reply(gdb_stub *g, int fault, char *out)
+{
+	static const char *watch_prefix[5] = {"", "", "", "r", "a"};
+
+	switch (fault)
+	{
+	case DEBUG_BREAK:
+		if (g->stop == GDB_STOP_WATCH)
+			sprintf(out, "T05%swatch:%08x;", watch_prefix[g->stop_kind], g->stop_addr);
+		else
+			strcpy(out, g->stop == GDB_STOP_INTERRUPT ? "S02" : "S05");
+		break;
+	case SYSCON_SHUTDOWN:
+		strcpy(out, "W00");
+		break;
+	case UNDEF_OPCODE:
+	case UNDEF_FUNC3:
+	case UNDEF_FUNC7:
+	case UNDEF_CSR:
+		strcpy(out, "S04"); // SIGILL
+		break;
+	case PC_UNALIGN:
+		strcpy(out, "S07"); // SIGBUS
+		break;
+	case PC_OUT_OF_RANGE:
+	case WRITE_ROM:
+		strcpy(out, "S0b"); // SIGSEGV
+		break;
+	default:
+		strcpy(out, "S06"); // SIGABRT
+		break;
+	}
+}
+
+// Target description, so the debugger knows the registers without an ELF
+static void target_xml(char *out, size_t size)
+{
+	int n = snprintf(out, size, "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+								"<target version=\"1.0\"><architecture>riscv:rv32</architecture>"
+								"<feature name=\"org.gnu.gdb.riscv.cpu\">");
+	for (int i = 0; i < 32; i++)
+		n += snprintf(out + n, size - n, "<reg name=\"%s\" bitsize=\"32\" type=\"%s\"/>", reg_names[i],
+					  i == 1 ? "code_ptr" : i == 2 || i == 8 ? "data_ptr" : "int");
+	snprintf(out + n, size - n, "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/></feature></target>");
+}
+
+static void read_memory(rv32core *core, const char *p, char *out)
+{
+	uint32_t addr = parse_hex(&p);
+	uint32_t len = *p == ',' ? (p++, parse_hex(&p)) : 0;
+	if (len > GDB_PACKET_SIZE / 2)
+		len = GDB_PACKET_SIZE / 2;
+
+	// MMIO isn't read, it could have side effects
+	uint32_t i;
+	for (i = 0; i < len; i++, addr++)
+	{
+		if (addr - RAM_BASE < RAM_SIZE)
+			out += sprintf(out, "%02x", core->ram[addr - RAM_BASE]);
+		else if (addr - ROM_BASE < ROM_SIZE)
+			out += sprintf(out, "%02x", core->rom[addr - ROM_BASE]);
+		else
+			break;
+	}
+	if (i == 0 && len)
+		strcpy(out, "E14");
+}
+
+static void write_memory(rv32core *core, const char *p, char *out)
+{
+	uint32_t addr = parse_hex(&p);
+	uint32_t len = *p == ',' ? (p++, parse_hex(&p)) : 0;
+	if (*p++ != ':')
+	{
+		strcpy(out, "E01");
+		return;
+	}
+
+	// Only RAM, ROM stays as the image was loaded
+	for (uint32_t i = 0; i < len; i++, addr++, p += 2)
+	{
+		int hi = hex_value(p[0]);
+		int lo = hi < 0 ? -1 : hex_value(p[1]);
+		if (lo < 0 || addr - RAM_BASE >= RAM_SIZE)
+		{
+			strcpy(out, "E01");
+			return;
+		}
+		mem_store_8(core, addr, hi << 4 | lo); // also drops decoded code there
+	}
+	strcpy(out, "OK");
+}
+
+static void query(gdb_stub *g, const char *p, char *out)
+{
+	if (!strncmp(p, "qSupported", 10))
+		sprintf(out, "PacketSize=%x;qXfer:features:read+", GDB_PACKET_SIZE);
+	else if (!strcmp(p, "qAttached"))
+		strcpy(out, "1");
+	else if (!strcmp(p, "qC"))
+		strcpy(out, "QC1");
+	else if (!strcmp(p, "qfThreadInfo"))
+		strcpy(out, "m1");
+	else if (!strcmp(p, "qsThreadInfo"))
+		strcpy(out, "l");
+	else if (!strncmp(p, "qXfer:features:read:target.xml:", 31))
+	{
+		static char xml[4096];
+		p += 31;
+		uint32_t offset = parse_hex(&p);
+		uint32_t len = *p == ',' ? (p++, parse_hex(&p)) : 0;
+		target_xml(xml, sizeof(xml));
+
+		uint32_t total = strlen(xml);
+		if (offset > total)
+			offset = total;
+		if (len > total - offset)
+			len = total - offset;
+		if (len > GDB_PACKET_SIZE - 1)
+			len = GDB_PACKET_SIZE - 1;
+		out[0] = offset + len < total ? 'm' : 'l';
+		memcpy(out + 1, xml + offset, len);
+		out[1 + len] = 0;
+	}
+	(void)g;
+}
+
+// Answer the debugger until it resumes the core
+// Returns GDB_CONTINUE, GDB_STEP, GDB_DETACH or GDB_KILL.
+static int serve(gdb_stub *g, rv32core *core, int fault)
+{
+	static char out[2 * GDB_PACKET_SIZE + 1];
+
+	for (;;)
+	{
+		if (get_packet(g) < 0)
+			return GDB_DETACH;
+
+		const char *p = g->packet;
+		out[0] = 0;
+
+		switch (*p++)
+		{
+
+		case '?':
+			stop_reply(g, fault, out);
+			break;
+
+		case 'g':
+		{
+			char *o = out;
+			for (int i = 0; i < 32; i++)
+				o = put_reg(o, core->x[i]);
+			put_reg(o, core->pc);
+			break;
+		}
+
+		case 'G':
+			for (int i = 0; i < 32; i++)
+				core->x[i] = parse_reg(&p);
+			core->x[0] = 0;
+			core->pc = parse_reg(&p);
+			strcpy(out, "OK");
+			break;
+
+		case 'p':
+		{
+			uint32_t n = parse_hex(&p);
+			if (n <= 32)
+				put_reg(out, n == 32 ? core->pc : core->x[n]);
+			else
+				strcpy(out, "E01");
+			break;
+		}
+
+		case 'P':
+		{
+			uint32_t n = parse_hex(&p);
+			if (*p++ != '=' || n > 32)
+			{
+				strcpy(out, "E01");
+				break;
+			}
+			uint32_t v = parse_reg(&p);
+			if (n == 32)
+				core->pc = v;
+			else if (n)
+				core->x[n] = v;
+			strcpy(out, "OK");
+			break;
+		}
+
+		case 'm':
+			read_memory(core, p, out);
+			break;
+
+		case 'M':
+			write_memory(core, p, out);
+			break;
+
+		case 'c':
+			return GDB_CONTINUE;
+
+		case 's':
+			return GDB_STEP;
+
+		case 'k':
+			return GDB_KILL;
+
+		case 'D':
+			put_packet(g, "OK");
+			return GDB_DETACH;
+
+		case 'Z':
+		case 'z':
+		{
+			int type = parse_hex(&p);
+			uint32_t addr = *p == ',' ? (p++, parse_hex(&p)) : 0;
+			uint32_t len = *p == ',' ? (p++, parse_hex(&p)) : 0;
+			if (type > GDB_WATCH_ACCESS)
+				break; // unsupported
+			int err = g->packet[0] == 'Z' ? set_point(g, core, type, addr, len) : clear_point(g, core, type, addr, len);
+			strcpy(out, err ? "E01" : "OK");
+			break;
+		}
+
+		case 'H':
+			strcpy(out, "OK");
+			break;
+
+		case 'q':
+			query(g, g->packet, out);
+			break;
+
+		case 'v':
+			if (!strcmp(g->packet, "vKill;1"))
+			{
+				put_packet(g, "OK");
+				return GDB_KILL;
+			}
+			break; // vCont isn't supported, so the debugger uses c and s
+
+		default:
+			break;
+		}
+
+		if (put_packet(g, out))
+			return GDB_DETACH;
+	}
+}
+
+// Running
+
+static int step_done(rv32core *core, void *ctx)
+{
+	gdb_stub *g = ctx;
+	(void)core;
+	g->stop = GDB_STOP_STEP;
+	return DEBUG_BREAK;
+}
+
+// Execute one instruction with the reference interpreter, which passes over
+// the breakpoint the core is stopped at
+static int step(gdb_stub *g, rv32core *core)
+{
+	rv32code *code = core->code;
+	core->code = NULL;
+	g->resume_count = core->inst_count;
+	g->stop = GDB_STOP_BREAK;
+
+	int fault = events_schedule(&core->events, core->inst_count + 1, step_done, g);
+	if (!fault)
+		fault = rv32_run(core);
+	events_cancel(&core->events, step_done, g);
+
+	g->resume_count = UINT64_MAX;
+	core->code = code;
+	return fault;
+}
+
+static int resume(gdb_stub *g, rv32core *core)
+{
+	if (find_break(g, core->pc) >= 0)
+	{
+		int fault = step(g, core);
+		if (fault != DEBUG_BREAK || g->stop != GDB_STOP_STEP)
+			return fault;
+	}
+	g->stop = GDB_STOP_BREAK;
+	return rv32_run(core);
+}
+
+// Device event checking for a debugger attaching or interrupting
+static int gdb_poll(rv32core *core, void *ctx)
+{
+	gdb_stub *g = ctx;
+	int fault = events_schedule(&core->events, core->inst_count + GDB_POLL, gdb_poll, g);
+	if (fault)
+		return fault;
+
+	if (g->conn < 0)
+	{
+		g->conn = accept(g->listen_fd, NULL, NULL);
+		if (g->conn < 0)
+			return 0;
+		g->stop = GDB_STOP_ATTACH;
+		return DEBUG_BREAK;
+	}
+
+	char c;
+	ssize_t n = recv(g->conn, &c, 1, MSG_DONTWAIT);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+		drop_connection(g, core);
+	else if (n == 1 && c == 0x03)
+	{
+		g->stop = GDB_STOP_INTERRUPT;
+		return DEBUG_BREAK;
+	}
+	return 0;
+}
+
+// Listen for a debugger on dest, a TCP port on the loopback interface or
+// "unix:<path>". With wait set, the first instruction only runs once the
+// debugger says so. Returns -1 if the socket can't be set up.
+int gdb_start(gdb_stub *g, rv32core *core, const char *dest, int wait)
+{
+	memset(g, 0, sizeof(gdb_stub));
+	g->conn = -1;
+	g->resume_count = UINT64_MAX;
+	g->idle_off = core->idle.off;
+
+	if (!strncmp(dest, "unix:", 5))
+	{
+		struct sockaddr_un addr;
+		if (strlen(dest + 5) >= sizeof(addr.sun_path))
+			return -1;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, dest + 5);
+		unlink(addr.sun_path); // left over from an earlier run
+		strcpy(g->socket_path, addr.sun_path);
+
+		g->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (g->listen_fd < 0 || bind(g->listen_fd, (struct sockaddr *)&addr, sizeof(addr)))
+			goto fail;
+	}
+	else
+	{
+		struct sockaddr_in addr;
+		int one = 1;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(atoi(dest));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		g->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (g->listen_fd < 0)
+			return -1;
+		setsockopt(g->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(g->listen_fd, (struct sockaddr *)&addr, sizeof(addr)))
+			goto fail;
+	}
+	if (listen(g->listen_fd, 1))
+		goto fail;
+
+	if (wait)
+	{
+		printf("Waiting for GDB on %s\n", dest);
+		fflush(stdout);
+		g->conn = accept(g->listen_fd, NULL, NULL);
+		if (g->conn < 0)
+			goto fail;
+		g->stop = GDB_STOP_ATTACH;
+	}
+	fcntl(g->listen_fd, F_SETFL, fcntl(g->listen_fd, F_GETFL) | O_NONBLOCK);
+
+	core->gdb = g;
+	return events_schedule(&core->events, core->inst_count + GDB_POLL, gdb_poll, g);
+
+fail:
+	if (g->listen_fd >= 0)
+		close(g->listen_fd);
+	return -1;
+}
+
+void gdb_stop(gdb_stub *g, rv32core *core)
+{
+	events_cancel(&core->events, gdb_poll, g);
+	if (g->conn >= 0)
+		drop_connection(g, core);
+	close(g->listen_fd);
+	if (g->socket_path[0])
+		unlink(g->socket_path);
+	core->gdb = NULL;
+}
+
+// rv32_run, stopping to talk to the debugger whenever it wants to
+int gdb_run(gdb_stub *g, rv32core *core)
+{
+	static char reply[64];
+	int fault = g->conn >= 0 ? DEBUG_BREAK : resume(g, core);
+
+	for (;;)
+	{
+		if (g->conn < 0)
+		{
+			if (fault != DEBUG_BREAK)
+				return fault;
+			fault = resume(g, core); // the debugger left while being attached
+			continue;
+		}
+
+		// The debugger asks for the state itself after attaching
+		stop_reply(g, fault, reply);
+		if (g->stop != GDB_STOP_ATTACH || fault != DEBUG_BREAK)
+		{
+			if (put_packet(g, reply))
+				drop_connection(g, core);
+		}
+		if (fault == SYSCON_SHUTDOWN)
+			return fault;
+
+		int action = g->conn >= 0 ? serve(g, core, fault) : GDB_DETACH;
+		if (action == GDB_KILL)
+			return fault == DEBUG_BREAK ? DEBUG_BREAK : fault;
+		if (action == GDB_DETACH && g->conn >= 0)
+			drop_connection(g, core);
+
+		if (fault != DEBUG_BREAK)
+		{
+			// The program can't go on past a fault
+			if (g->conn >= 0)
+			{
+				sprintf(reply, "X%c%c", reply[1], reply[2]);
+				put_packet(g, reply);
+			}
+			return fault;
+		}
+
+		fault = action == GDB_STEP ? step(g, core) : resume(g, core);
+	}
+}
+
+#else
+
+int gdb_start(gdb_stub *g, rv32core *core, const char *dest, int wait)
+{
+	(void)g;
+	(void)core;
+	(void)dest;
+	(void)wait;
+	return -1; // no sockets here
+}
+
+void gdb_stop(gdb_stub *g, rv32core *core)
+{
+	(void)g;
+	core->gdb = NULL;
+}
+
+int gdb_run(gdb_stub *g, rv32core *core)
+{
+	(void)g;
+	return rv32_run(core);
+}
+
+int gdb_breakpoint(gdb_stub *g, rv32core *core)
+{
+	(void)g;
+	(void)core;
+	return 0;
+}
+
+void gdb_access(gdb_stub *g, rv32core *core, uint32_t addr, int size, int store)
+{
+	(void)g;
+	(void)core;
+	(void)addr;
+	(void)size;
+	(void)store;
+}
+
+void gdb_patch_page(gdb_stub *g, rv32core *core, int page)
+{
+	(void)g;
+	(void)core;
+	(void)page;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include "rv32i.h"
+
+// GDB remote serial protocol stub
+// Listens on a loopback TCP port or a Unix socket ("unix:<path>") while the
+// program runs, so a debugger can attach at any time. Breakpoints cost the
+// fast engine nothing: the decoded op at a breakpoint is replaced by
+// OPK_BREAK, which ends the block before the instruction runs, and setting
+// or clearing one decodes only that op and the one before it again. Only the
+// reference interpreter checks each pc against the breakpoints. Watchpoints
+// send every load and store through rv32_execute for as long as any is set,
+// where the accessed page is checked against the watched ones before the
+// exact ranges. A device event polls the socket for a new connection or an
+// interrupt every GDB_POLL instructions.
+//
+// Hardware breakpoints (Z1) are the same as software ones, nothing is written
+// to guest memory for either.
+
+#define GDB_POLL (1 << 20) // instructions between socket checks
+#define GDB_MAX_BREAKS 64
+#define GDB_MAX_WATCHES 16
+#define GDB_PACKET_SIZE 4096
+
+// Why the core stopped
+#define GDB_STOP_BREAK 0 // breakpoint, or a step that ran into a fault
+#define GDB_STOP_STEP 1
+#define GDB_STOP_WATCH 2
+#define GDB_STOP_INTERRUPT 3 // Ctrl-C in the debugger
+#define GDB_STOP_ATTACH 4
+
+// Watchpoint kinds, as numbered in Z packets
+#define GDB_WATCH_WRITE 2
+#define GDB_WATCH_READ 3
+#define GDB_WATCH_ACCESS 4
+
+struct gdb_watch
+{
+	uint32_t addr;
+	uint32_t len;
+	uint8_t kind;
+};
+typedef struct gdb_watch gdb_watch;
+
+struct gdb_stub
+{
+	int listen_fd;
+	char socket_path[108]; // Unix socket to remove when done, empty for TCP
+	int conn; // connected debugger, -1 if none
+
+	uint32_t breaks[GDB_MAX_BREAKS];
+	int break_count;
+	gdb_watch watches[GDB_MAX_WATCHES];
+	int watch_count;
+	uint8_t watch_pages[256]; // watches per (addr / CODE_PAGE_SIZE) % 256
+	uint8_t idle_off; // spin-loop skipping setting before any breakpoint was set
+
+	int stop; // GDB_STOP_*
+	uint32_t stop_addr; // watched address accessed
+	uint8_t stop_kind;
+	uint64_t resume_count; // inst_count of a step, whose own breakpoint is ignored
+
+	char packet[GDB_PACKET_SIZE + 1];
+};
+typedef struct gdb_stub gdb_stub;
+
+int gdb_start(gdb_stub *g, rv32core *core, const char *dest, int wait);
+void gdb_stop(gdb_stub *g, rv32core *core);
+int gdb_run(gdb_stub *g, rv32core *core);
+
+int gdb_breakpoint(gdb_stub *g, rv32core *core);
+void gdb_access(gdb_stub *g, rv32core *core, uint32_t addr, int size, int store);
+void gdb_patch_page(gdb_stub *g, rv32core *core, int page);
@@ -0,0 +1,286 @@
+#include <stdint.h>
+
+#include "rv32i.h"
+#include "instructions.h"
+#include "opcodes.h"
+#include "isa.h"
+#include "idle.h"
+
+#define REG_BIT(r) (1u << (r))
+
+// Forget every analyzed loop
+void idle_reset(idle_state *idle)
+{
+	for (int i = 0; i < IDLE_CACHE_SIZE; i++)
+	{
+		idle->cache[i].top = 0;
+		idle->cache[i].kind = IDLE_UNKNOWN;
+	}
+	idle->last_top = 0;
+	idle->last_count = 0;
+	idle->skipped = 0;
+	idle->off = 0;
+}
+
+// Work out whether the loop starting at top can be fast-forwarded
+// Only ROM-resident loops are considered, so the result never goes stale.
+static void idle_analyze(rv32core *core, idle_loop *loop, uint32_t top)
+{
+	uint32_t reads[IDLE_MAX_BODY];
+	uint32_t writes[IDLE_MAX_BODY];
+	uint32_t read_first = 0; // registers read before being written in an iteration
+	uint32_t written = 0;
+	uint32_t inst = 0;
+	int len = 0;
+
+	loop->top = top;
+	loop->kind = IDLE_NONE;
+
+	for (int i = 0; i < IDLE_MAX_BODY && !len; i++)
+	{
+		uint32_t pc = top + 4 * i;
+		if (!inROM(pc) || !inROM(pc + 3))
+			return;
+
+		inst = mem_read_32(core, pc);
+		int id = isa_decode(inst);
+		if (id == ISA_UNKNOWN)
+			return; // faults
+		const isa_inst *d = &isa_table[id];
+
+		reads[i] = 0;
+		writes[i] = 0;
+		if (isa_reads_rs1(d->format))
+			reads[i] |= REG_BIT(get_rs1(inst));
+		if (isa_reads_rs2(d->format))
+			reads[i] |= REG_BIT(get_rs2(inst));
+		if (isa_writes_rd(d->cls))
+			writes[i] |= REG_BIT(get_rd(inst));
+
+		switch (d->cls)
+		{
+
+		case ISA_CLASS_ALU:
+		case ISA_CLASS_UPPER:
+		case ISA_CLASS_LOAD:
+			break;
+
+		case ISA_CLASS_BRANCH:
+			if (pc + isa_imm(d->format, inst) != top)
+				return;
+			len = i + 1;
+			break;
+
+		case ISA_CLASS_JUMP:
+			if (id != ISA_JAL || get_rd(inst) != 0 || pc + isa_imm(d->format, inst) != top)
+				return;
+			len = i + 1;
+			break;
+
+		default: // stores, and the FPU and CSR state the analysis doesn't track
+			return;
+		}
+
+		reads[i] &= ~REG_BIT(0);
+		writes[i] &= ~REG_BIT(0);
+		read_first |= reads[i] & ~written;
+		written |= writes[i];
+	}
+
+	if (!len)
+		return;
+
+	loop->len = len;
+	loop->exit = top + 4 * len;
+
+	uint32_t carried = read_first & written; // registers passed from one iteration to the next
+	if (!carried)
+	{
+		// Nothing flows between iterations, so each one recomputes the same state
+		loop->kind = IDLE_POLL;
+		return;
+	}
+
+	// Otherwise look for a single counter stepped by an ADDI and tested by the exit branch
+	if (isa_class(isa_decode(inst)) != ISA_CLASS_BRANCH || (carried & (carried - 1)))
+		return;
+
+	uint8_t c = 0;
+	while (!(carried & REG_BIT(c)))
+		c++;
+
+	int step_at = -1;
+	for (int i = 0; i < len - 1; i++)
+	{
+		if (!((reads[i] | writes[i]) & REG_BIT(c)))
+			continue;
+
+		uint32_t body = mem_read_32(core, top + 4 * i);
+		if (step_at >= 0 || isa_decode(body) != ISA_ADDI || get_rd(body) != c || get_rs1(body) != c)
+			return;
+		step_at = i;
+		loop->step = signextend_12(imm_type_i(body));
+	}
+	if (step_at < 0 || !loop->step)
+		return;
+
+	uint8_t rs1 = get_rs1(inst);
+	uint8_t rs2 = get_rs2(inst);
+	uint8_t func3 = get_func3(inst);
+	uint8_t bound = (rs1 == c) ? rs2 : rs1;
+	if (bound == c || (written & REG_BIT(bound)) || func3 == BEQ)
+		return;
+
+	loop->counter = c;
+	loop->bound = bound;
+	loop->cond = func3;
+	loop->counter_rs1 = (rs1 == c);
+	loop->kind = IDLE_COUNTER;
+}
+
+// Whether the exit branch is taken after k more iterations
+static int counter_taken(idle_loop *loop, uint32_t c0, uint32_t bound, uint64_t k)
+{
+	uint32_t v = c0 + (uint32_t)(k * (uint32_t)loop->step);
+	if (loop->counter_rs1)
+		return branch_taken(loop->cond, v, bound);
+	return branch_taken(loop->cond, bound, v);
+}
+
+// Inverse of an odd number modulo 2^32
+static uint32_t mod_inverse(uint32_t a)
+{
+	uint32_t x = a; // correct to 3 bits
+	for (int i = 0; i < 4; i++)
+		x *= 2 - a * x;
+	return x;
+}
+
+// Number of iterations the loop still runs
+// Sets exits to 1 if the last of them falls through the exit branch, otherwise
+// the branch is taken for all of them (and maybe more).
+static uint64_t counter_iterations(idle_loop *loop, uint32_t c0, uint32_t bound, int *exits)
+{
+	*exits = 0;
+
+	if (loop->cond == BNE)
+	{
+		// Solve c0 + k * step == bound (mod 2^32)
+		uint32_t d = bound - c0;
+		uint32_t step = loop->step;
+		int t = __builtin_ctz(step);
+		if (d & ((1u << t) - 1))
+			return UINT64_MAX; // never equal
+		uint64_t mask = (1ull << (32 - t)) - 1;
+		uint64_t k = ((uint64_t)((d >> t) * mod_inverse(step >> t))) & mask;
+		*exits = 1;
+		return k ? k : mask + 1;
+	}
+
+	// Ordered compares are monotonic as long as the counter does not wrap
+	int is_signed = (loop->cond == BLT || loop->cond == BGE);
+	int64_t w0 = is_signed ? (int64_t)(int32_t)c0 : (int64_t)c0;
+	int64_t lo = is_signed ? INT32_MIN : 0;
+	int64_t hi = is_signed ? INT32_MAX : UINT32_MAX;
+	int64_t step = loop->step;
+	uint64_t kwrap = step > 0 ? (uint64_t)(hi - w0) / step : (uint64_t)(w0 - lo) / -step;
+
+	if (!kwrap)
+		return 0;
+
+	if (!counter_taken(loop, c0, bound, 1))
+	{
+		*exits = 1;
+		return 1;
+	}
+
+	if (counter_taken(loop, c0, bound, kwrap))
+		return kwrap;
+
+	// Smallest k for which the branch falls through
+	uint64_t taken = 1, fall = kwrap;
+	while (fall - taken > 1)
+	{
+		uint64_t mid = taken + (fall - taken) / 2;
+		if (counter_taken(loop, c0, bound, mid))
+			taken = mid;
+		else
+			fall = mid;
+	}
+	*exits = 1;
+	return fall;
+}
+
+// Kind of the loop starting at top, IDLE_NONE if it can't be fast-forwarded
+int idle_kind(rv32core *core, uint32_t top)
+{
+	if (core->idle.off || !inROM(top))
+		return IDLE_NONE;
+
+	idle_loop *loop = idle_slot(&core->idle, top);
+	if (loop->kind == IDLE_UNKNOWN || loop->top != top)
+		idle_analyze(core, loop, top);
+	return loop->kind;
+}
+
+// Called when a backward jump lands on core->pc
+// If that is the top of a loop that can be fast-forwarded, skips as many
+// iterations as possible without passing the next device event, and returns
+// the number of instructions skipped.
+uint64_t idle_skip(rv32core *core)
+{
+	idle_state *idle = &core->idle;
+	uint32_t top = core->pc;
+
+	if (idle_kind(core, top) == IDLE_NONE)
+		return 0;
+	idle_loop *loop = idle_slot(idle, top);
+
+	// Only fast-forward once a whole iteration has just run from the top, so
+	// every register the body writes already holds its steady-state value
+	int steady = (idle->last_top == top && core->inst_count - idle->last_count == loop->len);
+	idle->last_top = top;
+	idle->last_count = core->inst_count;
+	if (!steady)
+		return 0;
+
+	uint64_t deadline = core->events.next;
+	if (deadline <= core->inst_count)
+		return 0;
+	uint64_t max_iter = (deadline - core->inst_count) / loop->len;
+
+	uint64_t n;
+	if (loop->kind == IDLE_POLL)
+	{
+		// Nothing but a device event can end the loop
+		if (deadline == NO_DEADLINE)
+			return 0;
+		n = max_iter;
+	}
+	else
+	{
+		uint32_t *counter = &core->x[loop->counter];
+		int exits;
+		n = counter_iterations(loop, *counter, core->x[loop->bound], &exits);
+
+		if (exits && n <= max_iter)
+		{
+			*counter += (uint32_t)(n * (uint32_t)loop->step);
+			core->inst_count += n * loop->len;
+			core->pc = loop->exit;
+			idle->skipped += n * loop->len;
+			return n * loop->len;
+		}
+
+		if (exits)
+			n--; // stop short of the exiting iteration
+		if (n > max_iter)
+			n = max_iter;
+		*counter += (uint32_t)(n * (uint32_t)loop->step);
+	}
+
+	core->inst_count += n * loop->len;
+	idle->last_count = core->inst_count;
+	idle->skipped += n * loop->len;
+	return n * loop->len;
+}
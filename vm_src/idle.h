@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+// Spin-loop detection
+// Tight loops whose only effect is counting a register up or down, or polling
+// the same address over and over, are fast-forwarded instead of executed.
+
+struct rv32core;
+
+// Longest loop body considered, in instructions
+#define IDLE_MAX_BODY 16
+
+// Number of analyzed loops remembered
+#define IDLE_CACHE_SIZE 64
+
+// Loop kinds
+#define IDLE_UNKNOWN 0 // not analyzed yet
+#define IDLE_NONE	 1 // has side effects, execute normally
+#define IDLE_POLL	 2 // every iteration leaves the same state behind
+#define IDLE_COUNTER 3 // one register steps by a constant until the exit branch falls through
+
+struct idle_loop
+{
+	uint32_t top; // loop entry (target of the backward branch)
+	uint32_t exit; // address following the backward branch
+	int32_t step; // counter increment per iteration
+	uint8_t kind;
+	uint8_t len;	 // instructions per iteration
+	uint8_t counter; // register stepped by the loop
+	uint8_t bound;	 // register the counter is compared against
+	uint8_t cond;	 // func3 of the exit branch
+	uint8_t counter_rs1; // 1 if the counter is the first branch operand
+};
+typedef struct idle_loop idle_loop;
+
+struct idle_state
+{
+	idle_loop cache[IDLE_CACHE_SIZE];
+	uint32_t last_top;	 // loop top reached by the previous backward jump
+	uint64_t last_count; // inst_count when it was reached
+	uint64_t skipped;	 // instructions fast-forwarded so far
+	uint8_t off;		 // run every loop as written
+};
+typedef struct idle_state idle_state;
+
+// Cache slot for the loop starting at top
+static inline idle_loop *idle_slot(idle_state *idle, uint32_t top)
+{
+	return &idle->cache[(top >> 2) % IDLE_CACHE_SIZE];
+}
+
+void idle_reset(idle_state *idle);
+int idle_kind(struct rv32core *core, uint32_t top);
+uint64_t idle_skip(struct rv32core *core);
@@ -2,6 +2,13 @@
 
 #include "rv32i.h"
 #include "opcodes.h"
+#include "stats.h"
+#include "trace.h"
+#include "cache.h"
+#include "gdbstub.h"
+#include "plugin.h"
+#include "isa.h"
+#include "fpu.h"
 
 // Functions used for decoding instructions
 
@@ -41,6 +48,24 @@ uint16_t imm_type_i(uint32_t inst)
 	return inst >> 20;
 }
 
+// Get sign extended immediate value from B-type instruction
+uint32_t imm_type_b(uint32_t inst)
+{
+	uint32_t imm = ((inst & 0xF00) >> 7) | ((inst & 0x7E000000) >> 20) | ((inst & 0x80) << 4) | ((inst >> 31) << 12);
+	if (imm & 0x1000) // Sign extend
+		imm |= 0xFFFFE000;
+	return imm;
+}
+
+// Get sign extended immediate value from J-type instruction
+uint32_t imm_type_j(uint32_t inst)
+{
+	uint32_t imm = ((inst & 0x80000000) >> 11) | ((inst & 0x7FE00000) >> 20) | ((inst & 0x00100000) >> 9) | (inst & 0x000ff000);
+	if (imm & 0x00100000) // Sign extend
+		imm |= 0xffe00000;
+	return imm;
+}
+
 // Sign extend from 12 bits to 32
 uint32_t signextend_12(uint16_t val)
 {
@@ -49,328 +74,202 @@ uint32_t signextend_12(uint16_t val)
 	else return val;
 }
 
-int exec_op_imm(rv32core *core, uint32_t inst)
+// Evaluate a branch condition
+// Returns 1 if taken, 0 if not, UNDEF_FUNC3 for an invalid condition
+int branch_taken(uint8_t func3, uint32_t a, uint32_t b)
 {
-	uint8_t func3 = get_func3(inst);
-	uint8_t rs1 = get_rs1(inst);
-	uint8_t rd = get_rd(inst);
-	uint16_t imm = imm_type_i(inst);
-	uint32_t ext_imm = signextend_12(imm);
-	uint8_t shamt;
-
 	switch (func3)
 	{
 
-	case ADDI:
-		core->x[rd] = core->x[rs1] + ext_imm;
-		break;
-	
-	case SLTI:
-		if ((int32_t)(core->x[rs1]) < (int32_t)(ext_imm))
-			core->x[rd] = 1;
-		else core->x[rd] = 0;
-		break;
-
-	case SLTIU:
-		if (core->x[rs1] < ext_imm)
-			core->x[rd] = 1;
-		else core->x[rd] = 0;
-		break;
-
-	case ANDI:
-		core->x[rd] = core->x[rs1] & ext_imm;
-		break;
-
-	case ORI:
-		core->x[rd] = core->x[rs1] | ext_imm;
-		break;
-
-	case XORI:
-		core->x[rd] = core->x[rs1] ^ ext_imm;
-		break;
-
-	case SLLI:
-		shamt = imm & 0x1F;
-		core->x[rd] = core->x[rs1] << shamt;
-		break;
-
-	case SRLI_SRAI:
-		shamt = imm & 0x1F;
-		uint8_t func7 = get_func7(inst);
-		if (func7) {
-			// SRAI
-			uint32_t sign = core->x[rs1] & (1 << 31);
-			if (sign)
-				sign = ~0 << (uint8_t)(32 - shamt);
-			core->x[rd] = (core->x[rs1] >> shamt) | sign;
-		}
-		else // SRLI
-			core->x[rd] = core->x[rs1] >> shamt;
-		break;
-
-	default:
-		return UNDEF_FUNC3;
-		break;
-	}
+	case BEQ:
+		return a == b;
 
-	return 0;
-}
+	case BNE:
+		return a != b;
 
-int exec_op_lui(rv32core* core, uint32_t inst)
-{
-	uint8_t rd = get_rd(inst);
-	core->x[rd] = inst & 0xFFFFF000;
-	return 0;
-}
+	case BLTU:
+		return a < b;
 
-int exec_op_auipc(rv32core* core, uint32_t inst)
-{
-	uint8_t rd = get_rd(inst);
-	core->x[rd] = (inst & 0xFFFFF000) + core->pc;
-	return 0;
-}
+	case BLT:
+		return (int32_t)a < (int32_t)b;
 
-int exec_op_op(rv32core* core, uint32_t inst)
-{
-	uint8_t func3 = get_func3(inst);
-	uint8_t func7 = get_func7(inst);
-	uint8_t rs1 = get_rs1(inst);
-	uint8_t rs2 = get_rs2(inst);
-	uint8_t rd = get_rd(inst);
+	case BGEU:
+		return a >= b;
 
+	case BGE:
+		return (int32_t)a >= (int32_t)b;
 
-	if (func7 == 1) // RV32M extension
-	{
-		switch (func3)
-		{
-		case MUL:
-			core->x[rd] = core->x[rs1] * core->x[rs2];
-			break;
-
-		case MULH:
-			core->x[rd] = ((int64_t)((int32_t)core->x[rs1]) * (int64_t)((int32_t)core->x[rs2])) >> 32;
-			break;
-
-		case MULHSU:
-			core->x[rd] = ((int64_t)((int32_t)core->x[rs1]) * (uint64_t)core->x[rs2]) >> 32;
-			break;
-
-		case MULHU:
-			core->x[rd] = ((uint64_t)core->x[rs1] * (uint64_t)core->x[rs2]) >> 32;
-			break;
-
-		// finish the M extension!!!
-
-		default:
-			return UNDEF_FUNC3;
-			break;
-		}
-	}
-	else { // RV32I
-		switch (func3)
-		{
-		case ADD_SUB:
-			if (!func7) // ADD
-				core->x[rd] = core->x[rs1] + core->x[rs2];
-			else core->x[rd] = core->x[rs1] - core->x[rs2]; // SUB
-			break;
-
-		case SLL:
-			core->x[rd] = core->x[rs1] << (core->x[rs2] & 0x1F);
-			break;
-
-		case SRL_SRA:
-			uint8_t shamt = (core->x[rs2] & 0x1F);
-			if (func7) {
-				// SRA
-				uint32_t sign = core->x[rs1] & (1 << 31);
-				if (sign)
-					sign = ~0 << (uint8_t)(32 - shamt);
-				core->x[rd] = (core->x[rs1] >> shamt) | sign;
-			}
-			else // SRL
-				core->x[rd] = core->x[rs1] >> shamt;
-			break;
-
-		case SLT:
-			if ((int32_t)(core->x[rs1]) < (int32_t)(core->x[rs2]))
-				core->x[rd] = 1;
-			else core->x[rd] = 0;
-			break;
-
-		case SLTU:
-			if (core->x[rs1] < core->x[rs2])
-				core->x[rd] = 1;
-			else core->x[rd] = 0;
-			break;
-
-		case AND:
-			core->x[rd] = core->x[rs1] & core->x[rs2];
-			break;
-
-		case OR:
-			core->x[rd] = core->x[rs1] | core->x[rs2];
-			break;
-
-		case XOR:
-			core->x[rd] = core->x[rs1] ^ core->x[rs2];
-			break;
-
-		default:
-			return UNDEF_FUNC3;
-			break;
-		}
+	default:
+		return UNDEF_FUNC3;
 	}
-	return 0;
 }
 
-int exec_op_jal(rv32core* core, uint32_t inst)
-{
-	uint8_t rd = get_rd(inst);
-	uint32_t imm = ((inst & 0x80000000) >> 11) | ((inst & 0x7FE00000) >> 20) | ((inst & 0x00100000) >> 9) | (inst & 0x000ff000); // J-type immediate
-	if (imm & 0x00100000) // Sign extend
-		imm |= 0xffe00000;
-	core->x[rd] = core->pc + 4;
-	core->pc = core->pc + imm - 4;
-	return 0;
-}
+// Memory access for loads and stores, func3 gives the width
+// Anything outside RAM and ROM is MMIO.
 
-int exec_op_jalr(rv32core* core, uint32_t inst)
+static uint32_t exec_load(rv32core *core, uint32_t addr, uint8_t func3)
 {
-	uint8_t rd = get_rd(inst);
-	uint8_t rs1 = get_rs1(inst);
-	core->x[rd] = core->pc + 4;
-	core->pc = ((signextend_12(imm_type_i(inst)) + core->x[rs1]) & 0xFFFFFFFE) - 4;
-	return 0;
-}
-
-int exec_op_load(rv32core* core, uint32_t inst)
-{
-	uint8_t rd = get_rd(inst);
-	uint8_t rs1 = get_rs1(inst);
-	uint32_t addr = signextend_12(imm_type_i(inst)) + core->x[rs1];
-	uint8_t func3 = get_func3(inst);
+	uint32_t value;
+	if (core->gdb)
+		gdb_access(core->gdb, core, addr, 1 << (func3 & 3), 0);
 
 	if (!inMemory(addr)) // MMIO
 	{
-		core->x[rd] = mmio_load(addr);
-		return 0;
+		STATS_COUNT(core, mmio_loads);
+		value = mmio_load(core, addr, core->inst_count);
+		TRACE_ACCESS(core, addr, value, TRACE_LOAD | (func3 & 3));
+		if (core->plugins)
+			plugin_access(core->plugins, core, addr, value, 1 << (func3 & 3), 0);
+		return value;
 	}
 
+	if (inROM(addr))
+		STATS_COUNT(core, rom_loads);
+	else
+		STATS_COUNT(core, ram_loads);
+
 	switch (func3)
 	{
-
-	case LW:
-		core->x[rd] = mem_read_32(core, addr);
-		break;
-
-	case LH:
-		core->x[rd] = (int16_t)mem_read_16(core, addr);
-		break;
-
-	case LHU:
-		core->x[rd] = mem_read_16(core, addr);
-		break;
-
-	case LB:
-		core->x[rd] = (int8_t)mem_read_8(core, addr);
-		break;
-
-	case LBU:
-		core->x[rd] = mem_read_8(core, addr);
-		break;
-
-	default:
-		return UNDEF_FUNC3;
-		break;
+	case LB:  value = (int8_t)mem_read_8(core, addr); break;
+	case LH:  value = (int16_t)mem_read_16(core, addr); break;
+	case LBU: value = mem_read_8(core, addr); break;
+	case LHU: value = mem_read_16(core, addr); break;
+	default:  value = mem_read_32(core, addr); break;
 	}
-
-	return 0;
+	TRACE_ACCESS(core, addr, value, TRACE_LOAD | (func3 & 3));
+	CACHE_ACCESS(core, core->pc, addr, 1 << (func3 & 3), 0);
+	if (core->plugins)
+		plugin_access(core->plugins, core, addr, value, 1 << (func3 & 3), 0);
+	return value;
 }
 
-int exec_op_store(rv32core* core, uint32_t inst)
+static int exec_store(rv32core *core, uint32_t addr, uint32_t value, uint8_t func3)
 {
-	uint8_t rs1 = get_rs1(inst);
-	uint8_t rs2 = get_rs2(inst);
-	uint32_t addr = signextend_12( ((inst >> 7) & 0x1F) | ((inst & 0xFE000000) >> 20)) + core->x[rs1];
-	uint8_t func3 = get_func3(inst);
+	uint32_t stored = func3 == SW ? value : func3 == SH ? value & 0xFFFF : value & 0xFF;
+	if (core->gdb)
+		gdb_access(core->gdb, core, addr, 1 << (func3 & 3), 1);
+	TRACE_ACCESS(core, addr, stored, TRACE_STORE | (func3 & 3));
+	if (core->plugins)
+		plugin_access(core->plugins, core, addr, stored, 1 << (func3 & 3), 1);
 
 	if (!inMemory(addr)) // MMIO
-		return mmio_store(addr, core->x[rs2]);
+	{
+		STATS_COUNT(core, mmio_stores);
+		return mmio_store(core, addr, value);
+	}
 
-	if(inROM(addr))
+	if (inROM(addr))
 		return WRITE_ROM;
+	STATS_COUNT(core, ram_stores);
+	CACHE_ACCESS(core, core->pc, addr, 1 << (func3 & 3), 1);
 
 	switch (func3)
 	{
-
-	case SW:
-		mem_store_32(core, addr, core->x[rs2]);
-		break;
-
-	case SH:
-		mem_store_16(core, addr, core->x[rs2]);
-		break;
-
-	case SB:
-		mem_store_8(core, addr, core->x[rs2]);
-		break;
-
-	default:
-		return UNDEF_FUNC3;
-		break;
+	case SB: mem_store_8(core, addr, value); break;
+	case SH: mem_store_16(core, addr, value); break;
+	default: mem_store_32(core, addr, value); break;
 	}
-
 	return 0;
 }
 
-int exec_op_branch(rv32core* core, uint32_t inst)
-{
-	uint8_t rs1 = get_rs1(inst);
-	uint8_t rs2 = get_rs2(inst);
-	uint8_t func3 = get_func3(inst);
-	uint32_t addr = ((inst & 0xF00) >> 7) | ((inst & 0x7E000000) >> 20) | ((inst & 0x80) << 4) | ((inst >> 31) << 12); // B-type immediate
-	if (addr & 0x1000) // Sign extend
-		addr |= 0xFFFFE000;
-	addr = addr + core->pc - 4;
-
-	switch (func3)
-	{
-
-	case BEQ:
-		if (core->x[rs1] == core->x[rs2])
-			core->pc = addr;
-		break;
-
-	case BNE:
-		if (core->x[rs1] != core->x[rs2])
-			core->pc = addr;
-		break;
-
-	case BLTU:
-		if (core->x[rs1] < core->x[rs2])
-			core->pc = addr;
-		break;
-
-	case BLT:
-		if ((int32_t)core->x[rs1] < (int32_t)core->x[rs2])
-			core->pc = addr;
-		break;
-
-	case BGEU:
-		if (core->x[rs1] >= core->x[rs2])
-			core->pc = addr;
-		break;
-
-	case BGE:
-		if ((int32_t)core->x[rs1] > (int32_t)core->x[rs2])
-			core->pc = addr;
-		break;
-
-	default:
-		return UNDEF_FUNC3;
-		break;
+// Handlers, one per instruction of isa.h
+// What a class does with the semantics of an instruction is spelled out
+// once here. Jumps and taken branches leave pc 4 short of their target,
+// rv32_execute adds the 4 like it does for everything else.
+
+#define RD core->x[get_rd(inst)]
+#define RS1 core->x[get_rs1(inst)]
+#define RS2 core->x[get_rs2(inst)]
+#define IMM imm
+#define PC core->pc
+#define FRD core->f[get_rd(inst)]
+#define F1 fpu_float(core->f[get_rs1(inst)])
+#define F2 fpu_float(core->f[get_rs2(inst)])
+#define F3 fpu_float(core->f[inst >> 27])
+#define FB1 core->f[get_rs1(inst)]
+#define FB2 core->f[get_rs2(inst)]
+#define RM rm
+#define CSR csr
+
+#define EXEC_ALU(semantics) RD = (semantics);
+#define EXEC_UPPER(semantics) RD = (semantics);
+#define EXEC_LOAD(semantics) RD = exec_load(core, RS1 + IMM, semantics);
+#define EXEC_STORE(semantics) fault = exec_store(core, RS1 + IMM, RS2, semantics);
+#define EXEC_BRANCH(semantics) if (semantics) PC += IMM - 4;
+#define EXEC_JUMP(semantics)			\
+	uint32_t target = (semantics);		\
+	RD = PC + 4;						\
+	PC = target - 4;
+#define EXEC_FLOAD(semantics) FRD = exec_load(core, RS1 + IMM, semantics);
+#define EXEC_FSTORE(semantics) fault = exec_store(core, RS1 + IMM, FB2, semantics);
+#define EXEC_FARITH(semantics)					\
+	int rm = fpu_rm(core, get_func3(inst));		\
+	if (rm < 0)									\
+		return UNDEF_FUNC3;						\
+	uint32_t env = fpu_enter(rm);				\
+	volatile float result = (semantics);		\
+	fpu_leave(core, env);						\
+	FRD = fpu_bits(result);
+#define EXEC_FBITS(semantics) FRD = (semantics);
+#define EXEC_FTOX(semantics)					\
+	int rm = fpu_rm(core, get_func3(inst));		\
+	if (rm < 0)									\
+		return UNDEF_FUNC3;						\
+	RD = (semantics);
+#define EXEC_CSR(semantics)										\
+	uint32_t csr;												\
+	fault = fpu_csr_read(core, inst >> 20, &csr);				\
+	if (!fault)													\
+		fault = fpu_csr_write(core, inst >> 20, (semantics));	\
+	if (!fault)													\
+		RD = csr;
+
+#define ISA_HANDLER(id, mnemonic, format, class, match, mask, semantics)	\
+	static int exec_##id(rv32core *core, uint32_t inst)					\
+	{																		\
+		int fault = 0;														\
+		uint32_t imm = isa_imm(ISA_FMT_##format, inst);						\
+		(void)imm;															\
+		EXEC_##class(semantics)												\
+		return fault;														\
 	}
 
-	return 0;
+RV32_ISA(ISA_HANDLER)
+
+#undef ISA_HANDLER
+#undef RD
+#undef RS1
+#undef RS2
+#undef IMM
+#undef PC
+#undef FRD
+#undef F1
+#undef F2
+#undef F3
+#undef FB1
+#undef FB2
+#undef RM
+#undef CSR
+
+// Dispatch table, by instruction id
+static int (*const handlers[ISA_COUNT])(rv32core *core, uint32_t inst) = {
+#define ISA_DISPATCH(id, mnemonic, format, class, match, mask, semantics) exec_##id,
+	RV32_ISA(ISA_DISPATCH)
+#undef ISA_DISPATCH
+};
+
+// Run the handler of inst, already decoded to id, without advancing pc
+// Returns the fault it raised, or 0
+int exec_handler(rv32core *core, int id, uint32_t inst)
+{
+	if (id == ISA_UNKNOWN)
+		return isa_fault(inst);
+	return handlers[id](core, inst);
+}
+
+// Execute one instruction, without advancing pc
+// Returns the fault it raised, or 0
+int exec_inst(rv32core *core, uint32_t inst)
+{
+	return exec_handler(core, isa_decode(inst), inst);
 }
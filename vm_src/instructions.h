@@ -4,16 +4,18 @@
 #include "rv32i.h"
 
 uint8_t get_opcode(uint32_t inst);
+uint8_t get_rd(uint32_t inst);
+uint8_t get_rs1(uint32_t inst);
+uint8_t get_rs2(uint32_t inst);
+uint8_t get_func3(uint32_t inst);
+uint8_t get_func7(uint32_t inst);
 
-int exec_op_op(rv32core* core, uint32_t inst);
-int exec_op_imm(rv32core* core, uint32_t inst);
+uint16_t imm_type_i(uint32_t inst);
+uint32_t imm_type_b(uint32_t inst);
+uint32_t imm_type_j(uint32_t inst);
+uint32_t signextend_12(uint16_t val);
 
-int exec_op_lui(rv32core* core, uint32_t inst);
-int exec_op_auipc(rv32core* core, uint32_t inst);
+int branch_taken(uint8_t func3, uint32_t a, uint32_t b);
 
-int exec_op_jal(rv32core* core, uint32_t inst);
-int exec_op_jalr(rv32core* core, uint32_t inst);
-int exec_op_branch(rv32core* core, uint32_t inst);
-
-int exec_op_load(rv32core* core, uint32_t inst);
-int exec_op_store(rv32core* core, uint32_t inst);
\ No newline at end of file
+int exec_handler(rv32core *core, int id, uint32_t inst);
+int exec_inst(rv32core *core, uint32_t inst);
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "rv32i.h"
+#include "instructions.h"
+#include "isa.h"
+
+const isa_inst isa_table[ISA_COUNT] = {
+#define ISA_ENTRY(id, mnemonic, format, class, match, mask, semantics) \
+	{mnemonic, ISA_FMT_##format, ISA_CLASS_##class, match, mask},
+	RV32_ISA(ISA_ENTRY)
+#undef ISA_ENTRY
+};
+
+// Decoding
+// Instructions are sorted by opcode and func3, the two fields every
+// instruction of the table either matches exactly or ignores. A key gives
+// the handful of candidates left, which are told apart by their masks
+// (func7 and the like), so decoding takes one lookup and a compare or two.
+// The candidates carry their match and mask, so that stays in one cache line.
+
+#define KEY_COUNT 256
+#define KEY(inst) ((((inst) >> 2) & 0x1F) << 3 | (((inst) >> 12) & 0x7))
+
+struct candidate
+{
+	uint32_t match;
+	uint32_t mask;
+	int id;
+};
+
+static uint16_t key_first[KEY_COUNT + 1]; // candidates of a key run up to the next key's first
+static struct candidate candidates[ISA_COUNT * 8]; // an instruction without a func3 has 8 keys
+
+// Sort the table by key, once before anything is decoded
+void isa_init(void)
+{
+	int n = 0;
+	for (int key = 0; key < KEY_COUNT; key++)
+	{
+		uint32_t inst = 0x3 | (uint32_t)(key >> 3) << 2 | (uint32_t)(key & 7) << 12;
+		key_first[key] = n;
+		for (int id = 0; id < ISA_COUNT; id++)
+		{
+			uint32_t mask = isa_table[id].mask & 0x707F;
+			if ((inst & mask) == (isa_table[id].match & mask))
+			{
+				candidates[n].match = isa_table[id].match;
+				candidates[n].mask = isa_table[id].mask;
+				candidates[n++].id = id;
+			}
+		}
+	}
+	key_first[KEY_COUNT] = n;
+}
+
+// Instruction id of inst, ISA_UNKNOWN if it isn't one
+int isa_decode(uint32_t inst)
+{
+	int key = KEY(inst);
+	const struct candidate *c = &candidates[key_first[key]];
+	const struct candidate *end = &candidates[key_first[key + 1]];
+	for (; c < end; c++)
+	{
+		if ((inst & c->mask) == c->match)
+			return c->id;
+	}
+	return ISA_UNKNOWN;
+}
+
+// The fault running an instruction isa_decode doesn't know raises
+int isa_fault(uint32_t inst)
+{
+	int key = KEY(inst);
+	if (key_first[key + 1] > key_first[key] && (inst & 3) == 3)
+		return UNDEF_FUNC7;
+	for (int func3 = 0; func3 < 8; func3++)
+	{
+		key = (KEY(inst) & ~7) | func3;
+		if (key_first[key + 1] > key_first[key] && (inst & 3) == 3)
+			return UNDEF_FUNC3;
+	}
+	return UNDEF_OPCODE;
+}
+
+// Immediate of an instruction of the format, sign extended
+// Shifts get their shift amount, csr immediates the 5 bits in place of rs1,
+// instructions without an immediate 0.
+uint32_t isa_imm(int format, uint32_t inst)
+{
+	switch (format)
+	{
+	case ISA_FMT_I:
+	case ISA_FMT_L:
+	case ISA_FMT_FL:
+		return signextend_12(imm_type_i(inst));
+	case ISA_FMT_SH:
+		return imm_type_i(inst) & 0x1F;
+	case ISA_FMT_S:
+	case ISA_FMT_FS:
+		return signextend_12(((inst >> 7) & 0x1F) | ((inst & 0xFE000000) >> 20));
+	case ISA_FMT_B:
+		return imm_type_b(inst);
+	case ISA_FMT_U:
+		return inst & 0xFFFFF000;
+	case ISA_FMT_J:
+		return imm_type_j(inst);
+	case ISA_FMT_CSRI:
+		return get_rs1(inst);
+	default:
+		return 0;
+	}
+}
+
+static const char *abi_names[32] = {
+	"zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+	"a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+static const char *abi_fnames[32] = {
+	"ft0", "ft1", "ft2", "ft3", "ft4", "ft5", "ft6", "ft7", "fs0", "fs1", "fa0", "fa1", "fa2", "fa3", "fa4", "fa5",
+	"fa6", "fa7", "fs2", "fs3", "fs4", "fs5", "fs6", "fs7", "fs8", "fs9", "fs10", "fs11", "ft8", "ft9", "ft10", "ft11"};
+
+static void csr_name(char *buf, int len, uint32_t csr)
+{
+	switch (csr)
+	{
+	case 0x001: snprintf(buf, len, "fflags"); break;
+	case 0x002: snprintf(buf, len, "frm"); break;
+	case 0x003: snprintf(buf, len, "fcsr"); break;
+	default:	snprintf(buf, len, "0x%03x", csr); break;
+	}
+}
+
+// Disassemble the instruction at pc into buf
+void isa_disasm(char *buf, int len, uint32_t inst, uint32_t pc)
+{
+	int id = isa_decode(inst);
+	if (id == ISA_UNKNOWN)
+	{
+		snprintf(buf, len, ".word 0x%08x", inst);
+		return;
+	}
+
+	const isa_inst *d = &isa_table[id];
+	const char *rd = abi_names[get_rd(inst)];
+	const char *rs1 = abi_names[get_rs1(inst)];
+	const char *rs2 = abi_names[get_rs2(inst)];
+	const char *frd = abi_fnames[get_rd(inst)];
+	const char *frs1 = abi_fnames[get_rs1(inst)];
+	const char *frs2 = abi_fnames[get_rs2(inst)];
+	int32_t imm = isa_imm(d->format, inst);
+	char csr[8];
+	csr_name(csr, sizeof(csr), inst >> 20);
+
+	switch (d->format)
+	{
+	case ISA_FMT_R:
+		snprintf(buf, len, "%s %s, %s, %s", d->mnemonic, rd, rs1, rs2);
+		break;
+	case ISA_FMT_R1:
+		snprintf(buf, len, "%s %s, %s", d->mnemonic, rd, rs1);
+		break;
+	case ISA_FMT_I:
+	case ISA_FMT_SH:
+		snprintf(buf, len, "%s %s, %s, %d", d->mnemonic, rd, rs1, imm);
+		break;
+	case ISA_FMT_L:
+		snprintf(buf, len, "%s %s, %d(%s)", d->mnemonic, rd, imm, rs1);
+		break;
+	case ISA_FMT_S:
+		snprintf(buf, len, "%s %s, %d(%s)", d->mnemonic, rs2, imm, rs1);
+		break;
+	case ISA_FMT_B:
+		snprintf(buf, len, "%s %s, %s, 0x%08x", d->mnemonic, rs1, rs2, pc + imm);
+		break;
+	case ISA_FMT_U:
+		snprintf(buf, len, "%s %s, 0x%x", d->mnemonic, rd, inst >> 12);
+		break;
+	case ISA_FMT_J:
+		snprintf(buf, len, "%s %s, 0x%08x", d->mnemonic, rd, pc + imm);
+		break;
+	case ISA_FMT_FL:
+		snprintf(buf, len, "%s %s, %d(%s)", d->mnemonic, frd, imm, rs1);
+		break;
+	case ISA_FMT_FS:
+		snprintf(buf, len, "%s %s, %d(%s)", d->mnemonic, frs2, imm, rs1);
+		break;
+	case ISA_FMT_FR:
+		snprintf(buf, len, "%s %s, %s, %s", d->mnemonic, frd, frs1, frs2);
+		break;
+	case ISA_FMT_FR1:
+		snprintf(buf, len, "%s %s, %s", d->mnemonic, frd, frs1);
+		break;
+	case ISA_FMT_FR4:
+		snprintf(buf, len, "%s %s, %s, %s, %s", d->mnemonic, frd, frs1, frs2, abi_fnames[inst >> 27]);
+		break;
+	case ISA_FMT_FCMP:
+		snprintf(buf, len, "%s %s, %s, %s", d->mnemonic, rd, frs1, frs2);
+		break;
+	case ISA_FMT_FX:
+		snprintf(buf, len, "%s %s, %s", d->mnemonic, rd, frs1);
+		break;
+	case ISA_FMT_XF:
+		snprintf(buf, len, "%s %s, %s", d->mnemonic, frd, rs1);
+		break;
+	case ISA_FMT_CSR:
+		snprintf(buf, len, "%s %s, %s, %s", d->mnemonic, rd, csr, rs1);
+		break;
+	case ISA_FMT_CSRI:
+		snprintf(buf, len, "%s %s, %s, %d", d->mnemonic, rd, csr, imm);
+		break;
+	}
+}
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <stdint.h>
+
+// Instruction set description
+// Every instruction the emulator knows is one line of RV32_ISA, which the
+// rest of the emulator expands to get its decoder (isa.c), the reference
+// interpreter's handlers and dispatch table (instructions.c), the fast
+// engine's op kinds (decode.h) and the cases of its switch (engine.c), the
+// disassembler and the instruction mix statistics. Supporting a new
+// instruction means adding a line here, plus a hand-written case in the
+// fast engine only if it needs more than its semantics.
+//
+// ISA(id, mnemonic, format, class, match, mask, semantics)
+//   format     how operands are encoded and printed, ISA_FMT_<format>:
+//              R       rd, rs1, rs2
+//              R1      rd, rs1         rs2 is part of the encoding
+//              I       rd, rs1, imm
+//              SH      rd, rs1, shamt
+//              L       rd, imm(rs1)    loads and jalr
+//              S       rs2, imm(rs1)
+//              B       rs1, rs2, pc + imm
+//              U       rd, imm >> 12
+//              J       rd, pc + imm
+//              FL      frd, imm(rs1)
+//              FS      frs2, imm(rs1)
+//              FR      frd, frs1, frs2
+//              FR1     frd, frs1
+//              FR4     frd, frs1, frs2, frs3
+//              FCMP    rd, frs1, frs2
+//              FX      rd, frs1
+//              XF      frd, rs1
+//              CSR     rd, csr, rs1
+//              CSRI    rd, csr, imm    imm is the 5 bits in place of rs1
+//   class      what the semantics mean, ISA_CLASS_<class>:
+//              ALU     value written to rd, from RS1, RS2 and IMM
+//              UPPER   value written to rd, which may also use PC
+//              LOAD    the load func3 in opcodes.h: width and signedness
+//              STORE   the store func3 in opcodes.h: width
+//              BRANCH  condition for jumping to PC + IMM
+//              JUMP    target, rd gets the return address
+//              FLOAD   the load func3 for a word, into frd
+//              FSTORE  the store func3 for a word, from frs2
+//              FARITH  float result on the host FPU, in the rounding mode
+//                      RM, written to frd with NaNs made canonical
+//              FBITS   bit pattern written to frd, no rounding involved
+//              FTOX    value written to rd, from a float register
+//              CSR     new value of the csr, from its old value CSR
+//   match/mask an instruction is this one if (inst & mask) == match
+//   semantics  an expression over RS1, RS2, IMM (sign extended, or the
+//              shift amount) and PC, no commas outside parentheses. Float
+//              registers read as floats F1, F2, F3 or bit patterns FB1,
+//              FB2; the fpu.h helpers take core to raise fflags.
+
+#define RV32_ISA(ISA) \
+	ISA(LUI,    "lui",    U,  UPPER,  0x00000037, 0x0000007F, IMM) \
+	ISA(AUIPC,  "auipc",  U,  UPPER,  0x00000017, 0x0000007F, PC + IMM) \
+	\
+	ISA(ADDI,   "addi",   I,  ALU,    0x00000013, 0x0000707F, RS1 + IMM) \
+	ISA(SLTI,   "slti",   I,  ALU,    0x00002013, 0x0000707F, (int32_t)RS1 < (int32_t)IMM) \
+	ISA(SLTIU,  "sltiu",  I,  ALU,    0x00003013, 0x0000707F, RS1 < IMM) \
+	ISA(XORI,   "xori",   I,  ALU,    0x00004013, 0x0000707F, RS1 ^ IMM) \
+	ISA(ORI,    "ori",    I,  ALU,    0x00006013, 0x0000707F, RS1 | IMM) \
+	ISA(ANDI,   "andi",   I,  ALU,    0x00007013, 0x0000707F, RS1 & IMM) \
+	ISA(SLLI,   "slli",   SH, ALU,    0x00001013, 0xFE00707F, RS1 << IMM) \
+	ISA(SRLI,   "srli",   SH, ALU,    0x00005013, 0xFE00707F, RS1 >> IMM) \
+	ISA(SRAI,   "srai",   SH, ALU,    0x40005013, 0xFE00707F, (int32_t)RS1 >> IMM) \
+	\
+	ISA(ADD,    "add",    R,  ALU,    0x00000033, 0xFE00707F, RS1 + RS2) \
+	ISA(SUB,    "sub",    R,  ALU,    0x40000033, 0xFE00707F, RS1 - RS2) \
+	ISA(SLL,    "sll",    R,  ALU,    0x00001033, 0xFE00707F, RS1 << (RS2 & 0x1F)) \
+	ISA(SLT,    "slt",    R,  ALU,    0x00002033, 0xFE00707F, (int32_t)RS1 < (int32_t)RS2) \
+	ISA(SLTU,   "sltu",   R,  ALU,    0x00003033, 0xFE00707F, RS1 < RS2) \
+	ISA(XOR,    "xor",    R,  ALU,    0x00004033, 0xFE00707F, RS1 ^ RS2) \
+	ISA(SRL,    "srl",    R,  ALU,    0x00005033, 0xFE00707F, RS1 >> (RS2 & 0x1F)) \
+	ISA(SRA,    "sra",    R,  ALU,    0x40005033, 0xFE00707F, (int32_t)RS1 >> (RS2 & 0x1F)) \
+	ISA(OR,     "or",     R,  ALU,    0x00006033, 0xFE00707F, RS1 | RS2) \
+	ISA(AND,    "and",    R,  ALU,    0x00007033, 0xFE00707F, RS1 & RS2) \
+	\
+	ISA(MUL,    "mul",    R,  ALU,    0x02000033, 0xFE00707F, RS1 * RS2) \
+	ISA(MULH,   "mulh",   R,  ALU,    0x02001033, 0xFE00707F, ((int64_t)(int32_t)RS1 * (int64_t)(int32_t)RS2) >> 32) \
+	ISA(MULHSU, "mulhsu", R,  ALU,    0x02002033, 0xFE00707F, ((int64_t)(int32_t)RS1 * (uint64_t)RS2) >> 32) \
+	ISA(MULHU,  "mulhu",  R,  ALU,    0x02003033, 0xFE00707F, ((uint64_t)RS1 * (uint64_t)RS2) >> 32) \
+	ISA(DIV,    "div",    R,  ALU,    0x02004033, 0xFE00707F, isa_div(RS1, RS2)) \
+	ISA(DIVU,   "divu",   R,  ALU,    0x02005033, 0xFE00707F, RS2 ? RS1 / RS2 : 0xFFFFFFFF) \
+	ISA(REM,    "rem",    R,  ALU,    0x02006033, 0xFE00707F, isa_rem(RS1, RS2)) \
+	ISA(REMU,   "remu",   R,  ALU,    0x02007033, 0xFE00707F, RS2 ? RS1 % RS2 : RS1) \
+	\
+	ISA(SH1ADD, "sh1add", R,  ALU,    0x20002033, 0xFE00707F, (RS1 << 1) + RS2) \
+	ISA(SH2ADD, "sh2add", R,  ALU,    0x20004033, 0xFE00707F, (RS1 << 2) + RS2) \
+	ISA(SH3ADD, "sh3add", R,  ALU,    0x20006033, 0xFE00707F, (RS1 << 3) + RS2) \
+	ISA(ANDN,   "andn",   R,  ALU,    0x40007033, 0xFE00707F, RS1 & ~RS2) \
+	ISA(ORN,    "orn",    R,  ALU,    0x40006033, 0xFE00707F, RS1 | ~RS2) \
+	ISA(XNOR,   "xnor",   R,  ALU,    0x40004033, 0xFE00707F, ~(RS1 ^ RS2)) \
+	ISA(MIN,    "min",    R,  ALU,    0x0A004033, 0xFE00707F, (int32_t)RS1 < (int32_t)RS2 ? RS1 : RS2) \
+	ISA(MINU,   "minu",   R,  ALU,    0x0A005033, 0xFE00707F, RS1 < RS2 ? RS1 : RS2) \
+	ISA(MAX,    "max",    R,  ALU,    0x0A006033, 0xFE00707F, (int32_t)RS1 > (int32_t)RS2 ? RS1 : RS2) \
+	ISA(MAXU,   "maxu",   R,  ALU,    0x0A007033, 0xFE00707F, RS1 > RS2 ? RS1 : RS2) \
+	ISA(ROL,    "rol",    R,  ALU,    0x60001033, 0xFE00707F, isa_rol(RS1, RS2)) \
+	ISA(ROR,    "ror",    R,  ALU,    0x60005033, 0xFE00707F, isa_rol(RS1, -RS2)) \
+	ISA(RORI,   "rori",   SH, ALU,    0x60005013, 0xFE00707F, isa_rol(RS1, -IMM)) \
+	ISA(CLZ,    "clz",    R1, ALU,    0x60001013, 0xFFF0707F, RS1 ? __builtin_clz(RS1) : 32) \
+	ISA(CTZ,    "ctz",    R1, ALU,    0x60101013, 0xFFF0707F, RS1 ? __builtin_ctz(RS1) : 32) \
+	ISA(CPOP,   "cpop",   R1, ALU,    0x60201013, 0xFFF0707F, __builtin_popcount(RS1)) \
+	ISA(SEXT_B, "sext.b", R1, ALU,    0x60401013, 0xFFF0707F, (int8_t)RS1) \
+	ISA(SEXT_H, "sext.h", R1, ALU,    0x60501013, 0xFFF0707F, (int16_t)RS1) \
+	ISA(ZEXT_H, "zext.h", R1, ALU,    0x08004033, 0xFFF0707F, RS1 & 0xFFFF) \
+	ISA(ORC_B,  "orc.b",  R1, ALU,    0x28705013, 0xFFF0707F, isa_orc_b(RS1)) \
+	ISA(REV8,   "rev8",   R1, ALU,    0x69805013, 0xFFF0707F, __builtin_bswap32(RS1)) \
+	\
+	ISA(JAL,    "jal",    J,  JUMP,   0x0000006F, 0x0000007F, PC + IMM) \
+	ISA(JALR,   "jalr",   L,  JUMP,   0x00000067, 0x0000707F, (RS1 + IMM) & 0xFFFFFFFE) \
+	\
+	ISA(BEQ,    "beq",    B,  BRANCH, 0x00000063, 0x0000707F, RS1 == RS2) \
+	ISA(BNE,    "bne",    B,  BRANCH, 0x00001063, 0x0000707F, RS1 != RS2) \
+	ISA(BLT,    "blt",    B,  BRANCH, 0x00004063, 0x0000707F, (int32_t)RS1 < (int32_t)RS2) \
+	ISA(BGE,    "bge",    B,  BRANCH, 0x00005063, 0x0000707F, (int32_t)RS1 >= (int32_t)RS2) \
+	ISA(BLTU,   "bltu",   B,  BRANCH, 0x00006063, 0x0000707F, RS1 < RS2) \
+	ISA(BGEU,   "bgeu",   B,  BRANCH, 0x00007063, 0x0000707F, RS1 >= RS2) \
+	\
+	ISA(LB,     "lb",     L,  LOAD,   0x00000003, 0x0000707F, LB) \
+	ISA(LH,     "lh",     L,  LOAD,   0x00001003, 0x0000707F, LH) \
+	ISA(LW,     "lw",     L,  LOAD,   0x00002003, 0x0000707F, LW) \
+	ISA(LBU,    "lbu",    L,  LOAD,   0x00004003, 0x0000707F, LBU) \
+	ISA(LHU,    "lhu",    L,  LOAD,   0x00005003, 0x0000707F, LHU) \
+	\
+	ISA(SB,     "sb",     S,  STORE,  0x00000023, 0x0000707F, SB) \
+	ISA(SH,     "sh",     S,  STORE,  0x00001023, 0x0000707F, SH) \
+	ISA(SW,     "sw",     S,  STORE,  0x00002023, 0x0000707F, SW) \
+	\
+	ISA(FLW,       "flw",       FL,   FLOAD,  0x00002007, 0x0000707F, LW) \
+	ISA(FSW,       "fsw",       FS,   FSTORE, 0x00002027, 0x0000707F, SW) \
+	ISA(FMADD_S,   "fmadd.s",   FR4,  FARITH, 0x00000043, 0x0600007F, fpu_fma(core, F1, F2, F3)) \
+	ISA(FMSUB_S,   "fmsub.s",   FR4,  FARITH, 0x00000047, 0x0600007F, fpu_fma(core, F1, F2, -F3)) \
+	ISA(FNMSUB_S,  "fnmsub.s",  FR4,  FARITH, 0x0000004B, 0x0600007F, fpu_fma(core, -F1, F2, F3)) \
+	ISA(FNMADD_S,  "fnmadd.s",  FR4,  FARITH, 0x0000004F, 0x0600007F, fpu_fma(core, -F1, F2, -F3)) \
+	ISA(FADD_S,    "fadd.s",    FR,   FARITH, 0x00000053, 0xFE00007F, F1 + F2) \
+	ISA(FSUB_S,    "fsub.s",    FR,   FARITH, 0x08000053, 0xFE00007F, F1 - F2) \
+	ISA(FMUL_S,    "fmul.s",    FR,   FARITH, 0x10000053, 0xFE00007F, F1 * F2) \
+	ISA(FDIV_S,    "fdiv.s",    FR,   FARITH, 0x18000053, 0xFE00007F, F1 / F2) \
+	ISA(FSQRT_S,   "fsqrt.s",   FR1,  FARITH, 0x58000053, 0xFFF0007F, sqrtf(F1)) \
+	ISA(FCVT_S_W,  "fcvt.s.w",  XF,   FARITH, 0xD0000053, 0xFFF0007F, (float)(int32_t)RS1) \
+	ISA(FCVT_S_WU, "fcvt.s.wu", XF,   FARITH, 0xD0100053, 0xFFF0007F, (float)RS1) \
+	ISA(FSGNJ_S,   "fsgnj.s",   FR,   FBITS,  0x20000053, 0xFE00707F, (FB1 & 0x7FFFFFFF) | (FB2 & 0x80000000)) \
+	ISA(FSGNJN_S,  "fsgnjn.s",  FR,   FBITS,  0x20001053, 0xFE00707F, (FB1 & 0x7FFFFFFF) | (~FB2 & 0x80000000)) \
+	ISA(FSGNJX_S,  "fsgnjx.s",  FR,   FBITS,  0x20002053, 0xFE00707F, FB1 ^ (FB2 & 0x80000000)) \
+	ISA(FMIN_S,    "fmin.s",    FR,   FBITS,  0x28000053, 0xFE00707F, fpu_min(core, FB1, FB2)) \
+	ISA(FMAX_S,    "fmax.s",    FR,   FBITS,  0x28001053, 0xFE00707F, fpu_max(core, FB1, FB2)) \
+	ISA(FMV_W_X,   "fmv.w.x",   XF,   FBITS,  0xF0000053, 0xFFF0707F, RS1) \
+	ISA(FCVT_W_S,  "fcvt.w.s",  FX,   FTOX,   0xC0000053, 0xFFF0007F, fpu_to_int32(core, F1, RM)) \
+	ISA(FCVT_WU_S, "fcvt.wu.s", FX,   FTOX,   0xC0100053, 0xFFF0007F, fpu_to_uint32(core, F1, RM)) \
+	ISA(FMV_X_W,   "fmv.x.w",   FX,   FTOX,   0xE0000053, 0xFFF0707F, FB1) \
+	ISA(FCLASS_S,  "fclass.s",  FX,   FTOX,   0xE0001053, 0xFFF0707F, fpu_class(FB1)) \
+	ISA(FEQ_S,     "feq.s",     FCMP, FTOX,   0xA0002053, 0xFE00707F, fpu_eq(core, FB1, FB2)) \
+	ISA(FLT_S,     "flt.s",     FCMP, FTOX,   0xA0001053, 0xFE00707F, fpu_lt(core, FB1, FB2)) \
+	ISA(FLE_S,     "fle.s",     FCMP, FTOX,   0xA0000053, 0xFE00707F, fpu_le(core, FB1, FB2)) \
+	\
+	ISA(CSRRW,  "csrrw",  CSR,  CSR,  0x00001073, 0x0000707F, RS1) \
+	ISA(CSRRS,  "csrrs",  CSR,  CSR,  0x00002073, 0x0000707F, CSR | RS1) \
+	ISA(CSRRC,  "csrrc",  CSR,  CSR,  0x00003073, 0x0000707F, CSR & ~RS1) \
+	ISA(CSRRWI, "csrrwi", CSRI, CSR,  0x00005073, 0x0000707F, IMM) \
+	ISA(CSRRSI, "csrrsi", CSRI, CSR,  0x00006073, 0x0000707F, CSR | IMM) \
+	ISA(CSRRCI, "csrrci", CSRI, CSR,  0x00007073, 0x0000707F, CSR & ~IMM)
+
+// Instruction ids, in table order
+enum
+{
+#define ISA_ID(id, mnemonic, format, class, match, mask, semantics) ISA_##id,
+	RV32_ISA(ISA_ID)
+#undef ISA_ID
+	ISA_COUNT,
+	ISA_UNKNOWN = ISA_COUNT // no instruction matches
+};
+
+enum
+{
+	ISA_FMT_R,
+	ISA_FMT_R1,
+	ISA_FMT_I,
+	ISA_FMT_SH,
+	ISA_FMT_L,
+	ISA_FMT_S,
+	ISA_FMT_B,
+	ISA_FMT_U,
+	ISA_FMT_J,
+	ISA_FMT_FL,
+	ISA_FMT_FS,
+	ISA_FMT_FR,
+	ISA_FMT_FR1,
+	ISA_FMT_FR4,
+	ISA_FMT_FCMP,
+	ISA_FMT_FX,
+	ISA_FMT_XF,
+	ISA_FMT_CSR,
+	ISA_FMT_CSRI
+};
+
+enum
+{
+	ISA_CLASS_ALU,
+	ISA_CLASS_UPPER,
+	ISA_CLASS_LOAD,
+	ISA_CLASS_STORE,
+	ISA_CLASS_BRANCH,
+	ISA_CLASS_JUMP,
+	ISA_CLASS_FLOAD,
+	ISA_CLASS_FSTORE,
+	ISA_CLASS_FARITH,
+	ISA_CLASS_FBITS,
+	ISA_CLASS_FTOX,
+	ISA_CLASS_CSR
+};
+
+struct isa_inst
+{
+	const char *mnemonic;
+	uint8_t format; // ISA_FMT_*
+	uint8_t cls;	// ISA_CLASS_*
+	uint32_t match;
+	uint32_t mask;
+};
+typedef struct isa_inst isa_inst;
+
+extern const isa_inst isa_table[ISA_COUNT];
+
+void isa_init(void);
+int isa_decode(uint32_t inst);
+int isa_fault(uint32_t inst);
+uint32_t isa_imm(int format, uint32_t inst);
+void isa_disasm(char *buf, int len, uint32_t inst, uint32_t pc);
+
+// Helpers for the semantics of the Zba/Zbb lines, which otherwise map onto
+// host builtins
+static inline uint32_t isa_rol(uint32_t x, uint32_t shamt)
+{
+	return x << (shamt & 0x1F) | x >> (-shamt & 0x1F);
+}
+
+// 0xFF in every byte of x that isn't zero
+static inline uint32_t isa_orc_b(uint32_t x)
+{
+	uint32_t high = (((x & 0x7F7F7F7F) + 0x7F7F7F7F) | x) & 0x80808080;
+	return (high >> 7) * 0xFF;
+}
+
+// Division by zero gives all ones (the remainder the dividend), and the one
+// overflowing division gives the dividend (the remainder 0)
+static inline uint32_t isa_div(uint32_t a, uint32_t b)
+{
+	if (!b)
+		return 0xFFFFFFFF;
+	if (a == 0x80000000 && b == 0xFFFFFFFF)
+		return a;
+	return (int32_t)a / (int32_t)b;
+}
+
+static inline uint32_t isa_rem(uint32_t a, uint32_t b)
+{
+	if (!b)
+		return a;
+	if (a == 0x80000000 && b == 0xFFFFFFFF)
+		return 0;
+	return (int32_t)a % (int32_t)b;
+}
+
+// Class of an instruction id, -1 for ISA_UNKNOWN
+static inline int isa_class(int id)
+{
+	return id < ISA_COUNT ? isa_table[id].cls : -1;
+}
+
+// Integer registers an instruction of the format and class reads and writes
+static inline int isa_reads_rs1(int format)
+{
+	switch (format)
+	{
+	case ISA_FMT_R:
+	case ISA_FMT_R1:
+	case ISA_FMT_I:
+	case ISA_FMT_SH:
+	case ISA_FMT_L:
+	case ISA_FMT_S:
+	case ISA_FMT_B:
+	case ISA_FMT_FL:
+	case ISA_FMT_FS:
+	case ISA_FMT_XF:
+	case ISA_FMT_CSR:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static inline int isa_reads_rs2(int format)
+{
+	return format == ISA_FMT_R || format == ISA_FMT_S || format == ISA_FMT_B;
+}
+
+static inline int isa_writes_rd(int cls)
+{
+	return cls == ISA_CLASS_ALU || cls == ISA_CLASS_UPPER || cls == ISA_CLASS_LOAD || cls == ISA_CLASS_JUMP ||
+		   cls == ISA_CLASS_FTOX || cls == ISA_CLASS_CSR;
+}
+
+// Whether rd of an instruction of the class is a float register
+static inline int isa_writes_frd(int cls)
+{
+	return cls == ISA_CLASS_FLOAD || cls == ISA_CLASS_FARITH || cls == ISA_CLASS_FBITS;
+}
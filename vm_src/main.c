@@ -5,6 +5,7 @@
 * RV32I User-mode ISA
 * 64k of RAM at 0x80000000
 * UART register at 0x10000000
+* Input device at 0x10100000
 * 
 */
 
@@ -13,27 +14,172 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 // Where the goodies live
 #include "rv32i.h"
+#include "decode.h"
+#include "isa.h"
+#include "codecache.h"
+#include "elfsym.h"
+#include "profile.h"
+#include "callstack.h"
+#include "timing.h"
+#include "stats.h"
+#include "cache.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "replay.h"
+#include "gdbstub.h"
+#include "cosim.h"
+#include "simt.h"
+#include "plugin.h"
+
+static void print_usage(const char *name)
+{
+	printf("Usage: %s [options] [filename]\n", name);
+	printf("  -r        use the reference interpreter only\n");
+	printf("  -c <dir>  keep decoded programs in a cache directory\n");
+	printf("  -p <file> write a per-address execution profile to file (- for stdout)\n");
+	printf("  -s <file> write the instructions run under each guest call path to file, in folded format\n");
+	printf("  -e <elf>  symbols for the profiles, by default filename with .elf for .bin\n");
+	printf("  -M <core> estimate cycles on a timing model, a preset with optional key=value changes\n");
+	printf("  -t <sec>  write a stats snapshot every sec seconds, as well as on SIGUSR1\n");
+	printf("  -T <dest> append snapshots to file dest, or send them to unix:<socket path>\n");
+	printf("  -x <file> record an execution trace to file\n");
+	printf("  -X <file> record an execution trace with every memory access to file\n");
+	printf("  -d <file> print the execution trace in file and exit\n");
+	printf("  -l <file> log the values devices return to file\n");
+	printf("  -L <file> replay a device log instead of reading the devices\n");
+	printf("  -g <dest> let GDB attach on TCP port dest of localhost, or unix:<socket path>\n");
+	printf("  -G <dest> the same, waiting for GDB before running anything\n");
+	printf("  -C        check the fast engine against the reference interpreter as it runs\n");
+	printf("  -i <file> let the guest read file through the input device\n");
+	printf("  -b <list> run a lane per input file listed in list, in lockstep warps\n");
+	printf("  -P <file> load an instrumentation plugin, arguments may follow separated by commas\n");
+#ifdef RV32_STATS
+	printf("  -m <file> write the instruction mix to file instead of stdout, as JSON for .json\n");
+	printf("  -I <spec> simulate an instruction cache, spec is size,ways,line[,lru|fifo|random]\n");
+	printf("  -D <spec> simulate a data cache, with the same spec\n");
+	printf("  -R <start-end> report cache misses of the pc range, in hex\n");
+#endif
+}
 
 int main(int argc, char* argv[])
 {
 	rv32core cpu;	  // instantiate CPU
+	isa_init();		  // sort the decoder's table
 	ram_clear(&cpu);  // clear RAM
 	core_reset(&cpu); // reset CPU
-	
-	if (argc < 2)
+
+	char *filename = NULL;
+	char *cache_dir = NULL;
+	char *profile_file = NULL;
+	char *stacks_file = NULL;
+	char *timing_spec = NULL;
+#ifdef RV32_STATS
+	char *stats_file = NULL;
+	char *icache_spec = NULL;
+	char *dcache_spec = NULL;
+	char *ranges[CACHE_RANGES];
+	int range_count = 0;
+#endif
+	char *elf_file = NULL;
+	char *snapshot_dest = NULL;
+	char *trace_file = NULL;
+	int trace_memory = 0;
+	char *replay_file = NULL;
+	int replay_mode = REPLAY_RECORD;
+	char *gdb_dest = NULL;
+	int gdb_wait = 0;
+	double snapshot_interval = 0;
+	int reference = 0;
+	int cosim = 0;
+	char *input_file = NULL;
+	char *batch_list = NULL;
+	char *plugin_specs[PLUGIN_MAX];
+	int plugin_count = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-r"))
+			reference = 1;
+		else if (!strcmp(argv[i], "-C"))
+			cosim = 1;
+		else if (!strcmp(argv[i], "-i") && i + 1 < argc)
+			input_file = argv[++i];
+		else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+			batch_list = argv[++i];
+		else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+			cache_dir = argv[++i];
+		else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+			profile_file = argv[++i];
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+			stacks_file = argv[++i];
+		else if (!strcmp(argv[i], "-e") && i + 1 < argc)
+			elf_file = argv[++i];
+		else if (!strcmp(argv[i], "-M") && i + 1 < argc)
+			timing_spec = argv[++i];
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+			snapshot_interval = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-T") && i + 1 < argc)
+			snapshot_dest = argv[++i];
+		else if ((!strcmp(argv[i], "-x") || !strcmp(argv[i], "-X")) && i + 1 < argc)
+		{
+			trace_memory = argv[i][1] == 'X';
+			trace_file = argv[++i];
+		}
+		else if ((!strcmp(argv[i], "-l") || !strcmp(argv[i], "-L")) && i + 1 < argc)
+		{
+			replay_mode = argv[i][1] == 'L' ? REPLAY_PLAY : REPLAY_RECORD;
+			replay_file = argv[++i];
+		}
+		else if ((!strcmp(argv[i], "-g") || !strcmp(argv[i], "-G")) && i + 1 < argc)
+		{
+			gdb_wait = argv[i][1] == 'G';
+			gdb_dest = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-P") && i + 1 < argc && plugin_count < PLUGIN_MAX)
+			plugin_specs[plugin_count++] = argv[++i];
+		else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+		{
+			if (trace_dump(argv[++i], stdout))
+			{
+				printf("Can't read the trace in %s\n", argv[i]);
+				exit(-2);
+			}
+			return 0;
+		}
+#ifdef RV32_STATS
+		else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+			stats_file = argv[++i];
+		else if (!strcmp(argv[i], "-I") && i + 1 < argc)
+			icache_spec = argv[++i];
+		else if (!strcmp(argv[i], "-D") && i + 1 < argc)
+			dcache_spec = argv[++i];
+		else if (!strcmp(argv[i], "-R") && i + 1 < argc && range_count < CACHE_RANGES)
+			ranges[range_count++] = argv[++i];
+#endif
+		else if (argv[i][0] == '-')
+		{
+			print_usage(argv[0]);
+			exit(-1);
+		}
+		else
+			filename = argv[i];
+	}
+
+	if (filename == NULL)
 	{
-		printf("Usage: %s [filename]\n", argv[0]);
+		print_usage(argv[0]);
 		exit(-1);
 	}
 
 	FILE* binfile;
-	binfile = fopen(argv[1], "rb");
+	binfile = fopen(filename, "rb");
 	if (binfile == NULL)
 	{
-		printf("Error loading file. %s\n", argv[1]);
+		printf("Error loading file. %s\n", filename);
 		exit(-2);
 	}
 
@@ -43,61 +189,337 @@ int main(int argc, char* argv[])
 
 	if (filesize > ROM_SIZE)
 	{
-		printf("File %s exceeds ROM size by %d bytes\n", argv[1], filesize - ROM_SIZE);
+		printf("File %s exceeds ROM size by %lu bytes\n", filename, (unsigned long)(filesize - ROM_SIZE));
 		fclose(binfile);
 		exit(-2);
 	}
 
+	memset(cpu.rom, 0, ROM_SIZE); // past the end of the image
 	fread(cpu.rom, 1, filesize, binfile);
 	fclose(binfile);
 
-	int fault = 0;
-	while (!fault)
+	if (input_file && input_load(&cpu, input_file))
+	{
+		printf("Can't read input %s\n", input_file);
+		exit(-2);
+	}
+
+	if (batch_list && (reference || cosim || input_file || profile_file || stacks_file || timing_spec || trace_file ||
+					   replay_file || gdb_dest || snapshot_interval > 0 || snapshot_dest || plugin_count))
+	{
+		printf("-b runs lanes on the batch engine, without -r, -C, -i, -p, -s, -M, -t, -T, -x, -l, -g or -P\n");
+		exit(-1);
+	}
+
+#ifdef RV32_STATS
+	rv32cache *cache = NULL;
+	if (icache_spec || dcache_spec)
+	{
+		if (batch_list)
+		{
+			printf("-b runs lanes on the batch engine, without cache simulation\n");
+			exit(-1);
+		}
+		cache = malloc(sizeof(rv32cache));
+		if (cache == NULL || cache_start(cache, icache_spec, dcache_spec))
+		{
+			printf("Invalid cache, it takes size,ways,line[,policy] with as many sets as a power of 2\n");
+			exit(-1);
+		}
+		for (int i = 0; i < range_count; i++)
+		{
+			if (cache_range_add(cache, ranges[i]))
+			{
+				printf("Invalid pc range %s\n", ranges[i]);
+				exit(-1);
+			}
+		}
+		cpu.cache = cache;
+	}
+#endif
+
+	rv32telemetry telemetry;
+	if (telemetry_start(&telemetry, &cpu, snapshot_interval, snapshot_dest))
+	{
+		printf("Can't open %s for snapshots\n", snapshot_dest);
+		exit(-2);
+	}
+
+	if (!reference)
+	{
+		rv32code *code = NULL;
+		cpu.tier = TIER_DECODE;
+		if (cache_dir)
+			code = code_cache_open(cache_dir, &cpu);
+
+		if (code == NULL)
+		{
+			code = malloc(sizeof(rv32code));
+			if (code == NULL)
+			{
+				printf("Out of memory\n");
+				exit(-2);
+			}
+			code_load(code, &cpu); // predecode the whole ROM
+			if (cache_dir)
+				code_cache_save(cache_dir, code, &cpu);
+		}
+
+		cpu.code = code;
+	}
+
+	if (batch_list)
+	{
+		rv32batch *batch = malloc(sizeof(rv32batch));
+		if (batch == NULL || simt_start(batch, &cpu, cpu.code, batch_list))
+		{
+			printf("Can't run the inputs listed in %s\n", batch_list);
+			exit(-2);
+		}
+		int status = simt_run(batch, stdout);
+		simt_report(batch, stdout);
+		simt_stop(batch);
+		free(batch);
+		telemetry_stop(&telemetry);
+		return status ? -2 : 0;
+	}
+
+	rv32plugins *plugins = NULL;
+	if (plugin_count)
+	{
+		plugins = calloc(1, sizeof(rv32plugins));
+		if (plugins == NULL)
+		{
+			printf("Out of memory\n");
+			exit(-2);
+		}
+		for (int i = 0; i < plugin_count; i++)
+		{
+			if (plugin_load(plugins, plugin_specs[i]))
+			{
+				printf("Can't load plugin %s, or it refused its arguments\n", plugin_specs[i]);
+				exit(-2);
+			}
+		}
+		plugin_start(plugins, &cpu);
+	}
+
+	// Symbols come from the ELF the image was made from, when there is one
+	elf_symbols *syms = NULL;
+	int want_syms = profile_file || stacks_file || timing_spec;
+#ifdef RV32_STATS
+	want_syms |= cache != NULL;
+#endif
+	if (want_syms)
+	{
+		char guess[1024];
+		size_t len = strlen(filename);
+		if (elf_file == NULL && len > 4 && len < sizeof(guess) && !strcmp(filename + len - 4, ".bin"))
+		{
+			strcpy(guess, filename);
+			strcpy(guess + len - 4, ".elf");
+			elf_file = guess;
+		}
+		syms = elf_file ? elfsym_load(elf_file) : NULL;
+	}
+
+	rv32profile *prof = NULL;
+	if (profile_file)
+	{
+		prof = malloc(sizeof(rv32profile));
+		if (prof == NULL)
+		{
+			printf("Out of memory\n");
+			exit(-2);
+		}
+		profile_clear(prof);
+		cpu.prof = prof;
+	}
+
+	rv32timing *timing = NULL;
+	if (timing_spec)
+	{
+		timing = malloc(sizeof(rv32timing));
+		if (timing == NULL)
+		{
+			printf("Out of memory\n");
+			exit(-2);
+		}
+		if (timing_start(timing, timing_spec))
+		{
+			printf("Invalid timing model %s, the presets are ", timing_spec);
+			timing_list(stdout);
+			exit(-1);
+		}
+		cpu.timing = timing;
+	}
+
+	call_stacks *stacks = NULL;
+	if (stacks_file)
+	{
+		stacks = malloc(sizeof(call_stacks));
+		if (stacks == NULL || stacks_init(stacks, cpu.pc, syms))
+		{
+			printf("Out of memory\n");
+			exit(-2);
+		}
+		cpu.stacks = stacks;
+	}
+
+#ifdef RV32_STATS
+	rv32stats *stats = malloc(sizeof(rv32stats));
+	if (stats == NULL)
+	{
+		printf("Out of memory\n");
+		exit(-2);
+	}
+	stats_clear(stats);
+	cpu.stats = stats;
+#endif
+
+	rv32trace trace;
+	if (trace_file && trace_start(&trace, &cpu, trace_file, trace_memory))
 	{
-		fault = rv32_execute(&cpu); // execute one instruction
+		printf("Can't write a trace to %s\n", trace_file);
+		exit(-2);
+	}
 
-		/*
-		if (!fault) {
-			core_print(&cpu);   // show CPU contents
-			printf("****************\n");
+	rv32replay replay;
+	if (replay_file && replay_start(&replay, &cpu, replay_file, replay_mode))
+	{
+		printf("Can't %s device log %s\n", replay_mode == REPLAY_PLAY ? "replay the" : "write a", replay_file);
+		exit(-2);
+	}
+
+	rv32cosim *check = NULL;
+	if (cosim)
+	{
+		if (reference)
+		{
+			printf("-C checks the fast engine, it can't run with -r\n");
+			exit(-1);
 		}
-		*/
+		check = malloc(sizeof(rv32cosim));
+		if (check == NULL)
+		{
+			printf("Out of memory\n");
+			exit(-2);
+		}
+		cosim_start(check, &cpu);
 	}
+
+	gdb_stub gdb;
+	if (gdb_dest && gdb_start(&gdb, &cpu, gdb_dest, gdb_wait))
+	{
+		printf("Can't listen for GDB on %s\n", gdb_dest);
+		exit(-2);
+	}
+
+	// run until something stops the CPU
+	int fault = gdb_dest ? gdb_run(&gdb, &cpu) : rv32_run(&cpu);
+	if (gdb_dest)
+		gdb_stop(&gdb, &cpu);
 	
 	printf("\n");
-	switch (fault)
+	printf("%s\n", fault_name(fault));
+
+	printf("Executed %llu instructions\n", (unsigned long long)(cpu.inst_count - 1));
+	telemetry_report(&telemetry, stdout);
+	telemetry_stop(&telemetry);
+
+	if (plugins)
 	{
+		plugin_stop(plugins, &cpu, fault);
+		free(plugins);
+	}
 
-	case UNDEF_OPCODE:
-		printf("Undefined opcode\n");
-		break;
+	if (trace_file)
+	{
+		if (trace_stop(&trace, &cpu, fault))
+			printf("Error writing the trace to %s\n", trace_file);
+		trace_report(&trace, stdout);
+	}
 
-	case UNDEF_FUNC3:
-		printf("Undefined func3\n");
-		break;
+	if (replay_file)
+	{
+		if (replay_stop(&replay, &cpu))
+			printf("Error writing the device log to %s\n", replay_file);
+		replay_report(&replay, stdout);
+	}
 
-	case PC_UNALIGN:
-		printf("Unaligned PC\n");
-		break;
+	if (check)
+	{
+		cosim_report(check, &cpu, stdout);
+		cosim_stop(check, &cpu);
+		free(check);
+	}
 
-	case PC_OUT_OF_RANGE:
-		printf("PC out of range!\n");
-		break;
+	if (prof)
+	{
+		FILE *out = strcmp(profile_file, "-") ? fopen(profile_file, "w") : stdout;
+		if (out == NULL)
+			printf("Can't write profile to %s\n", profile_file);
+		else
+		{
+			profile_report(prof, out, syms);
+			if (stacks)
+				stacks_report(stacks, out);
+			if (out != stdout)
+				fclose(out);
+		}
+		free(prof);
+	}
+
+	if (stacks)
+	{
+		FILE *out = strcmp(stacks_file, "-") ? fopen(stacks_file, "w") : stdout;
+		if (out == NULL)
+			printf("Can't write call stacks to %s\n", stacks_file);
+		else
+		{
+			stacks_write_folded(stacks, out);
+			if (out != stdout)
+				fclose(out);
+		}
+		stacks_free(stacks);
+		free(stacks);
+	}
 
-	case WRITE_ROM:
-		printf("Tried to write in ROM!\n");
-		break;
+	if (timing)
+	{
+		printf("\n");
+		timing_report(timing, &cpu, stdout, syms);
+		free(timing);
+	}
 
-	case SYSCON_SHUTDOWN:
-		printf("Poweroff by SYSCON\n");
-		break;
+#ifdef RV32_STATS
+	{
+		size_t len = stats_file ? strlen(stats_file) : 0;
+		int json = len > 5 && !strcmp(stats_file + len - 5, ".json");
+		FILE *out = stats_file ? fopen(stats_file, "w") : stdout;
+		if (out == NULL)
+			printf("Can't write statistics to %s\n", stats_file);
+		else
+		{
+			stats_report(stats, &cpu, out, json);
+			if (out != stdout)
+				fclose(out);
+		}
+		free(stats);
+	}
+#endif
 
-	default:
-		printf("Unknown fault\n");
-		break;
+#ifdef RV32_STATS
+	if (cache)
+	{
+		printf("\n");
+		cache_report(cache, stdout, syms);
+		cache_stop(cache);
+		free(cache);
 	}
+#endif
 
-	printf("Executed %d instructions\n", cpu.inst_count - 1);
+	elfsym_free(syms);
 		
 
 	return 0;
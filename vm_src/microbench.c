@@ -0,0 +1,644 @@
+/*
+* Host microbenchmarks for the emulator's primitives
+* Times instruction field decoding, memory accesses, the reference handlers
+* of each kind of instruction on words decoded beforehand and the two dispatch
+* loops on synthetic instruction streams, so a change in whole-program MIPS
+* can be traced to the path responsible for it.
+*/
+
+#define _CRT_SECURE_NO_WARNINGS // allow building on MSVC
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "rv32i.h"
+#include "instructions.h"
+#include "opcodes.h"
+#include "decode.h"
+#include "isa.h"
+#include "engine.h"
+
+// Synthetic streams are this long, and wrap around
+#define STREAM_LEN 1024
+#define STREAM_MASK (STREAM_LEN - 1)
+
+// Registers the streams rely on; results only go to x11..x31
+#define REG_RAM 8	   // middle of RAM
+#define REG_ROM 9	   // middle of ROM
+#define REG_MMIO 10	   // an MMIO address no device answers to
+#define MMIO_ADDR 0x10000100
+
+#define MAX_REPS 1000
+#define MAX_OPS (1ull << 36) // a repetition this long that is still too short measures nothing
+
+static rv32core core;
+static rv32code code;
+static uint32_t stream[STREAM_LEN];
+static int ids[STREAM_LEN]; // of the stream's instructions, so the execute cases time only their handlers
+static uint32_t addrs[STREAM_LEN];
+static uint32_t rng = 1;
+static int faults; // handlers that faulted, a bad stream if nonzero
+
+// Results end up here, so no case can be optimized away
+static volatile uint32_t sink;
+// Read anew on every MMIO access, which no device answers so the access has no
+// effect the compiler could see and would otherwise drop
+static volatile uint32_t mmio_addr = MMIO_ADDR;
+
+static double now(void)
+{
+	struct timespec ts;
+#ifdef _WIN32
+	timespec_get(&ts, TIME_UTC);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t next_random(void)
+{
+	rng = rng * 1103515245 + 12345;
+	return (rng >> 16) | (rng << 16);
+}
+
+// Random number in [lo, hi]
+static uint32_t pick(uint32_t lo, uint32_t hi)
+{
+	return lo + next_random() % (hi - lo + 1);
+}
+
+// Instruction encoders
+
+static uint32_t enc_r(uint8_t opcode, int rd, int func3, int rs1, int rs2, int func7)
+{
+	return opcode | rd << 7 | func3 << 12 | rs1 << 15 | rs2 << 20 | (uint32_t)func7 << 25;
+}
+
+static uint32_t enc_i(uint8_t opcode, int rd, int func3, int rs1, int32_t imm)
+{
+	return opcode | rd << 7 | func3 << 12 | rs1 << 15 | (uint32_t)imm << 20;
+}
+
+static uint32_t enc_s(int func3, int rs1, int rs2, int32_t imm)
+{
+	return OP_STORE | (imm & 0x1F) << 7 | func3 << 12 | rs1 << 15 | rs2 << 20 | ((uint32_t)imm >> 5) << 25;
+}
+
+static uint32_t enc_b(int func3, int rs1, int rs2, int32_t imm)
+{
+	uint32_t u = imm;
+	return OP_BRANCH | ((u >> 11) & 1) << 7 | ((u >> 1) & 0xF) << 8 | func3 << 12 | rs1 << 15 | rs2 << 20 |
+		   ((u >> 5) & 0x3F) << 25 | ((u >> 12) & 1) << 31;
+}
+
+static uint32_t enc_j(int rd, int32_t imm)
+{
+	uint32_t u = imm;
+	return OP_JAL | rd << 7 | ((u >> 12) & 0xFF) << 12 | ((u >> 11) & 1) << 20 | ((u >> 1) & 0x3FF) << 21 |
+		   ((u >> 20) & 1) << 31;
+}
+
+static uint32_t random_imm(void)
+{
+	int func3 = pick(0, 7);
+	int32_t imm = (int32_t)pick(0, 4095) - 2048;
+	if (func3 == SLLI)
+		imm = pick(0, 31);
+	else if (func3 == SRLI_SRAI)
+		imm = pick(0, 31) | (next_random() & 1) << 10;
+	return enc_i(OP_IMM, pick(11, 31), func3, pick(1, 31), imm);
+}
+
+static uint32_t random_op(void)
+{
+	int func3 = pick(0, 7);
+	int func7 = 0;
+	if (pick(0, 7) == 0 && func3 < 4)
+		func7 = 1; // mul, mulh, mulhsu, mulhu
+	else if ((func3 == ADD_SUB || func3 == SRL_SRA) && (next_random() & 1))
+		func7 = 0x20;
+	return enc_r(OP_OP, pick(11, 31), func3, pick(1, 31), pick(1, 31), func7);
+}
+
+// Registers hold random values, apart from the base registers
+static void reset_core(void)
+{
+	ram_clear(&core);
+	core_reset(&core);
+	for (int i = 1; i < 32; i++)
+		core.x[i] = next_random();
+	core.x[REG_RAM] = RAM_BASE + RAM_SIZE / 2;
+	core.x[REG_ROM] = ROM_BASE + ROM_SIZE / 2;
+	core.x[REG_MMIO] = MMIO_ADDR;
+}
+
+// Stream setups
+
+static void setup_words(void)
+{
+	for (int i = 0; i < STREAM_LEN; i++)
+		stream[i] = next_random();
+}
+
+static void setup_ram_addrs(void)
+{
+	for (int i = 0; i < STREAM_LEN; i++)
+		addrs[i] = RAM_BASE + 4 * pick(0, RAM_SIZE / 4 - 1);
+}
+
+static void setup_rom_addrs(void)
+{
+	for (int i = 0; i < STREAM_LEN; i++)
+		addrs[i] = ROM_BASE + 4 * pick(0, ROM_SIZE / 4 - 1);
+}
+
+static void setup_imm(void)
+{
+	for (int i = 0; i < STREAM_LEN; i++)
+		stream[i] = random_imm();
+}
+
+static void setup_op(void)
+{
+	for (int i = 0; i < STREAM_LEN; i++)
+		stream[i] = random_op();
+}
+
+static void setup_upper(uint32_t opcode)
+{
+	for (int i = 0; i < STREAM_LEN; i++)
+		stream[i] = (next_random() & 0xFFFFF000) | pick(11, 31) << 7 | opcode;
+}
+
+static void setup_lui(void)
+{
+	setup_upper(OP_LUI);
+}
+
+static void setup_auipc(void)
+{
+	setup_upper(OP_AUIPC);
+}
+
+static void setup_jal(void)
+{
+	for (int i = 0; i < STREAM_LEN; i++)
+		stream[i] = enc_j(pick(0, 1) ? 1 : pick(11, 31), ((int32_t)pick(0, 0x1FFFF) - 0x10000) * 2);
+}
+
+static void setup_jalr(void)
+{
+	for (int i = 0; i < STREAM_LEN; i++)
+		stream[i] = enc_i(OP_JALR, pick(0, 1) ? 0 : pick(11, 31), 0, pick(1, 7), (int32_t)pick(0, 4095) - 2048);
+}
+
+static void setup_branch(void)
+{
+	static const int conditions[] = {BEQ, BNE, BLT, BGE, BLTU, BGEU};
+	for (int i = 0; i < STREAM_LEN; i++)
+		stream[i] = enc_b(conditions[pick(0, 5)], pick(1, 7), pick(1, 7), ((int32_t)pick(0, 4095) - 2048) * 2);
+}
+
+// Loads and stores of every width, at most RAM_SIZE / 2 away from the base
+static void setup_memory(int store, int base)
+{
+	static const int loads[] = {LB, LH, LW, LBU, LHU};
+	static const int stores[] = {SB, SH, SW};
+	for (int i = 0; i < STREAM_LEN; i++)
+	{
+		int func3 = store ? stores[pick(0, 2)] : loads[pick(0, 4)];
+		int32_t imm = (int32_t)pick(0, RAM_SIZE / 2 - 1) - RAM_SIZE / 2;
+		imm &= ~((1 << (func3 & 3)) - 1);
+		if (base == REG_MMIO)
+			imm = 0;
+		stream[i] = store ? enc_s(func3, base, pick(1, 31), imm) : enc_i(OP_LOAD, pick(11, 31), func3, base, imm);
+	}
+}
+
+static void setup_load_ram(void)
+{
+	setup_memory(0, REG_RAM);
+}
+
+static void setup_load_rom(void)
+{
+	setup_memory(0, REG_ROM);
+}
+
+static void setup_load_mmio(void)
+{
+	setup_memory(0, REG_MMIO);
+}
+
+static void setup_store_ram(void)
+{
+	setup_memory(1, REG_RAM);
+}
+
+static void setup_store_mmio(void)
+{
+	setup_memory(1, REG_MMIO);
+}
+
+// A ROM program of straight-line ALU code in a loop, for the dispatch loops
+static void setup_program(void)
+{
+	for (int i = 0; i < STREAM_LEN - 1; i++)
+	{
+		uint32_t inst = pick(0, 1) ? random_imm() : random_op();
+		memcpy(&core.rom[4 * i], &inst, 4);
+	}
+	uint32_t loop = enc_j(0, -4 * (STREAM_LEN - 1));
+	memcpy(&core.rom[4 * (STREAM_LEN - 1)], &loop, 4);
+	code_load(&code, &core);
+}
+
+// Cases
+// Each runs its path n times over the stream and returns something that
+// depends on the results.
+
+static uint32_t run_loop(uint64_t n)
+{
+	uint32_t s = 0;
+	for (uint64_t i = 0; i < n; i++)
+		s += stream[i & STREAM_MASK];
+	return s;
+}
+
+#define DECODE_CASE(fn)                              \
+	static uint32_t run_##fn(uint64_t n)             \
+	{                                                \
+		uint32_t s = 0;                              \
+		for (uint64_t i = 0; i < n; i++)             \
+			s += fn(stream[i & STREAM_MASK]);        \
+		return s;                                    \
+	}
+
+DECODE_CASE(get_opcode)
+DECODE_CASE(get_rd)
+DECODE_CASE(get_rs1)
+DECODE_CASE(get_rs2)
+DECODE_CASE(get_func3)
+DECODE_CASE(get_func7)
+DECODE_CASE(imm_type_i)
+DECODE_CASE(imm_type_b)
+DECODE_CASE(imm_type_j)
+
+static uint32_t run_signextend_12(uint64_t n)
+{
+	uint32_t s = 0;
+	for (uint64_t i = 0; i < n; i++)
+		s += signextend_12(stream[i & STREAM_MASK] >> 20);
+	return s;
+}
+
+static uint32_t run_decode_inst(uint64_t n)
+{
+	rv32op op;
+	uint32_t s = 0;
+	for (uint64_t i = 0; i < n; i++)
+	{
+		decode_inst(&op, stream[i & STREAM_MASK], ROM_BASE);
+		s += op.kind + op.imm;
+	}
+	return s;
+}
+
+static uint32_t run_mem_read_32(uint64_t n)
+{
+	uint32_t s = 0;
+	for (uint64_t i = 0; i < n; i++)
+		s += mem_read_32(&core, addrs[i & STREAM_MASK]);
+	return s;
+}
+
+static uint32_t run_mem_store_32(uint64_t n)
+{
+	for (uint64_t i = 0; i < n; i++)
+		mem_store_32(&core, addrs[i & STREAM_MASK], (uint32_t)i);
+	return core.ram[0] + core.rom[0];
+}
+
+static uint32_t run_mmio_load(uint64_t n)
+{
+	uint32_t s = 0;
+	for (uint64_t i = 0; i < n; i++)
+		s += mmio_load(&core, mmio_addr, i);
+	return s;
+}
+
+static uint32_t run_mmio_store(uint64_t n)
+{
+	int s = 0;
+	for (uint64_t i = 0; i < n; i++)
+		s |= mmio_store(&core, mmio_addr, (uint32_t)i);
+	return s;
+}
+
+#define EXEC_CASE(name)                                                              \
+	static uint32_t run_##name(uint64_t n)                                           \
+	{                                                                                \
+		int f = 0;                                                                   \
+		for (uint64_t i = 0; i < n; i++)                                             \
+			f |= exec_handler(&core, ids[i & STREAM_MASK], stream[i & STREAM_MASK]); \
+		faults |= f;                                                                 \
+		return core.x[11] + core.pc;                                                 \
+	}
+
+EXEC_CASE(exec_op_imm)
+EXEC_CASE(exec_op_op)
+EXEC_CASE(exec_op_lui)
+EXEC_CASE(exec_op_auipc)
+EXEC_CASE(exec_op_jal)
+EXEC_CASE(exec_op_jalr)
+EXEC_CASE(exec_op_branch)
+EXEC_CASE(exec_op_load_ram)
+EXEC_CASE(exec_op_load_rom)
+EXEC_CASE(exec_op_load_mmio)
+EXEC_CASE(exec_op_store_ram)
+EXEC_CASE(exec_op_store_mmio)
+
+static uint32_t run_rv32_execute(uint64_t n)
+{
+	int f = 0;
+	for (uint64_t i = 0; i < n; i++)
+		f |= rv32_execute(&core);
+	faults |= f;
+	return core.x[11];
+}
+
+static uint32_t run_engine_block(uint64_t n)
+{
+	int f = 0;
+	uint64_t end = core.inst_count + n;
+	while (core.inst_count < end)
+		f |= engine_block(&core, end - core.inst_count);
+	faults |= f;
+	return core.x[11];
+}
+
+struct bench_case
+{
+	const char *name;
+	const char *group;
+	void (*setup)(void); // fills the stream, after the core has been reset
+	uint32_t (*run)(uint64_t n);
+	int engine;			 // runs on the predecoded program
+};
+typedef struct bench_case bench_case;
+
+static const bench_case cases[] = {
+	{"loop", "baseline", setup_words, run_loop, 0},
+
+	{"get_opcode", "decode", setup_words, run_get_opcode, 0},
+	{"get_rd", "decode", setup_words, run_get_rd, 0},
+	{"get_rs1", "decode", setup_words, run_get_rs1, 0},
+	{"get_rs2", "decode", setup_words, run_get_rs2, 0},
+	{"get_func3", "decode", setup_words, run_get_func3, 0},
+	{"get_func7", "decode", setup_words, run_get_func7, 0},
+	{"imm_type_i", "decode", setup_words, run_imm_type_i, 0},
+	{"imm_type_b", "decode", setup_words, run_imm_type_b, 0},
+	{"imm_type_j", "decode", setup_words, run_imm_type_j, 0},
+	{"signextend_12", "decode", setup_words, run_signextend_12, 0},
+	{"decode_inst", "decode", setup_imm, run_decode_inst, 0},
+
+	{"mem_read_32_ram", "memory", setup_ram_addrs, run_mem_read_32, 0},
+	{"mem_read_32_rom", "memory", setup_rom_addrs, run_mem_read_32, 0},
+	{"mem_store_32_ram", "memory", setup_ram_addrs, run_mem_store_32, 0},
+	{"mem_store_32_rom", "memory", setup_rom_addrs, run_mem_store_32, 0},
+	{"mmio_load", "memory", setup_words, run_mmio_load, 0},
+	{"mmio_store", "memory", setup_words, run_mmio_store, 0},
+
+	{"exec_op_imm", "execute", setup_imm, run_exec_op_imm, 0},
+	{"exec_op_op", "execute", setup_op, run_exec_op_op, 0},
+	{"exec_op_lui", "execute", setup_lui, run_exec_op_lui, 0},
+	{"exec_op_auipc", "execute", setup_auipc, run_exec_op_auipc, 0},
+	{"exec_op_jal", "execute", setup_jal, run_exec_op_jal, 0},
+	{"exec_op_jalr", "execute", setup_jalr, run_exec_op_jalr, 0},
+	{"exec_op_branch", "execute", setup_branch, run_exec_op_branch, 0},
+	{"exec_op_load_ram", "execute", setup_load_ram, run_exec_op_load_ram, 0},
+	{"exec_op_load_rom", "execute", setup_load_rom, run_exec_op_load_rom, 0},
+	{"exec_op_load_mmio", "execute", setup_load_mmio, run_exec_op_load_mmio, 0},
+	{"exec_op_store_ram", "execute", setup_store_ram, run_exec_op_store_ram, 0},
+	{"exec_op_store_mmio", "execute", setup_store_mmio, run_exec_op_store_mmio, 0},
+
+	{"rv32_execute", "dispatch", setup_program, run_rv32_execute, 0},
+	{"engine_block", "dispatch", setup_program, run_engine_block, 1},
+};
+
+#define CASE_COUNT (int)(sizeof(cases) / sizeof(cases[0]))
+
+struct bench_result
+{
+	double median, min, mean, stddev; // ns per op
+	uint64_t ops;					  // per repetition, 0 if the case can't be timed
+};
+typedef struct bench_result bench_result;
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Runs the case reps times, each repetition long enough to take min_time
+static bench_result measure(const bench_case *c, int reps, double min_time)
+{
+	static double samples[MAX_REPS];
+	bench_result r;
+
+	reset_core();
+	c->setup();
+	for (int i = 0; i < STREAM_LEN; i++)
+		ids[i] = isa_decode(stream[i]);
+	core.code = c->engine ? &code : 0;
+
+	// Find how many ops take min_time, warming up the caches on the way
+	// A loop the compiler emptied never gets there, and is reported instead.
+	uint64_t n = 1024;
+	for (;;)
+	{
+		double start = now();
+		sink = c->run(n);
+		double elapsed = now() - start;
+		if (elapsed >= min_time)
+			break;
+		if (n >= MAX_OPS)
+		{
+			memset(&r, 0, sizeof(r));
+			return r;
+		}
+		double next = elapsed > min_time / 16 ? n * min_time * 1.2 / elapsed : n * 16.0;
+		n = next < MAX_OPS ? (uint64_t)next : MAX_OPS;
+	}
+
+	for (int i = 0; i < reps; i++)
+	{
+		double start = now();
+		sink = c->run(n);
+		samples[i] = (now() - start) * 1e9 / n;
+	}
+
+	qsort(samples, reps, sizeof(double), compare_double);
+	r.ops = n;
+	r.min = samples[0];
+	r.median = reps % 2 ? samples[reps / 2] : (samples[reps / 2 - 1] + samples[reps / 2]) / 2;
+	r.mean = 0;
+	for (int i = 0; i < reps; i++)
+		r.mean += samples[i];
+	r.mean /= reps;
+	r.stddev = 0;
+	for (int i = 0; i < reps; i++)
+		r.stddev += (samples[i] - r.mean) * (samples[i] - r.mean);
+	r.stddev = reps > 1 ? sqrt(r.stddev / (reps - 1)) : 0;
+	return r;
+}
+
+// Medians of an earlier run, from its JSON output
+static int load_baseline(const char *file, char names[][32], double *medians)
+{
+	FILE *f = fopen(file, "r");
+	if (!f)
+		return -1;
+
+	char line[512];
+	int count = 0;
+	while (count < CASE_COUNT && fgets(line, sizeof(line), f))
+	{
+		char *name = strstr(line, "\"name\": \"");
+		char *median = strstr(line, "\"ns_per_op\": ");
+		if (name && median && sscanf(name + 9, "%31[^\"]", names[count]) == 1 &&
+			sscanf(median + 13, "%lf", &medians[count]) == 1)
+			count++;
+	}
+	fclose(f);
+	return count;
+}
+
+static int selected(const char *name, int argc, char *argv[], int first)
+{
+	if (first == argc)
+		return 1;
+	for (int i = first; i < argc; i++)
+	{
+		if (strstr(name, argv[i]))
+			return 1;
+	}
+	return 0;
+}
+
+static void print_usage(const char *name)
+{
+	printf("Usage: %s [options] [case...]\n", name);
+	printf("  -n <reps>  repetitions of each case, 15 by default\n");
+	printf("  -t <ms>    minimum time of a repetition, 20 by default\n");
+	printf("  -j <file>  write the results to file as JSON\n");
+	printf("  -b <file>  compare with the JSON results of an earlier run\n");
+	printf("Only cases whose names contain one of the case arguments are run.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int reps = 15;
+	double min_time = 0.02;
+	char *json_file = NULL;
+	char *baseline_file = NULL;
+	static char base_names[CASE_COUNT][32];
+	static double base_medians[CASE_COUNT];
+	int base_count = 0;
+
+	isa_init();
+
+	int first = 1;
+	for (; first < argc && argv[first][0] == '-'; first++)
+	{
+		char opt = argv[first][1];
+		if (first + 1 < argc && (opt == 'n' || opt == 't' || opt == 'j' || opt == 'b'))
+		{
+			char *value = argv[++first];
+			if (opt == 'n')
+				reps = atoi(value);
+			else if (opt == 't')
+				min_time = atof(value) / 1000;
+			else if (opt == 'j')
+				json_file = value;
+			else
+				baseline_file = value;
+		}
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (reps < 1 || reps > MAX_REPS || min_time <= 0)
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	if (baseline_file && (base_count = load_baseline(baseline_file, base_names, base_medians)) < 0)
+	{
+		printf("Can't read %s\n", baseline_file);
+		return 1;
+	}
+
+	FILE *json = NULL;
+	if (json_file && !(json = fopen(json_file, "w")))
+	{
+		printf("Can't write %s\n", json_file);
+		return 1;
+	}
+	if (json)
+		fprintf(json, "{\"reps\": %d, \"min_time_ms\": %g, \"results\": [", reps, min_time * 1000);
+
+	printf("%-20s %-9s %10s %10s %10s %8s%s\n", "case", "group", "ns/op", "min", "mean", "stddev",
+		   baseline_file ? "     change" : "");
+
+	int written = 0;
+	int untimed = 0;
+	for (int i = 0; i < CASE_COUNT; i++)
+	{
+		const bench_case *c = &cases[i];
+		if (!selected(c->name, argc, argv, first))
+			continue;
+
+		faults = 0;
+		bench_result r = measure(c, reps, min_time);
+		if (r.ops == 0)
+		{
+			printf("%-20s %-9s  takes no time, optimized away?\n", c->name, c->group);
+			untimed++;
+			continue;
+		}
+		printf("%-20s %-9s %10.3f %10.3f %10.3f %8.3f", c->name, c->group, r.median, r.min, r.mean, r.stddev);
+		for (int j = 0; j < base_count; j++)
+		{
+			if (!strcmp(base_names[j], c->name) && base_medians[j] > 0)
+				printf(" %+9.1f%%", (r.median / base_medians[j] - 1) * 100);
+		}
+		printf("%s\n", faults ? "  (faulted)" : "");
+
+		if (json)
+			fprintf(json, "%s\n  {\"name\": \"%s\", \"group\": \"%s\", \"ns_per_op\": %.4f, \"min\": %.4f, \"mean\": %.4f, "
+						  "\"stddev\": %.4f, \"ops\": %llu, \"faulted\": %s}",
+					written++ ? "," : "", c->name, c->group, r.median, r.min, r.mean, r.stddev,
+					(unsigned long long)r.ops, faults ? "true" : "false");
+	}
+
+	if (json)
+	{
+		fprintf(json, "\n]}\n");
+		fclose(json);
+	}
+	return untimed ? 1 : 0;
+}
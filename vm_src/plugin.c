@@ -0,0 +1,242 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PLUGIN_DLOPEN
+#include <dlfcn.h>
+#endif
+
+#include "rv32i.h"
+#include "decode.h"
+#include "isa.h"
+#include "plugin.h"
+
+// Load the plugin of a -P argument, file[,arg...], and let it install itself
+// Returns 0 on success, -1 if it can't be loaded or refuses its arguments.
+int plugin_load(rv32plugins *p, const char *spec)
+{
+#ifdef PLUGIN_DLOPEN
+	if (p->count == PLUGIN_MAX)
+		return -1;
+
+	// A bare file name is looked for in the current directory, not the
+	// library path
+	size_t len = strlen(spec);
+	char *copy = malloc(len + 3);
+	if (copy == NULL)
+		return -1;
+	strcpy(copy, "./");
+	strcpy(copy + 2, spec);
+
+	char **argv = p->argv[p->count];
+	int argc = 0;
+	char *s = copy;
+	while (s && argc < PLUGIN_ARGS)
+	{
+		argv[argc++] = s;
+		s = strchr(s, ',');
+		if (s)
+			*s++ = 0;
+	}
+	argv[argc] = NULL;
+	if (s) // too many arguments
+	{
+		free(copy);
+		return -1;
+	}
+	if (strchr(argv[0] + 2, '/'))
+		argv[0] += 2;
+
+	void *handle = dlopen(argv[0], RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL)
+	{
+		free(copy);
+		return -1;
+	}
+
+	const int *version = dlsym(handle, "rv32_plugin_version");
+	int (*install)(rv32plugin *plugin, int argc, char **argv);
+	*(void **)&install = dlsym(handle, "rv32_plugin_install");
+
+	rv32plugin *plugin = &p->plugin[p->count];
+	memset(plugin, 0, sizeof(rv32plugin));
+	if (version == NULL || *version != RV32_PLUGIN_VERSION || install == NULL || install(plugin, argc, argv))
+	{
+		dlclose(handle);
+		free(copy);
+		return -1;
+	}
+
+	p->handle[p->count] = handle;
+	p->spec[p->count] = copy;
+	p->count++;
+	return 0;
+#else
+	(void)p;
+	(void)spec;
+	return -1;
+#endif
+}
+
+// Make every op the plugins hook fall back to rv32_execute, count ops from pc
+static void patch_ops(rv32plugins *p, rv32core *core, rv32op *ops, uint32_t pc, int count)
+{
+	int first = profile_slot(pc);
+
+	for (int i = 0; i < count; i++)
+	{
+		if (!p->hooked[first + i])
+			continue;
+
+		// A pair fused across the hooked instruction is split, so it runs on
+		// its own. The hooked op isn't fused with what follows any more.
+		if (i > 0 && ops[i - 1].len == 2)
+			decode_inst(&ops[i - 1], mem_read_32(core, pc + 4 * (i - 1)), pc + 4 * (i - 1));
+		ops[i].kind = OPK_FALLBACK;
+		ops[i].len = 1;
+	}
+}
+
+// Hand count instructions from pc to the plugins and record the callbacks
+// they ask for
+static void translate(rv32plugins *p, rv32core *core, uint32_t pc, int count)
+{
+	int first = profile_slot(pc);
+
+	for (int i = 0; i < count; i++)
+	{
+		rv32plugin_insn *insn = &p->insns[i];
+		insn->pc = pc + 4 * i;
+		insn->inst = mem_read_32(core, insn->pc);
+		insn->id = isa_decode(insn->inst);
+		insn->mnemonic = insn->id == ISA_UNKNOWN ? NULL : isa_table[insn->id].mnemonic;
+		isa_disasm(insn->text, sizeof(insn->text), insn->inst, insn->pc);
+
+		p->insts[first + i] = insn->inst;
+		p->hooked[first + i] = 0;
+	}
+
+	for (int n = 0; n < p->count; n++)
+	{
+		rv32plugin *plugin = &p->plugin[n];
+		if (plugin->translate == NULL)
+			continue;
+
+		for (int i = 0; i < count; i++)
+		{
+			p->insns[i].exec = NULL;
+			p->insns[i].mem = NULL;
+			p->insns[i].data = NULL;
+		}
+		plugin->translate(core, p->insns, count, plugin->data);
+
+		for (int i = 0; i < count; i++)
+		{
+			plugin_hook *hook = &p->hooks[n][first + i];
+			hook->exec = p->insns[i].exec;
+			hook->mem = p->insns[i].mem;
+			hook->data = p->insns[i].data;
+			p->hooked[first + i] |= hook->exec || hook->mem;
+		}
+	}
+}
+
+// Translate a RAM page, and patch its ops if it is decoded
+static void translate_page(rv32plugins *p, rv32core *core, int page)
+{
+	int first = page * (CODE_PAGE_SIZE / 4);
+	translate(p, core, RAM_BASE + 4 * first, CODE_PAGE_SIZE / 4);
+	p->ram_pages[page] = 1;
+
+	if (core->code && core->code->ram_code[page])
+		patch_ops(p, core, &core->code->ram[first], RAM_BASE + 4 * first, CODE_PAGE_SIZE / 4);
+}
+
+// Attach the loaded plugins to core and translate the ROM
+void plugin_start(rv32plugins *p, rv32core *core)
+{
+	core->plugins = p;
+	core->idle.off = 1; // fast-forwarded iterations would skip the callbacks
+
+	translate(p, core, ROM_BASE, ROM_SIZE / 4);
+	plugin_patch(p, core);
+}
+
+// Tell the plugins the run is over and unload them
+void plugin_stop(rv32plugins *p, rv32core *core, int fault)
+{
+	for (int n = 0; n < p->count; n++)
+	{
+		if (p->plugin[n].exit)
+			p->plugin[n].exit(core, fault, p->plugin[n].data);
+	}
+
+	for (int n = 0; n < p->count; n++)
+	{
+#ifdef PLUGIN_DLOPEN
+		dlclose(p->handle[n]);
+#endif
+		free(p->spec[n]);
+	}
+	p->count = 0;
+	core->plugins = 0;
+}
+
+// Patch the hooked ROM ops, after the ROM has been decoded again
+// RAM is patched as its pages get decoded.
+void plugin_patch(rv32plugins *p, rv32core *core)
+{
+	if (core->code)
+		patch_ops(p, core, core->code->rom, ROM_BASE, ROM_SIZE / 4);
+}
+
+// Called when a RAM page has just been decoded, the code in it may be new
+void plugin_patch_page(rv32plugins *p, rv32core *core, int page)
+{
+	translate_page(p, core, page);
+}
+
+// Called by rv32_execute before the instruction at pc runs
+// The reference interpreter has no decoding to follow, so RAM code is
+// translated when first run and again when the instruction there changed.
+void plugin_exec(rv32plugins *p, rv32core *core)
+{
+	uint32_t pc = core->pc;
+	int slot = profile_slot(pc);
+	if (slot < 0)
+		return;
+
+	if (slot >= ROM_SIZE / 4)
+	{
+		int page = (pc - RAM_BASE) / CODE_PAGE_SIZE;
+		if (!p->ram_pages[page] || p->insts[slot] != mem_read_32(core, pc))
+			translate_page(p, core, page);
+	}
+
+	if (!p->hooked[slot])
+		return;
+	for (int n = 0; n < p->count; n++)
+	{
+		plugin_hook *hook = &p->hooks[n][slot];
+		if (hook->exec)
+			hook->exec(core, pc, hook->data);
+	}
+}
+
+// Called by rv32_execute for every load and store of size bytes at addr
+void plugin_access(rv32plugins *p, rv32core *core, uint32_t addr, uint32_t value, int size, int store)
+{
+	int slot = profile_slot(core->pc);
+	if (slot < 0 || !p->hooked[slot])
+		return;
+
+	for (int n = 0; n < p->count; n++)
+	{
+		plugin_hook *hook = &p->hooks[n][slot];
+		if (hook->mem)
+			hook->mem(core, core->pc, addr, value, size, store, hook->data);
+	}
+}
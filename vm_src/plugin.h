@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include "rv32i.h"
+#include "profile.h"
+#include "decode.h"
+
+// Instrumentation plugins
+// Shared libraries loaded with -P, in the style of QEMU's TCG plugins, so one
+// build can be instrumented on demand. A plugin is told about code as it is
+// translated, which here is decoding: the ROM when the program is loaded and
+// a RAM page whenever code there is decoded anew. It then asks for a callback
+// on the instructions it wants to see run, and on the loads and stores of the
+// ones whose accesses it wants to see.
+//
+// Only those instructions pay for it. Their decoded ops are made
+// OPK_FALLBACK, so the fast engine ends its block there and runs them through
+// rv32_execute, which makes the callbacks; everything else runs as it always
+// does, and with no plugins the fast engine is the same code. Spin loops are
+// not fast-forwarded while plugins are loaded, so every iteration reaches
+// them.
+//
+// A plugin exports an int rv32_plugin_version set to RV32_PLUGIN_VERSION and
+//   int rv32_plugin_install(rv32plugin *p, int argc, char **argv)
+// which fills in the callbacks of p it wants and returns 0, or nonzero to
+// stop the emulator. argv holds the file name, then the arguments given
+// after it separated by commas, and stays valid until the plugin is unloaded
+// at exit. Plugins see the core they run on and may read its registers and
+// memory, but call nothing in the emulator.
+
+#define RV32_PLUGIN_VERSION 1
+
+// An instruction being translated
+struct rv32plugin_insn
+{
+	uint32_t pc;
+	uint32_t inst;
+	int id; // ISA_*, ISA_UNKNOWN for an invalid encoding
+	const char *mnemonic; // NULL for an invalid encoding
+	char text[40]; // disassembly
+
+	// Set by the plugin, called with data when the instruction runs
+	void (*exec)(rv32core *core, uint32_t pc, void *data); // before it runs
+	void (*mem)(rv32core *core, uint32_t pc, uint32_t addr, uint32_t value, int size, int store,
+				void *data); // for each load once it has read, and each store before it writes
+	void *data;
+};
+typedef struct rv32plugin_insn rv32plugin_insn;
+
+// What a plugin registers, any callback may be left NULL
+struct rv32plugin
+{
+	// Code is being translated, count instructions from insns[0].pc on
+	void (*translate)(rv32core *core, rv32plugin_insn *insns, int count, void *data);
+	// The run is over, with the fault that stopped it
+	void (*exit)(rv32core *core, int fault, void *data);
+	void *data; // passed to translate and exit
+};
+typedef struct rv32plugin rv32plugin;
+
+// Emulator side
+
+#define PLUGIN_MAX 8 // plugins loaded at once
+#define PLUGIN_ARGS 16 // arguments of a plugin
+
+// Callbacks a plugin asked for on one instruction
+struct plugin_hook
+{
+	void (*exec)(rv32core *core, uint32_t pc, void *data);
+	void (*mem)(rv32core *core, uint32_t pc, uint32_t addr, uint32_t value, int size, int store, void *data);
+	void *data;
+};
+typedef struct plugin_hook plugin_hook;
+
+struct rv32plugins
+{
+	rv32plugin plugin[PLUGIN_MAX];
+	void *handle[PLUGIN_MAX]; // of the shared library
+	char *spec[PLUGIN_MAX];	  // copy of -P's argument, split into argv
+	char *argv[PLUGIN_MAX][PLUGIN_ARGS + 1];
+	int count;
+
+	plugin_hook hooks[PLUGIN_MAX][PROFILE_SLOTS];
+	uint8_t hooked[PROFILE_SLOTS]; // 1 if any plugin has a callback on the instruction
+	uint32_t insts[PROFILE_SLOTS]; // instruction translated at each RAM address
+	uint8_t ram_pages[CODE_PAGES]; // 1 once a RAM page has been translated
+
+	rv32plugin_insn insns[ROM_SIZE / 4]; // handed to translate
+};
+typedef struct rv32plugins rv32plugins;
+
+int plugin_load(rv32plugins *p, const char *spec);
+void plugin_start(rv32plugins *p, rv32core *core);
+void plugin_stop(rv32plugins *p, rv32core *core, int fault);
+
+void plugin_patch(rv32plugins *p, rv32core *core);
+void plugin_patch_page(rv32plugins *p, rv32core *core, int page);
+void plugin_exec(rv32plugins *p, rv32core *core);
+void plugin_access(rv32plugins *p, rv32core *core, uint32_t addr, uint32_t value, int size, int store);
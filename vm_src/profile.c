@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32i.h"
+#include "elfsym.h"
+#include "profile.h"
+
+// Executed address and how often it ran, or a function and its total
+struct hot_entry
+{
+	uint32_t addr;
+	uint64_t count;
+	const char *name;
+};
+typedef struct hot_entry hot_entry;
+
+void profile_clear(rv32profile *prof)
+{
+	memset(prof, 0, sizeof(rv32profile));
+}
+
+static int hotter(const void *a, const void *b)
+{
+	const hot_entry *x = a, *y = b;
+	if (x->count != y->count)
+		return x->count < y->count ? 1 : -1;
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+// Turns one table of differences back into counts, appending every executed address
+static int collect(const int64_t *diff, int n, uint32_t base, hot_entry *out)
+{
+	int64_t count = 0;
+	int found = 0;
+	for (int i = 0; i < n; i++)
+	{
+		count += diff[i];
+		if (count > 0)
+		{
+			out[found].addr = base + 4 * i;
+			out[found].count = count;
+			out[found].name = NULL;
+			found++;
+		}
+	}
+	return found;
+}
+
+static double percent(uint64_t count, uint64_t total)
+{
+	return total ? 100.0 * count / total : 0.0;
+}
+
+// Write the profile, hottest first, per function and then per address
+// With symbols, addresses are shown as function+offset and source line.
+void profile_report(rv32profile *prof, FILE *out, elf_symbols *syms)
+{
+	hot_entry *pcs = malloc((ROM_SIZE / 4 + RAM_SIZE / 4) * sizeof(hot_entry));
+	hot_entry *funcs = malloc((ROM_SIZE / 4 + RAM_SIZE / 4) * sizeof(hot_entry));
+	if (pcs == NULL || funcs == NULL)
+	{
+		free(pcs);
+		free(funcs);
+		return;
+	}
+
+	int n = collect(prof->ram, RAM_SIZE / 4, RAM_BASE, pcs);
+	n += collect(prof->rom, ROM_SIZE / 4, ROM_BASE, pcs + n);
+
+	// Addresses are in order here, so each function's are next to each other
+	uint64_t total = 0;
+	int nfuncs = 0;
+	for (int i = 0; i < n; i++)
+	{
+		uint32_t offset = 0;
+		const char *name = syms ? elfsym_function(syms, pcs[i].addr, &offset) : NULL;
+		pcs[i].name = name;
+		total += pcs[i].count;
+
+		if (nfuncs && name && funcs[nfuncs - 1].name == name && pcs[i].addr - offset == funcs[nfuncs - 1].addr)
+		{
+			funcs[nfuncs - 1].count += pcs[i].count;
+			continue;
+		}
+		if (name == NULL)
+			continue;
+		funcs[nfuncs].addr = pcs[i].addr - offset;
+		funcs[nfuncs].count = pcs[i].count;
+		funcs[nfuncs].name = name;
+		nfuncs++;
+	}
+
+	qsort(funcs, nfuncs, sizeof(hot_entry), hotter);
+	qsort(pcs, n, sizeof(hot_entry), hotter);
+
+	fprintf(out, "Profile of %llu instructions at %d addresses\n", (unsigned long long)total, n);
+
+	if (nfuncs)
+	{
+		fprintf(out, "\nFunctions\n");
+		fprintf(out, "%14s %7s  %-8s  %s\n", "count", "%", "address", "function");
+		for (int i = 0; i < nfuncs; i++)
+			fprintf(out, "%14llu %6.2f%%  %08x  %s\n", (unsigned long long)funcs[i].count,
+					percent(funcs[i].count, total), funcs[i].addr, funcs[i].name);
+	}
+
+	fprintf(out, "\nAddresses\n");
+	fprintf(out, "%14s %7s  %-8s  %s\n", "count", "%", "address", "location");
+	for (int i = 0; i < n; i++)
+	{
+		fprintf(out, "%14llu %6.2f%%  %08x", (unsigned long long)pcs[i].count, percent(pcs[i].count, total), pcs[i].addr);
+
+		uint32_t offset;
+		const char *file;
+		if (syms && pcs[i].name && elfsym_function(syms, pcs[i].addr, &offset))
+			fprintf(out, "  %s+0x%x", pcs[i].name, offset);
+		int line = syms ? elfsym_line(syms, pcs[i].addr, &file) : 0;
+		if (line)
+			fprintf(out, "  %s:%d", file, line);
+		fprintf(out, "\n");
+	}
+
+	free(pcs);
+	free(funcs);
+}
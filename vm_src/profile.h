@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "rv32i.h"
+#include "elfsym.h"
+
+// Exact per-PC execution counts
+// Code runs in straight lines between jumps, so instead of counting every
+// instruction the profiler adds 1 where a run starts and subtracts 1 just past
+// where it ends. The counts are recovered with a prefix sum when reporting, so
+// the cost while running is two array updates per basic block.
+
+struct rv32profile
+{
+	int64_t rom[ROM_SIZE / 4 + 1];
+	int64_t ram[RAM_SIZE / 4 + 1];
+};
+typedef struct rv32profile rv32profile;
+
+// Count n instructions executed in a row from pc, each of them times times
+static inline void profile_range(rv32profile *prof, uint32_t pc, uint64_t n, uint64_t times)
+{
+	int64_t *diff;
+	uint32_t index;
+
+	if (pc - ROM_BASE < ROM_SIZE)
+	{
+		diff = prof->rom;
+		index = (pc - ROM_BASE) / 4;
+	}
+	else if (pc - RAM_BASE < RAM_SIZE)
+	{
+		diff = prof->ram;
+		index = (pc - RAM_BASE) / 4;
+	}
+	else
+		return;
+
+	diff[index] += times;
+	diff[index + n] -= times;
+}
+
+// Tables of counts per instruction index them by slot, ROM first
+#define PROFILE_SLOTS (ROM_SIZE / 4 + RAM_SIZE / 4)
+
+// Slot of pc, -1 outside RAM and ROM
+static inline int profile_slot(uint32_t pc)
+{
+	if (pc - ROM_BASE < ROM_SIZE)
+		return (pc - ROM_BASE) / 4;
+	if (pc - RAM_BASE < RAM_SIZE)
+		return ROM_SIZE / 4 + (pc - RAM_BASE) / 4;
+	return -1;
+}
+
+static inline uint32_t profile_slot_pc(int slot)
+{
+	return slot < ROM_SIZE / 4 ? ROM_BASE + 4 * (uint32_t)slot : RAM_BASE + 4 * (uint32_t)(slot - ROM_SIZE / 4);
+}
+
+void profile_clear(rv32profile *prof);
+void profile_report(rv32profile *prof, FILE *out, elf_symbols *syms);
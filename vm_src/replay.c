@@ -0,0 +1,166 @@
+#define _CRT_SECURE_NO_WARNINGS // allow building on MSVC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32i.h"
+#include "events.h"
+#include "replay.h"
+
+// FNV-1a of the ROM, so a log isn't replayed against another program
+static uint32_t rom_hash(rv32core *core)
+{
+	uint32_t h = 2166136261u;
+	for (int i = 0; i < ROM_SIZE; i++)
+		h = (h ^ core->rom[i]) * 16777619u;
+	return h;
+}
+
+static void put_varint(rv32replay *r, uint64_t v)
+{
+	for (; v >= 0x80; v >>= 7)
+		putc((uint8_t)v | 0x80, r->file);
+	putc((uint8_t)v, r->file);
+}
+
+// Returns -1 at the end of the log
+static int get_varint(rv32replay *r, uint64_t *v)
+{
+	*v = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		int b = getc(r->file);
+		if (b == EOF)
+			return -1;
+		*v |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			return 0;
+	}
+	return -1;
+}
+
+// Read ahead the next logged load
+static void read_next(rv32replay *r)
+{
+	uint64_t delta;
+	uint64_t addr;
+	uint64_t value = r->last_value;
+
+	r->have_next = 0;
+	if (get_varint(r, &delta) || get_varint(r, &addr) || (!(delta & 1) && get_varint(r, &value)))
+		return;
+
+	r->next_count = r->last_count + (delta >> 1);
+	r->next_addr = r->last_addr + ((uint32_t)(addr >> 1) ^ -(uint32_t)(addr & 1));
+	r->next_value = (uint32_t)value;
+	r->have_next = 1;
+}
+
+// Open path, to log device input to it or to replay the log in it
+// Returns -1 if the file can't be opened or was recorded with another ROM.
+int replay_start(rv32replay *r, rv32core *core, const char *path, int mode)
+{
+	uint8_t header[12];
+	uint32_t hash = rom_hash(core);
+
+	memset(r, 0, sizeof(rv32replay));
+	r->mode = mode;
+	r->last_count = core->inst_count;
+	r->file = fopen(path, mode == REPLAY_PLAY ? "rb" : "wb");
+	if (r->file == NULL)
+		return -1;
+
+	if (mode == REPLAY_PLAY)
+	{
+		if (fread(header, 1, 12, r->file) != 12 || memcmp(header, REPLAY_MAGIC, 8) ||
+			(header[8] | header[9] << 8 | header[10] << 16 | (uint32_t)header[11] << 24) != hash)
+		{
+			fclose(r->file);
+			return -1;
+		}
+		read_next(r);
+	}
+	else
+	{
+		memcpy(header, REPLAY_MAGIC, 8);
+		header[8] = hash;
+		header[9] = hash >> 8;
+		header[10] = hash >> 16;
+		header[11] = hash >> 24;
+		if (fwrite(header, 1, 12, r->file) != 12)
+			r->error = 1;
+	}
+
+	core->replay = r;
+	return 0;
+}
+
+// Returns -1 if the log couldn't be written
+int replay_stop(rv32replay *r, rv32core *core)
+{
+	core->replay = NULL;
+	if (r->file && fclose(r->file))
+		r->error = 1;
+	r->file = NULL;
+	return r->error ? -1 : 0;
+}
+
+void replay_report(rv32replay *r, FILE *out)
+{
+	if (r->mode == REPLAY_RECORD)
+		fprintf(out, "Recorded %llu device reads\n", (unsigned long long)r->loads);
+	else if (r->diverged_at)
+		fprintf(out, "Replay diverged from the log at instruction %llu, after %llu device reads\n",
+				(unsigned long long)r->diverged_at, (unsigned long long)r->loads);
+	else
+		fprintf(out, "Replayed %llu device reads%s\n", (unsigned long long)r->loads,
+				r->have_next ? ", the log goes on further" : "");
+}
+
+void replay_record(rv32replay *r, uint32_t addr, uint64_t count, uint32_t value)
+{
+	int same = r->loads && value == r->last_value;
+	int32_t delta = (int32_t)(addr - r->last_addr);
+
+	put_varint(r, (count - r->last_count) << 1 | same);
+	put_varint(r, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+	if (!same)
+		put_varint(r, value);
+
+	r->last_count = count;
+	r->last_addr = addr;
+	r->last_value = value;
+	r->loads++;
+}
+
+// Event stopping a replay that went its own way
+static int replay_diverged(rv32core *core, void *ctx)
+{
+	(void)core;
+	(void)ctx;
+	return REPLAY_DIVERGED;
+}
+
+// Value the load at count from addr returned when the log was recorded
+uint32_t replay_load(rv32replay *r, rv32core *core, uint32_t addr, uint64_t count)
+{
+	if (!r->have_next || r->next_count != count || r->next_addr != addr)
+	{
+		if (!r->diverged_at)
+		{
+			r->diverged_at = count;
+			events_schedule(&core->events, core->inst_count, replay_diverged, r);
+		}
+		return 0;
+	}
+
+	uint32_t value = r->next_value;
+	r->last_count = r->next_count;
+	r->last_addr = r->next_addr;
+	r->last_value = value;
+	r->loads++;
+	read_next(r);
+	return value;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "rv32i.h"
+
+// Device input record and replay
+// Recording logs every value a device returns to an MMIO load, with the
+// address and the inst_count the load happened at. Replaying feeds the logged
+// values back instead of asking the devices, so a run can be reproduced
+// exactly without them. A load that doesn't match the next logged one (a
+// different address or count, or running past the end of the log) stops the
+// run with REPLAY_DIVERGED.
+//
+// File layout: "RV32RPL1", u32 hash of the ROM, then one entry per load
+//   varint count delta << 1 | same, zigzag varint address delta, varint value
+// where the deltas are from the previous entry and same means the value is
+// the previous entry's, and isn't stored again.
+
+#define REPLAY_MAGIC "RV32RPL1"
+
+// Modes
+#define REPLAY_RECORD 0
+#define REPLAY_PLAY 1
+
+struct rv32replay
+{
+	FILE *file;
+	int mode;
+	int error;
+
+	uint64_t last_count; // previous entry
+	uint32_t last_addr;
+	uint32_t last_value;
+
+	// Next logged load, when replaying
+	int have_next;
+	uint64_t next_count;
+	uint32_t next_addr;
+	uint32_t next_value;
+
+	uint64_t loads; // loads recorded or replayed
+	uint64_t diverged_at; // inst_count replay stopped at
+};
+typedef struct rv32replay rv32replay;
+
+int replay_start(rv32replay *r, rv32core *core, const char *path, int mode);
+int replay_stop(rv32replay *r, rv32core *core);
+void replay_report(rv32replay *r, FILE *out);
+
+uint32_t replay_load(rv32replay *r, rv32core *core, uint32_t addr, uint64_t count);
+void replay_record(rv32replay *r, uint32_t addr, uint64_t count, uint32_t value);
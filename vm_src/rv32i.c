@@ -1,18 +1,54 @@
 #define _CRT_SECURE_NO_WARNINGS
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 
 #include "rv32i.h"
 #include "instructions.h"
-#include "opcodes.h"
+#include "decode.h"
+#include "engine.h"
+#include "profile.h"
+#include "callstack.h"
+#include "timing.h"
+#include "stats.h"
+#include "cache.h"
+#include "trace.h"
+#include "replay.h"
+#include "gdbstub.h"
+#include "cosim.h"
+#include "simt.h"
+#include "plugin.h"
 
 // Reset the HART (zero the registers and PC)
 void core_reset(rv32core *core)
 {
 	for (int i = 0; i < 32; i++)
 		core->x[i] = 0;
+	for (int i = 0; i < 32; i++)
+		core->f[i] = 0;
+	core->fcsr = 0;
 	core->pc = ROM_BASE;
 	core->inst_count = 0;
+	events_clear(&core->events);
+	idle_reset(&core->idle);
+	core->code = 0;
+	core->tier = TIER_REFERENCE;
+	core->input = 0;
+	core->input_size = 0;
+	core->prof = 0;
+	core->stacks = 0;
+	core->timing = 0;
+	core->trace = 0;
+	core->trace_mem = 0;
+	core->replay = 0;
+	core->gdb = 0;
+	core->cosim = 0;
+	core->plugins = 0;
+	core->lane = 0;
+#ifdef RV32_STATS
+	core->stats = 0;
+	core->cache = 0;
+#endif
 }
 
 // Clear RAM
@@ -106,6 +142,9 @@ uint32_t mem_read_32(rv32core *core, uint32_t addr)
 
 void mem_store_8(rv32core *core, uint32_t addr, uint8_t value)
 {
+	if (core->code) // drop decoded RAM code this overwrites
+		code_invalidate_store(core->code, addr, 1);
+
 	uint8_t *memPtr = memoryPointer(core, addr);
 	addr -= getMemBase(addr);
 	memPtr[addr] = value;
@@ -113,6 +152,9 @@ void mem_store_8(rv32core *core, uint32_t addr, uint8_t value)
 
 void mem_store_16(rv32core *core, uint32_t addr, uint16_t value)
 {
+	if (core->code) // drop decoded RAM code this overwrites
+		code_invalidate_store(core->code, addr, 2);
+
 	uint8_t *memPtr = memoryPointer(core, addr);
 	addr -= getMemBase(addr);
 	memPtr[addr] = value & 0xff;
@@ -121,6 +163,9 @@ void mem_store_16(rv32core *core, uint32_t addr, uint16_t value)
 
 void mem_store_32(rv32core *core, uint32_t addr, uint32_t value)
 {
+	if (core->code) // drop decoded RAM code this overwrites
+		code_invalidate_store(core->code, addr, 4);
+
 	uint8_t *memPtr = memoryPointer(core, addr);
 	addr -= getMemBase(addr);
 	memPtr[addr] = value & 0xff;
@@ -136,13 +181,86 @@ void loadProgram(rv32core *core, uint32_t program[], int len)
 		mem_store_32(core, ROM_BASE + (4 * i), program[i]);
 }
 
+// Input device
+// Reads have no side effects, so the same word can be read any number of
+// times, and past the end of the input reads 0.
+static uint32_t input_read(rv32core *core, uint32_t offset)
+{
+	if (offset == 0)
+		return core->input_size;
+
+	uint32_t value = 0;
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		uint32_t at = offset - 4 + i;
+		if (at < core->input_size)
+			value |= (uint32_t)core->input[at] << (8 * i);
+	}
+	return value;
+}
+
+// Map the contents of filename as the core's input
+int input_load(rv32core *core, const char *filename)
+{
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL)
+		return -1;
+
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	input_free(core);
+
+	if (size < 0 || size > 0x100000 - 4) // past the end of the device
+	{
+		fclose(f);
+		return -1;
+	}
+
+	uint8_t *data = malloc(size ? size : 1);
+	if (data == NULL || fread(data, 1, size, f) != (size_t)size)
+	{
+		free(data);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	core->input = data;
+	core->input_size = (uint32_t)size;
+	return 0;
+}
+
+void input_free(rv32core *core)
+{
+	free((void *)core->input);
+	core->input = 0;
+	core->input_size = 0;
+}
+
 // MMIO reads
-uint32_t mmio_load(uint32_t addr)
+// count is the inst_count of the load, which the fast engine only writes back
+// to the core at the end of a block
+uint32_t mmio_load(rv32core *core, uint32_t addr, uint64_t count)
 {
-	return 0xdeadbeef;
+	if (cosim_shadow(core)) // gets what the checked core read
+		return cosim_load(core->cosim, addr, count);
+
+	uint32_t value = 0xdeadbeef;
+	if (addr - INPUT_BASE < 0x100000 && !(addr & 3)) // input device
+		value = input_read(core, addr - INPUT_BASE);
+
+	if (core->replay && core->replay->mode == REPLAY_PLAY)
+		value = replay_load(core->replay, core, addr, count);
+	else if (core->replay)
+		replay_record(core->replay, addr, count, value);
+
+	if (core->cosim)
+		cosim_record(core->cosim, addr, count, value);
+	return value;
 }
 
-int mmio_store(uint32_t addr, uint32_t val)
+int mmio_store(rv32core *core, uint32_t addr, uint32_t val)
 {
 	if (addr == 0x11100000) // SYSCON
 	{
@@ -151,71 +269,135 @@ int mmio_store(uint32_t addr, uint32_t val)
 	}
 	else if (addr == 0x10000000) // UART
 	{
-		printf("%c", val);
+		if (core->lane) // a batch lane, printed when the lane is reported
+			simt_output(core->lane, val);
+		else if (!cosim_shadow(core)) // the checked core has printed it already
+			printf("%c", val);
 	}
 	return 0;
 }
 
+// What a fault code means
+const char *fault_name(int fault)
+{
+	switch (fault)
+	{
+	case UNDEF_OPCODE:	   return "Undefined opcode";
+	case UNDEF_FUNC3:	   return "Undefined func3";
+	case UNDEF_FUNC7:	   return "Undefined func7";
+	case UNDEF_CSR:		   return "Undefined CSR";
+	case PC_UNALIGN:	   return "Unaligned PC";
+	case PC_OUT_OF_RANGE:  return "PC out of range!";
+	case WRITE_ROM:		   return "Tried to write in ROM!";
+	case SYSCON_SHUTDOWN:  return "Poweroff by SYSCON";
+	case EVENT_QUEUE_FULL: return "Device event queue full";
+	case REPLAY_DIVERGED:  return "Run no longer matches the device log";
+	case COSIM_DIVERGED:   return "Fast engine and reference interpreter diverged";
+	case DEBUG_BREAK:	   return "Killed by the debugger";
+	default:			   return "Unknown fault";
+	}
+}
+
 // Execute a single instruction
 int rv32_execute(rv32core *core)
 {
-	int fault = 0;
-
-	if (core->pc & 0b11 != 0)
+	if ((core->pc & 0b11) != 0)
 		return PC_UNALIGN;
 
 	if (!inMemory(core->pc))
 		return PC_OUT_OF_RANGE;
 
-	uint32_t inst = mem_read_32(core, core->pc);
-	uint8_t opcode = get_opcode(inst);
-
-	switch (opcode)
-	{
-
-	case OP_IMM:
-		fault = exec_op_imm(core, inst);
-		break;
-
-	case OP_LUI:
-		fault = exec_op_lui(core, inst);
-		break;
-
-	case OP_AUIPC:
-		fault = exec_op_auipc(core, inst);
-		break;
-
-	case OP_OP:
-		fault = exec_op_op(core, inst);
-		break;
-
-	case OP_JAL:
-		fault = exec_op_jal(core, inst);
-		break;
+	if (core->plugins)
+		plugin_exec(core->plugins, core);
 
-	case OP_JALR:
-		fault = exec_op_jalr(core, inst);
-		break;
-
-	case OP_BRANCH:
-		fault = exec_op_branch(core, inst);
-		break;
-
-	case OP_LOAD:
-		fault = exec_op_load(core, inst);
-		break;
-
-	case OP_STORE:
-		fault = exec_op_store(core, inst);
-		break;
-
-	default:
-		fault = UNDEF_OPCODE;
-		break;
-	}
+	uint32_t inst = mem_read_32(core, core->pc);
+	int fault = exec_inst(core, inst);
 
 	core->pc += 4;
 	core->inst_count++;
 	core->x[0] = 0;
 	return fault;
+}
+
+// Run until a fault, dispatching device events as their deadlines are reached
+int rv32_run(rv32core *core)
+{
+	int fault = 0;
+	uint8_t tier = core->code ? TIER_FAST : TIER_REFERENCE;
+
+	while (!fault)
+	{
+		core->tier = tier;
+		while (!fault && core->inst_count < core->events.next)
+		{
+			uint32_t pc = core->pc;
+			uint64_t count = core->inst_count;
+			if (core->code)
+				fault = engine_block(core, core->events.next - core->inst_count); // a basic block, up to the deadline
+			else if (core->gdb && gdb_breakpoint(core->gdb, core))
+				fault = DEBUG_BREAK;
+			else
+				fault = rv32_execute(core); // execute one instruction
+
+			if (core->prof) // everything just executed runs in a line from pc
+				profile_range(core->prof, pc, core->inst_count - count, 1);
+			if (core->stacks)
+				stacks_step(core->stacks, core, pc, core->inst_count - count);
+			if (core->timing)
+				timing_step(core->timing, core, pc, core->inst_count - count, fault);
+			if (core->trace)
+				trace_step(core->trace, core, pc, core->inst_count - count, fault);
+			if (core->cosim)
+				fault = cosim_step(core->cosim, core, pc, fault, 0);
+#ifdef RV32_STATS
+			if (core->stats)
+				stats_step(core, pc, core->inst_count - count);
+			if (core->cache)
+				cache_fetch(core->cache, pc, core->inst_count - count);
+#endif
+
+			// Jumped back to the last instruction run or before it, maybe a spin
+			// loop. Comparing with the last instruction rather than pc makes
+			// both engines see the same loops, whatever the block boundaries.
+			if (!fault && core->pc <= pc + 4 * (uint32_t)(core->inst_count - count - 1))
+			{
+				uint32_t top = core->pc;
+				uint64_t skipped = idle_skip(core);
+				if (skipped && core->prof) // whole iterations of the loop body
+				{
+					idle_loop *loop = idle_slot(&core->idle, top);
+					profile_range(core->prof, top, loop->len, skipped / loop->len);
+				}
+				if (skipped && core->stacks)
+					stacks_count(core->stacks, skipped);
+				if (skipped && core->timing)
+					timing_loop(core->timing, core, top, skipped);
+				if (skipped && core->trace)
+					trace_skip(core->trace, core, top, skipped);
+				if (skipped && core->cosim)
+					fault = cosim_step(core->cosim, core, top, 0, 1);
+#ifdef RV32_STATS
+				if (skipped && core->stats)
+					stats_loop(core, top, skipped);
+				if (skipped && core->cache)
+					cache_loop(core->cache, core, top, skipped);
+#endif
+			}
+
+			/*
+			if (!fault) {
+				core_print(core);   // show CPU contents
+				printf("****************\n");
+			}
+			*/
+		}
+
+		if (!fault)
+		{
+			core->tier = TIER_EVENTS;
+			fault = events_dispatch(core);
+			core->idle.last_top = 0; // device state may have changed under a polling loop
+		}
+	}
+	return fault;
 }
\ No newline at end of file
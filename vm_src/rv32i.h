@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdint.h>
+#include "events.h"
+#include "idle.h"
 
 // Where RAM lives
 #define RAM_BASE 0x20000000
@@ -20,6 +22,10 @@
 // ROM End
 #define ROM_END (ROM_BASE + ROM_SIZE)
 
+// Where the input device lives: a word with the size of the input in bytes,
+// then the input itself, read a word at a time
+#define INPUT_BASE 0x10100000
+
 // Errors
 #define UNDEF_OPCODE -1
 #define UNDEF_FUNC3 -2
@@ -28,17 +34,67 @@
 #define PC_OUT_OF_RANGE -5
 #define SYSCON_SHUTDOWN -6
 #define WRITE_ROM -7
+#define EVENT_QUEUE_FULL -8
+#define REPLAY_DIVERGED -9
+#define DEBUG_BREAK -10
+#define COSIM_DIVERGED -11
+#define UNDEF_CSR -12
+
+// Engine tiers, what the core is busy with
+#define TIER_REFERENCE 0 // reference interpreter
+#define TIER_FAST 1		 // predecoded fast engine
+#define TIER_EVENTS 2	 // device event callbacks
+#define TIER_DECODE 3	 // predecoding
+#define TIER_COUNT 4
+
+struct rv32code;
+struct rv32profile;
+struct call_stacks;
+struct rv32timing;
+struct rv32stats;
+struct rv32cache;
+struct rv32trace;
+struct rv32replay;
+struct gdb_stub;
+struct rv32cosim;
+struct rv32plugins;
+struct rv32lane;
 
 // RISC-V 32bit core
 struct rv32core
 {
-	uint32_t x[32]; // 32 registers
+	uint32_t x[32 + 1]; // 32 registers, plus the sink the fast engine sends x0 writes to
 	uint32_t pc;
+	uint32_t f[32]; // F registers, as bit patterns
+	uint32_t fcsr;	// fflags in bits 4:0, frm in bits 7:5
 
 	uint8_t ram[RAM_SIZE];
 	uint8_t rom[ROM_SIZE];
 
 	uint64_t inst_count;
+
+	event_queue events; // pending device events
+	idle_state idle;	// spin-loop detection
+	volatile uint8_t tier; // TIER_*, sampled by the telemetry timer
+
+	const uint8_t *input; // what the input device reads, NULL for nothing
+	uint32_t input_size;
+
+	struct rv32code *code; // predecoded program for the fast engine, NULL to interpret
+	struct rv32profile *prof; // per-PC execution counts, NULL when not profiling
+	struct call_stacks *stacks; // shadow call stack profiler, NULL when not profiling
+	struct rv32timing *timing; // cycle estimate, NULL when not estimating
+	struct rv32trace *trace; // execution trace, NULL when not tracing
+	struct rv32trace *trace_mem; // the same trace when it records memory accesses
+	struct rv32replay *replay; // device input log being recorded or replayed, NULL if neither
+	struct gdb_stub *gdb; // debugger stub, NULL when not debugging
+	struct rv32cosim *cosim; // lockstep check against the reference interpreter, NULL if off
+	struct rv32plugins *plugins; // instrumentation plugins, NULL if none are loaded
+	struct rv32lane *lane; // batch lane, whose UART output is kept; NULL when running alone
+#ifdef RV32_STATS
+	struct rv32stats *stats; // instruction mix, NULL when not counting
+	struct rv32cache *cache; // cache simulation, NULL when not simulating
+#endif
 };
 typedef struct rv32core rv32core;
 
@@ -59,7 +115,13 @@ uint32_t mem_read_32(rv32core *core, uint32_t addr);
 
 void loadProgram(rv32core *core, uint32_t program[], int len);
 
-uint32_t mmio_load(uint32_t addr);
-int mmio_store(uint32_t addr, uint32_t val);
+uint32_t mmio_load(rv32core *core, uint32_t addr, uint64_t count);
+int mmio_store(rv32core *core, uint32_t addr, uint32_t val);
+
+int input_load(rv32core *core, const char *filename);
+void input_free(rv32core *core);
+
+const char *fault_name(int fault);
 
-int rv32_execute(rv32core *core);
\ No newline at end of file
+int rv32_execute(rv32core *core);
+int rv32_run(rv32core *core);
\ No newline at end of file
@@ -0,0 +1,563 @@
+#define _CRT_SECURE_NO_WARNINGS // allow building on MSVC
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32i.h"
+#include "decode.h"
+#include "engine.h"
+#include "telemetry.h"
+#include "fpu.h"
+#include "simt.h"
+
+// Keep a character the lane printed
+void simt_output(rv32lane *lane, uint32_t c)
+{
+	if (lane->len == lane->cap)
+	{
+		size_t cap = lane->cap ? 2 * lane->cap : 256;
+		char *out = realloc(lane->out, cap);
+		if (out == NULL)
+			return;
+		lane->out = out;
+		lane->cap = cap;
+	}
+	lane->out[lane->len++] = (char)c;
+}
+
+// Lane l stops with fault at pc
+static void lane_stop(rv32warp *w, int l, int fault, uint32_t pc)
+{
+	w->pc[l] = pc;
+	w->running[l] = 0;
+	w->fault[l] = fault;
+}
+
+// Move lane l's registers and counts between the warp and its core
+static void lane_unload(rv32warp *w, int l)
+{
+	for (int r = 0; r < 32; r++)
+		w->core[l]->x[r] = w->x[r][l];
+	w->core[l]->x[0] = 0;
+	w->core[l]->pc = w->pc[l];
+	w->core[l]->inst_count = w->count[l];
+}
+
+static void lane_load(rv32warp *w, int l)
+{
+	for (int r = 0; r < 32; r++)
+		w->x[r][l] = w->core[l]->x[r];
+	w->pc[l] = w->core[l]->pc;
+	w->count[l] = w->core[l]->inst_count;
+}
+
+// Run one instruction of lane l on the reference interpreter
+static void lane_step(rv32warp *w, int l)
+{
+	lane_unload(w, l);
+	int fault = rv32_execute(w->core[l]);
+	lane_load(w, l);
+	if (fault)
+		lane_stop(w, l, fault, w->pc[l]);
+}
+
+// Finish lane l on the scalar engine, with code of its own since what it
+// decodes from RAM is its own
+static void lane_split(rv32batch *b, rv32warp *w, int l)
+{
+	rv32core *core = w->core[l];
+
+	lane_unload(w, l);
+	memcpy(b->scalar, b->code, sizeof(rv32code));
+	core->code = b->scalar;
+	int fault = rv32_run(core);
+	core->code = b->code;
+
+	b->scalar_insts += core->inst_count - w->count[l];
+	lane_load(w, l);
+	lane_stop(w, l, fault, w->pc[l]);
+}
+
+// Cases of the warp's switch generated from isa.h, like the fast engine's
+// Integer registers are read lane by lane, through l, and core is the lane's
+// core wherever memory or the F registers are involved.
+#define RS1 x[op->rs1][l]
+#define RS2 x[op->rs2][l]
+#define IMM op->imm
+#define F1 fpu_float(core->f[op->rs1])
+#define F2 fpu_float(core->f[op->rs2])
+#define F3 fpu_float(core->f[op->imm2 >> 27])
+#define FB1 core->f[op->rs1]
+#define FB2 core->f[op->rs2]
+#define RM rm[l]
+#define CSR csr
+
+// Every lane, and only the lanes of the mask, with their core
+#define LANES for (int l = 0; l < SIMT_WIDTH; l++)
+#define ACTIVE_LANES LANES if (m[l])
+#define CORE rv32core *core = w->core[l]
+
+// Values are computed for every lane and written to the masked ones, which
+// keeps both loops free of branches
+#define WRITE_FROM(rd, value) LANES x[rd][l] = (value[l] & m[l]) | (x[rd][l] & ~m[l])
+#define WRITE(rd) WRITE_FROM(rd, v)
+
+#define SIMT_ALU(id, semantics) \
+	case OPK_##id: LANES v[l] = (semantics); WRITE(op->rd); op++; continue;
+#define SIMT_UPPER(id, semantics)
+#define SIMT_LOAD(id, semantics)											\
+	case OPK_##id:															\
+		ACTIVE_LANES														\
+		{																	\
+			CORE;															\
+			core->inst_count = w->count[l]; /* for device reads */			\
+			x[op->rd][l] = engine_load(core, RS1 + IMM, OPK_##id, op - start); \
+		}																	\
+		op++;																\
+		continue;
+#define SIMT_STORE(id, semantics)											\
+	case OPK_##id:															\
+		ACTIVE_LANES														\
+		{																	\
+			CORE;															\
+			int fault = engine_store(core, RS1 + IMM, RS2, OPK_##id, op - start);		\
+			if (fault)														\
+			{																\
+				w->count[l] += (op - start) + 1;							\
+				lane_stop(w, l, fault, OP_PC(op) + 4);						\
+				m[l] = 0;													\
+			}																\
+		}																	\
+		op++;																\
+		continue;
+#define SIMT_BRANCH(id, semantics)											\
+	case OPK_##id:															\
+		LANES v[l] = (semantics) ? op->imm : OP_PC(op) + 4;					\
+		goto block_end;
+#define SIMT_JUMP(id, semantics)
+#define SIMT_FLOAD(id, semantics)											\
+	case OPK_##id:															\
+		ACTIVE_LANES														\
+		{																	\
+			CORE;															\
+			core->inst_count = w->count[l];									\
+			core->f[op->rd] = engine_load(core, RS1 + IMM, OPK_##semantics, op - start); \
+		}																	\
+		op++;																\
+		continue;
+#define SIMT_FSTORE(id, semantics)											\
+	case OPK_##id:															\
+		ACTIVE_LANES														\
+		{																	\
+			CORE;															\
+			int fault = engine_store(core, RS1 + IMM, FB2, OPK_##semantics, op - start);	\
+			if (fault)														\
+			{																\
+				w->count[l] += (op - start) + 1;							\
+				lane_stop(w, l, fault, OP_PC(op) + 4);						\
+				m[l] = 0;													\
+			}																\
+		}																	\
+		op++;																\
+		continue;
+#define SIMT_FARITH(id, semantics)											\
+	case OPK_##id:															\
+		ACTIVE_LANES														\
+		{																	\
+			rm[l] = fpu_rm(w->core[l], (op->imm2 >> 12) & 7);				\
+			if (rm[l] < 0)													\
+				goto fallback;												\
+		}																	\
+		ACTIVE_LANES														\
+		{																	\
+			CORE;															\
+			uint32_t env = fpu_enter(rm[l]);								\
+			volatile float result = (semantics);							\
+			fpu_leave(core, env);											\
+			core->f[op->rd] = fpu_bits(result);								\
+		}																	\
+		op++;																\
+		continue;
+#define SIMT_FBITS(id, semantics) \
+	case OPK_##id: ACTIVE_LANES { CORE; core->f[op->rd] = (semantics); } op++; continue;
+#define SIMT_FTOX(id, semantics)											\
+	case OPK_##id:															\
+		ACTIVE_LANES														\
+		{																	\
+			rm[l] = fpu_rm(w->core[l], (op->imm2 >> 12) & 7);				\
+			if (rm[l] < 0)													\
+				goto fallback;												\
+		}																	\
+		ACTIVE_LANES														\
+		{																	\
+			CORE;															\
+			x[op->rd][l] = (semantics);										\
+		}																	\
+		op++;																\
+		continue;
+#define SIMT_CSR(id, semantics)												\
+	case OPK_##id:															\
+		ACTIVE_LANES														\
+		{																	\
+			CORE;															\
+			uint32_t csr;													\
+			uint32_t number = op->imm2 >> 20;								\
+			if (fpu_csr_read(core, number, &csr) ||							\
+				fpu_csr_write(core, number, (semantics)))					\
+				goto fallback; /* the number is unknown, the same for every lane */ \
+			x[op->rd][l] = csr;												\
+		}																	\
+		op++;																\
+		continue;
+
+#define SIMT_CASE(id, mnemonic, format, class, match, mask, semantics) SIMT_##class(id, semantics)
+
+// Address of a predecoded instruction
+#define OP_PC(op) (ROM_BASE + (uint32_t)((op) - b->code->rom) * 4)
+
+// Run the lanes of active, all at pc in ROM, to the end of the block or to
+// join, where lanes left behind wait for them
+// Lanes that fault stop where they are, the others get the pc they go on at.
+// Returns the address of the last instruction when the block ended on a
+// jump or branch, 0 otherwise.
+static uint32_t warp_block(rv32batch *b, rv32warp *w, uint32_t pc, const uint32_t *active, uint32_t join)
+{
+	uint32_t (*x)[SIMT_WIDTH] = w->x;
+	uint32_t m[SIMT_WIDTH]; // ~0 for the lanes running the block
+	uint32_t v[SIMT_WIDTH];
+	uint32_t t[SIMT_WIDTH];
+	int rm[SIMT_WIDTH]; // rounding mode of each lane, for the F instructions
+	uint32_t ran; // instructions each lane ran
+	int jumped = 1;
+	int n = 0;
+
+	LANES
+	{
+		m[l] = active[l];
+		n += m[l] & 1;
+	}
+
+	rv32op *start = &b->code->rom[(pc - ROM_BASE) >> 2];
+	rv32op *op = start;
+	rv32op *stop = join - ROM_BASE < ROM_SIZE ? &b->code->rom[(join - ROM_BASE) >> 2] : NULL;
+
+	for (;;)
+	{
+		if (op == stop) // the paths join here, end the block before it
+		{
+			LANES v[l] = join;
+			ran = op - start;
+			jumped = 0;
+			goto exit;
+		}
+
+		switch (op->kind)
+		{
+
+		RV32_ISA(SIMT_CASE)
+
+		case OPK_LUI: LANES v[l] = op->imm; WRITE(op->rd); op++; continue;
+
+		// Fused pairs
+		case OPK_CONST2:
+			LANES v[l] = op->imm;
+			WRITE(op->rd);
+			LANES v[l] = op->imm2;
+			WRITE(op->rd2);
+			op += 2;
+			continue;
+
+		case OPK_CONST_LW:
+			LANES v[l] = op->imm;
+			WRITE(op->rd);
+			ACTIVE_LANES
+			{
+				w->core[l]->inst_count = w->count[l];
+				x[op->rd2][l] = engine_load(w->core[l], op->imm2, OPK_LW, op - start + 1);
+			}
+			op += 2;
+			continue;
+
+		case OPK_SLLI_SRLI: LANES v[l] = (RS1 << op->imm) >> op->imm2; WRITE(op->rd); op += 2; continue;
+		case OPK_SLLI_SRAI: LANES v[l] = (int32_t)(RS1 << op->imm) >> op->imm2; WRITE(op->rd); op += 2; continue;
+
+		// Block terminators, v gets the pc each lane goes on at
+		case OPK_JAL:
+			LANES t[l] = OP_PC(op) + 4;
+			LANES v[l] = op->imm;
+			WRITE_FROM(op->rd, t);
+			goto block_end;
+
+		case OPK_JALR:
+			LANES t[l] = OP_PC(op) + 4;
+			LANES v[l] = (RS1 + op->imm) & 0xFFFFFFFE;
+			WRITE_FROM(op->rd, t);
+			goto block_end;
+
+		case OPK_CALL:
+			LANES t[l] = op->imm;
+			WRITE_FROM(op->rd, t);
+			LANES t[l] = OP_PC(op) + 8;
+			WRITE_FROM(op->rd2, t);
+			LANES v[l] = op->imm2;
+			goto block_end;
+
+		case OPK_SLT_BR:   LANES t[l] = (int32_t)RS1 < (int32_t)RS2; goto set_branch;
+		case OPK_SLTU_BR:  LANES t[l] = RS1 < RS2; goto set_branch;
+		case OPK_SLTI_BR:  LANES t[l] = (int32_t)RS1 < (int32_t)op->imm; goto set_branch;
+		case OPK_SLTIU_BR: LANES t[l] = RS1 < op->imm; goto set_branch;
+		set_branch:
+			LANES v[l] = (t[l] == op->flags) ? op->imm2 : OP_PC(op) + 8;
+			WRITE_FROM(op->rd, t);
+			goto block_end;
+
+		default: // OPK_FALLBACK, each lane runs it on the reference interpreter
+		fallback: // from the cases generated above, for the faults rv32_execute reports
+			ACTIVE_LANES
+			{
+				w->count[l] += op - start;
+				w->pc[l] = OP_PC(op);
+				lane_step(w, l);
+			}
+			b->warp_insts += (op - start) + 1;
+			b->lane_insts += ((op - start) + 1) * n;
+			return 0;
+		}
+	}
+
+block_end:
+	ran = (op - start) + op->len;
+exit:
+	LANES
+	{
+		w->pc[l] = (v[l] & m[l]) | (w->pc[l] & ~m[l]);
+		w->count[l] += ran & m[l];
+	}
+	b->warp_insts += ran;
+	b->lane_insts += (uint64_t)ran * n;
+	return jumped ? pc + 4 * (ran - 1) : 0;
+}
+
+// Kind of the loop at pc, which is the same for every lane as they share the
+// ROM, so the first lane to jump back there works it out for all of them
+static int loop_kind(rv32batch *b, rv32warp *w, int l, uint32_t pc)
+{
+	if (pc - ROM_BASE >= ROM_SIZE || (pc & 0b11))
+		return IDLE_NONE;
+
+	uint8_t *kind = &b->loop_kind[(pc - ROM_BASE) >> 2];
+	if (*kind == IDLE_UNKNOWN)
+		*kind = idle_kind(w->core[l], pc);
+	return *kind;
+}
+
+// Run a warp until all its lanes are done
+static void warp_run(rv32batch *b, rv32warp *w)
+{
+	for (;;)
+	{
+		// The lanes furthest behind go first, up to where the next ones wait
+		uint32_t pc = 0xFFFFFFFF;
+		uint32_t ahead = 0;
+		int running = 0;
+		for (int l = 0; l < SIMT_WIDTH; l++)
+		{
+			uint32_t at = w->pc[l] | ~w->running[l];
+			pc = at < pc ? at : pc;
+			at = w->pc[l] & w->running[l];
+			ahead = at > ahead ? at : ahead;
+			running += w->running[l] & 1;
+		}
+
+		if (!running)
+			return;
+
+		uint32_t active[SIMT_WIDTH];
+		uint32_t join = 0xFFFFFFFF;
+		if (pc == ahead) // all at the same pc, nothing to join
+			memcpy(active, w->running, sizeof(active));
+		else
+		{
+			for (int l = 0; l < SIMT_WIDTH; l++)
+			{
+				active[l] = w->running[l] & -(uint32_t)(w->pc[l] == pc);
+				uint32_t at = w->pc[l] | ~w->running[l] | active[l];
+				join = at < join ? at : join;
+			}
+		}
+
+		if (running == 1 || pc - ROM_BASE >= ROM_SIZE || (pc & 0b11))
+		{
+			// Alone, or in RAM code or about to fault: on its own from here
+			for (int l = 0; l < SIMT_WIDTH; l++)
+			{
+				if (active[l])
+					lane_split(b, w, l);
+			}
+			continue;
+		}
+
+		// Lanes jumping back to a loop that only counts get it fast-forwarded
+		// on their own
+		uint32_t last = warp_block(b, w, pc, active, join);
+		if (!last)
+			continue;
+		for (int l = 0; l < SIMT_WIDTH; l++)
+		{
+			if (active[l] && w->running[l] && w->pc[l] <= last && loop_kind(b, w, l, w->pc[l]) == IDLE_COUNTER)
+				lane_split(b, w, l);
+		}
+	}
+}
+
+#undef RS1
+#undef RS2
+#undef IMM
+#undef F1
+#undef F2
+#undef F3
+#undef FB1
+#undef FB2
+#undef RM
+#undef CSR
+
+// Batch of lanes running image, with the inputs listed in file list
+int simt_start(rv32batch *b, rv32core *image, rv32code *code, const char *list)
+{
+	memset(b, 0, sizeof(rv32batch));
+	b->image = image;
+	b->code = code;
+	b->list = fopen(list, "r");
+	b->scalar = malloc(sizeof(rv32code));
+	if (b->list == NULL || b->scalar == NULL)
+	{
+		simt_stop(b);
+		return -1;
+	}
+
+	for (int l = 0; l < SIMT_WIDTH; l++)
+	{
+		b->warp.core[l] = malloc(sizeof(rv32core));
+		if (b->warp.core[l] == NULL)
+		{
+			simt_stop(b);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void simt_stop(rv32batch *b)
+{
+	for (int l = 0; l < SIMT_WIDTH; l++)
+	{
+		if (b->warp.core[l])
+			input_free(b->warp.core[l]);
+		free(b->warp.core[l]);
+		free(b->warp.lane[l].input);
+		free(b->warp.lane[l].out);
+		b->warp.core[l] = NULL;
+		b->warp.lane[l].input = NULL;
+		b->warp.lane[l].out = NULL;
+	}
+	free(b->scalar);
+	b->scalar = NULL;
+	if (b->list)
+		fclose(b->list);
+	b->list = NULL;
+}
+
+// Next warp of lanes, from the next lines of the list
+// Returns -1 if an input can't be read, leaving that lane out.
+static int warp_fill(rv32batch *b, rv32warp *w)
+{
+	char line[1024];
+	int status = 0;
+
+	w->lanes = 0;
+	while (w->lanes < SIMT_WIDTH && fgets(line, sizeof(line), b->list))
+	{
+		line[strcspn(line, "\r\n")] = 0;
+		if (!line[0])
+			continue;
+
+		int l = w->lanes;
+		rv32core *core = w->core[l];
+		ram_clear(core);
+		core_reset(core);
+		memcpy(core->rom, b->image->rom, ROM_SIZE);
+		if (input_load(core, line))
+		{
+			printf("Can't read input %s\n", line);
+			status = -1;
+			continue;
+		}
+		core->code = b->code;
+		core->lane = &w->lane[l];
+		core->tier = TIER_FAST;
+
+		free(w->lane[l].input);
+		w->lane[l].input = malloc(strlen(line) + 1);
+		if (w->lane[l].input)
+			strcpy(w->lane[l].input, line);
+		w->lane[l].len = 0;
+
+		lane_load(w, l);
+		w->x[REG_SINK][l] = 0;
+		w->running[l] = 0xFFFFFFFF;
+		w->fault[l] = 0;
+		w->lanes++;
+	}
+
+	// Unused lanes are done from the start
+	for (int l = w->lanes; l < SIMT_WIDTH; l++)
+		w->running[l] = 0;
+	return status;
+}
+
+// Run every lane of the list, reporting each to out as its warp finishes
+// Returns -1 if any input couldn't be read.
+int simt_run(rv32batch *b, FILE *out)
+{
+	rv32warp *w = &b->warp;
+	int status = 0;
+
+	b->start = telemetry_now();
+	for (;;)
+	{
+		if (warp_fill(b, w))
+			status = -1;
+		if (!w->lanes)
+			break;
+
+		warp_run(b, w);
+
+		for (int l = 0; l < w->lanes; l++)
+		{
+			rv32lane *lane = &w->lane[l];
+			fprintf(out, "== lane %llu: %s ==\n", (unsigned long long)b->lanes, lane->input ? lane->input : "");
+			fwrite(lane->out, 1, lane->len, out);
+			if (lane->len && lane->out[lane->len - 1] != '\n')
+				fprintf(out, "\n");
+			fprintf(out, "%s, executed %llu instructions\n", fault_name(w->fault[l]),
+					(unsigned long long)(w->count[l] - 1));
+
+			b->insts += w->count[l];
+			b->lanes++;
+		}
+	}
+	return status;
+}
+
+void simt_report(rv32batch *b, FILE *out)
+{
+	double elapsed = telemetry_now() - b->start;
+
+	fprintf(out, "Ran %llu lanes, %llu instructions in %.3f s, %.2f MIPS\n", (unsigned long long)b->lanes,
+			(unsigned long long)b->insts, elapsed, elapsed > 0 ? b->insts / elapsed / 1e6 : 0.0);
+	fprintf(out, "Warps issued %llu instructions, for %.2f of %d lanes on average; %llu ran split off\n",
+			(unsigned long long)b->warp_insts, b->warp_insts ? (double)b->lane_insts / b->warp_insts : 0.0,
+			SIMT_WIDTH, (unsigned long long)b->scalar_insts);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "rv32i.h"
+#include "decode.h"
+
+// Batch execution
+// One program run over many inputs, a lane per input. Lanes are grouped in
+// warps of SIMT_WIDTH that run in lockstep over the ROM, decoded once for
+// all of them. The integer registers of a warp are kept register by
+// register, one row holding the value of every lane, so an instruction is a
+// short loop over the lanes the compiler turns into SIMD code. Memory and
+// the F registers stay in each lane's own core.
+//
+// When a branch sends lanes different ways the warp runs the lanes with the
+// lowest pc, masking the others: the ones left behind catch up and the warp
+// reconverges where the paths join. A lane left running alone in its warp,
+// leaving ROM or entering a spin loop is split off and finished on the
+// scalar engine, which fast-forwards the loop.
+
+#define SIMT_WIDTH 16 // lanes run in lockstep
+
+// A lane's UART output, kept until the lane is reported
+struct rv32lane
+{
+	char *input; // file the input came from
+	char *out;
+	size_t len;
+	size_t cap;
+};
+typedef struct rv32lane rv32lane;
+
+struct rv32warp
+{
+	uint32_t x[32 + 1][SIMT_WIDTH]; // x[register][lane], the sink register included
+	uint32_t pc[SIMT_WIDTH];
+	uint32_t running[SIMT_WIDTH]; // ~0 for lanes still running, 0 once done
+	uint64_t count[SIMT_WIDTH];	  // instructions run, core->inst_count while in the warp
+	int fault[SIMT_WIDTH];
+	rv32core *core[SIMT_WIDTH]; // memory and F registers of each lane
+	rv32lane lane[SIMT_WIDTH];
+	int lanes; // lanes in use, the last warp of a batch may not be full
+};
+typedef struct rv32warp rv32warp;
+
+struct rv32batch
+{
+	rv32core *image; // core the program was loaded in, every lane starts as a copy
+	rv32code *code;	 // the ROM decoded for every lane
+	rv32code *scalar; // code of a lane split off
+	uint8_t loop_kind[ROM_SIZE / 4]; // idle_kind of the loop at each ROM pc, IDLE_UNKNOWN until a lane jumps there
+	rv32warp warp;
+	FILE *list; // input files, one per line
+
+	uint64_t lanes;
+	uint64_t insts;		   // instructions run by all lanes
+	uint64_t warp_insts;   // instructions issued by warps
+	uint64_t lane_insts;   // instructions they ran, counted per lane
+	uint64_t scalar_insts; // instructions of lanes split off
+	double start;
+};
+typedef struct rv32batch rv32batch;
+
+int simt_start(rv32batch *b, rv32core *image, rv32code *code, const char *list);
+int simt_run(rv32batch *b, FILE *out);
+void simt_report(rv32batch *b, FILE *out);
+void simt_stop(rv32batch *b);
+
+void simt_output(rv32lane *lane, uint32_t c);
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rv32i.h"
+#include "instructions.h"
+#include "opcodes.h"
+#include "isa.h"
+#include "profile.h"
+#include "stats.h"
+
+#ifdef RV32_STATS
+
+// Instructions are counted by their id in isa.h, ISA_UNKNOWN included
+#define M_COUNT (ISA_COUNT + 1)
+
+static const char *mnemonic_name(int m)
+{
+	return m == ISA_UNKNOWN ? "unknown" : isa_table[m].mnemonic;
+}
+
+// Instruction classes, named after their opcode in opcodes.h
+enum
+{
+	C_LUI, C_AUIPC, C_IMM, C_OP, C_M, C_B, C_JAL, C_JALR, C_BRANCH, C_LOAD, C_STORE, C_F, C_CSR, C_UNKNOWN,
+	C_COUNT
+};
+
+static const char *class_names[C_COUNT] = {
+	"OP_LUI", "OP_AUIPC", "OP_IMM", "OP_OP", "OP_OP (M)", "Zba/Zbb", "OP_JAL", "OP_JALR", "OP_BRANCH", "OP_LOAD",
+	"OP_STORE", "RV32F", "Zicsr", "unknown",
+};
+
+static int mnemonic_class(int m)
+{
+	if (m == ISA_UNKNOWN)
+		return C_UNKNOWN;
+
+	if (m >= ISA_SH1ADD && m <= ISA_REV8) // the Zba/Zbb lines of RV32_ISA
+		return C_B;
+	if (isa_class(m) >= ISA_CLASS_FLOAD && isa_class(m) <= ISA_CLASS_FTOX)
+		return C_F;
+	if (isa_class(m) == ISA_CLASS_CSR)
+		return C_CSR;
+
+	uint32_t match = isa_table[m].match;
+	switch (get_opcode(match))
+	{
+	case OP_LUI:	return C_LUI;
+	case OP_AUIPC:	return C_AUIPC;
+	case OP_IMM:	return C_IMM;
+	case OP_OP:		return get_func7(match) == 1 ? C_M : C_OP;
+	case OP_JAL:	return C_JAL;
+	case OP_JALR:	return C_JALR;
+	case OP_BRANCH: return C_BRANCH;
+	case OP_LOAD:	return C_LOAD;
+	case OP_STORE:	return C_STORE;
+	default:		return C_UNKNOWN;
+	}
+}
+
+void stats_clear(rv32stats *stats)
+{
+	memset(stats, 0, sizeof(rv32stats));
+}
+
+// Count n instructions executed in a row from pc, and the outcome of the last
+// one if it was a branch
+void stats_step(rv32core *core, uint32_t pc, uint64_t n)
+{
+	rv32stats *stats = core->stats;
+	if (!n)
+		return;
+	profile_range(&stats->counts, pc, n, 1);
+
+	uint32_t last = pc + 4 * (uint32_t)(n - 1);
+	if (!inMemory(last))
+		return;
+
+	uint32_t inst = mem_read_32(core, last);
+	if (get_opcode(inst) == OP_BRANCH)
+	{
+		if (core->pc != last + 4)
+			stats->taken[get_func3(inst)]++;
+		else
+			stats->not_taken[get_func3(inst)]++;
+	}
+}
+
+// Count the iterations of the loop at top the spin-loop skipper just skipped
+void stats_loop(rv32core *core, uint32_t top, uint64_t skipped)
+{
+	rv32stats *stats = core->stats;
+	idle_loop *loop = idle_slot(&core->idle, top);
+	uint64_t iterations = skipped / loop->len;
+	uint64_t exited = (core->pc != top); // the last iteration fell through
+
+	profile_range(&stats->counts, top, loop->len, iterations);
+	stats->skipped += skipped;
+
+	uint32_t inst = mem_read_32(core, top + 4 * (loop->len - 1));
+	if (get_opcode(inst) == OP_BRANCH)
+	{
+		stats->taken[get_func3(inst)] += iterations - exited;
+		stats->not_taken[get_func3(inst)] += exited;
+	}
+
+	// Skippable loops don't store, and their loads go where they did last time
+	for (int i = 0; i < loop->len; i++)
+	{
+		inst = mem_read_32(core, top + 4 * i);
+		if (isa_class(isa_decode(inst)) != ISA_CLASS_LOAD)
+			continue;
+
+		uint32_t addr = core->x[get_rs1(inst)] + signextend_12(imm_type_i(inst));
+		if (!inMemory(addr))
+			stats->mmio_loads += iterations;
+		else if (inROM(addr))
+			stats->rom_loads += iterations;
+		else
+			stats->ram_loads += iterations;
+	}
+}
+
+// Adds up executions per mnemonic from the per-address counts
+static uint64_t count_mnemonics(rv32stats *stats, rv32core *core, uint64_t *counts)
+{
+	uint64_t total = 0;
+	memset(counts, 0, M_COUNT * sizeof(uint64_t));
+
+	for (int region = 0; region < 2; region++)
+	{
+		int64_t *diff = region ? stats->counts.rom : stats->counts.ram;
+		uint32_t base = region ? ROM_BASE : RAM_BASE;
+		int n = (region ? ROM_SIZE : RAM_SIZE) / 4;
+
+		int64_t count = 0;
+		for (int i = 0; i < n; i++)
+		{
+			count += diff[i];
+			if (count > 0)
+			{
+				counts[isa_decode(mem_read_32(core, base + 4 * i))] += count;
+				total += count;
+			}
+		}
+	}
+	return total;
+}
+
+static double percent(uint64_t count, uint64_t total)
+{
+	return total ? 100.0 * count / total : 0.0;
+}
+
+static const int branch_mnemonics[6] = {ISA_BEQ, ISA_BNE, ISA_BLT, ISA_BGE, ISA_BLTU, ISA_BGEU};
+static const int branch_func3[6] = {BEQ, BNE, BLT, BGE, BLTU, BGEU};
+
+static void report_text(rv32stats *stats, FILE *out, uint64_t *counts, uint64_t *classes, uint64_t total)
+{
+	fprintf(out, "Instruction mix of %llu instructions (%llu fast-forwarded)\n",
+			(unsigned long long)total, (unsigned long long)stats->skipped);
+
+	fprintf(out, "\nBy class\n");
+	for (int c = 0; c < C_COUNT; c++)
+	{
+		if (classes[c])
+			fprintf(out, "  %-10s %14llu %6.2f%%\n", class_names[c], (unsigned long long)classes[c], percent(classes[c], total));
+	}
+
+	// Most executed first
+	int order[M_COUNT];
+	for (int i = 0; i < M_COUNT; i++)
+		order[i] = i;
+	for (int i = 1; i < M_COUNT; i++)
+	{
+		for (int j = i; j > 0 && counts[order[j]] > counts[order[j - 1]]; j--)
+		{
+			int t = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = t;
+		}
+	}
+
+	fprintf(out, "\nBy mnemonic\n");
+	for (int i = 0; i < M_COUNT && counts[order[i]]; i++)
+		fprintf(out, "  %-10s %14llu %6.2f%%\n", mnemonic_name(order[i]), (unsigned long long)counts[order[i]],
+				percent(counts[order[i]], total));
+
+	fprintf(out, "\nBranches %14s %14s\n", "taken", "not taken");
+	uint64_t taken = 0, not_taken = 0;
+	for (int i = 0; i < 6; i++)
+	{
+		uint64_t t = stats->taken[branch_func3[i]], n = stats->not_taken[branch_func3[i]];
+		taken += t;
+		not_taken += n;
+		if (t + n)
+			fprintf(out, "  %-6s %14llu %14llu %6.2f%% taken\n", mnemonic_name(branch_mnemonics[i]),
+					(unsigned long long)t, (unsigned long long)n, percent(t, t + n));
+	}
+	fprintf(out, "  %-6s %14llu %14llu %6.2f%% taken\n", "all", (unsigned long long)taken,
+			(unsigned long long)not_taken, percent(taken, taken + not_taken));
+
+	fprintf(out, "\nAccess widths %11s %14s %14s\n", "byte", "half", "word");
+	fprintf(out, "  loads  %18llu %14llu %14llu\n", (unsigned long long)(counts[ISA_LB] + counts[ISA_LBU]),
+			(unsigned long long)(counts[ISA_LH] + counts[ISA_LHU]), (unsigned long long)counts[ISA_LW]);
+	fprintf(out, "  stores %18llu %14llu %14llu\n", (unsigned long long)counts[ISA_SB],
+			(unsigned long long)counts[ISA_SH], (unsigned long long)counts[ISA_SW]);
+
+	fprintf(out, "\nAccesses performed %6s %14s %14s\n", "RAM", "ROM", "MMIO");
+	fprintf(out, "  loads  %18llu %14llu %14llu\n", (unsigned long long)stats->ram_loads,
+			(unsigned long long)stats->rom_loads, (unsigned long long)stats->mmio_loads);
+	fprintf(out, "  stores %18llu %14s %14llu\n", (unsigned long long)stats->ram_stores, "-",
+			(unsigned long long)stats->mmio_stores);
+}
+
+static void report_json(rv32stats *stats, FILE *out, uint64_t *counts, uint64_t *classes, uint64_t total)
+{
+	fprintf(out, "{\n  \"instructions\": %llu,\n  \"fast_forwarded\": %llu,\n",
+			(unsigned long long)total, (unsigned long long)stats->skipped);
+
+	fprintf(out, "  \"classes\": {");
+	for (int c = 0, first = 1; c < C_COUNT; c++)
+	{
+		if (!classes[c])
+			continue;
+		fprintf(out, "%s\n    \"%s\": %llu", first ? "" : ",", class_names[c], (unsigned long long)classes[c]);
+		first = 0;
+	}
+	fprintf(out, "\n  },\n");
+
+	fprintf(out, "  \"mnemonics\": {");
+	for (int m = 0, first = 1; m < M_COUNT; m++)
+	{
+		if (!counts[m])
+			continue;
+		fprintf(out, "%s\n    \"%s\": %llu", first ? "" : ",", mnemonic_name(m), (unsigned long long)counts[m]);
+		first = 0;
+	}
+	fprintf(out, "\n  },\n");
+
+	fprintf(out, "  \"branches\": {");
+	for (int i = 0; i < 6; i++)
+		fprintf(out, "%s\n    \"%s\": {\"taken\": %llu, \"not_taken\": %llu}", i ? "," : "",
+				mnemonic_name(branch_mnemonics[i]), (unsigned long long)stats->taken[branch_func3[i]],
+				(unsigned long long)stats->not_taken[branch_func3[i]]);
+	fprintf(out, "\n  },\n");
+
+	fprintf(out, "  \"load_widths\": {\"byte\": %llu, \"half\": %llu, \"word\": %llu},\n",
+			(unsigned long long)(counts[ISA_LB] + counts[ISA_LBU]), (unsigned long long)(counts[ISA_LH] + counts[ISA_LHU]),
+			(unsigned long long)counts[ISA_LW]);
+	fprintf(out, "  \"store_widths\": {\"byte\": %llu, \"half\": %llu, \"word\": %llu},\n",
+			(unsigned long long)counts[ISA_SB], (unsigned long long)counts[ISA_SH], (unsigned long long)counts[ISA_SW]);
+
+	fprintf(out, "  \"loads\": {\"ram\": %llu, \"rom\": %llu, \"mmio\": %llu},\n", (unsigned long long)stats->ram_loads,
+			(unsigned long long)stats->rom_loads, (unsigned long long)stats->mmio_loads);
+	fprintf(out, "  \"stores\": {\"ram\": %llu, \"mmio\": %llu}\n}\n", (unsigned long long)stats->ram_stores,
+			(unsigned long long)stats->mmio_stores);
+}
+
+// Write the statistics, as text or as a JSON object
+void stats_report(rv32stats *stats, rv32core *core, FILE *out, int json)
+{
+	uint64_t counts[M_COUNT];
+	uint64_t classes[C_COUNT] = {0};
+	uint64_t total = count_mnemonics(stats, core, counts);
+	for (int m = 0; m < M_COUNT; m++)
+		classes[mnemonic_class(m)] += counts[m];
+
+	if (json)
+		report_json(stats, out, counts, classes, total);
+	else
+		report_text(stats, out, counts, classes, total);
+}
+
+#endif
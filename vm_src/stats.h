@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "rv32i.h"
+#include "profile.h"
+
+// Instruction mix statistics
+// Only built with -DRV32_STATS (make emulator_stats). Instructions are counted
+// per address the way the profiler does it and classified by mnemonic at exit,
+// so RAM code rewritten during the run is reported as it was last written.
+// Branch outcomes are taken from the instruction ending each executed run,
+// memory accesses are counted where the engines perform them. Loads in loop
+// iterations fast-forwarded by the spin-loop skipper are counted by the
+// address they had in the last iteration that really ran.
+
+#ifdef RV32_STATS
+
+struct rv32stats
+{
+	rv32profile counts; // executions per address
+
+	uint64_t taken[8]; // by branch func3
+	uint64_t not_taken[8];
+	uint64_t skipped; // instructions fast-forwarded
+
+	uint64_t ram_loads;
+	uint64_t rom_loads;
+	uint64_t mmio_loads;
+	uint64_t ram_stores;
+	uint64_t mmio_stores;
+};
+typedef struct rv32stats rv32stats;
+
+#define STATS_COUNT(core, field) \
+	do { if ((core)->stats) (core)->stats->field++; } while (0)
+
+void stats_clear(rv32stats *stats);
+void stats_step(rv32core *core, uint32_t pc, uint64_t n);
+void stats_loop(rv32core *core, uint32_t top, uint64_t skipped);
+void stats_report(rv32stats *stats, rv32core *core, FILE *out, int json);
+
+#else
+
+#define STATS_COUNT(core, field) ((void)0)
+
+#endif
@@ -0,0 +1,225 @@
+#define _CRT_SECURE_NO_WARNINGS // allow building on MSVC
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "rv32i.h"
+#include "events.h"
+#include "telemetry.h"
+
+static const char *tier_names[TIER_COUNT] = {"reference", "fast", "events", "decode"};
+
+// Telemetry the signal handlers report to
+static rv32telemetry *active;
+static volatile sig_atomic_t snapshot_requested;
+
+// Host time in seconds, from an arbitrary start
+double telemetry_now(void)
+{
+	struct timespec ts;
+#ifdef _WIN32
+	timespec_get(&ts, TIME_UTC);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#ifndef _WIN32
+static void on_sigprof(int sig)
+{
+	(void)sig;
+	if (active)
+		active->samples[active->core->tier]++;
+}
+
+static void on_sigusr1(int sig)
+{
+	(void)sig;
+	snapshot_requested = 1;
+}
+
+// Connects to a listening Unix stream socket
+static FILE *open_socket(const char *path)
+{
+	struct sockaddr_un addr;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return NULL;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return NULL;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	FILE *f = fdopen(fd, "w");
+	if (f == NULL)
+		close(fd);
+	return f;
+}
+#endif
+
+// Device event checking for due snapshots every TELEMETRY_CHECK instructions
+static int telemetry_check(rv32core *core, void *ctx)
+{
+	rv32telemetry *t = ctx;
+
+	if (snapshot_requested || (t->interval > 0 && telemetry_now() >= t->next_time))
+	{
+		snapshot_requested = 0;
+		telemetry_snapshot(t);
+		while (t->interval > 0 && t->next_time <= t->last_time)
+			t->next_time += t->interval;
+	}
+
+	return events_schedule(&core->events, core->inst_count + TELEMETRY_CHECK, telemetry_check, t);
+}
+
+// Start timing the run of core
+// dest is a file to append snapshots to, "unix:<path>" for a socket, or NULL
+// for stderr. Returns -1 if dest can't be opened.
+int telemetry_start(rv32telemetry *t, rv32core *core, double interval, const char *dest)
+{
+	memset(t, 0, sizeof(rv32telemetry));
+	t->core = core;
+	t->start = telemetry_now();
+	t->interval = interval;
+	t->next_time = t->start + interval;
+	t->last_time = t->start;
+	t->last_count = core->inst_count;
+	t->out = stderr;
+
+	if (dest && !strncmp(dest, "unix:", 5))
+	{
+#ifndef _WIN32
+		t->out = open_socket(dest + 5);
+#else
+		t->out = NULL;
+#endif
+	}
+	else if (dest)
+		t->out = fopen(dest, "a");
+	if (t->out == NULL)
+		return -1;
+
+	active = t;
+
+#ifndef _WIN32
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+
+	sa.sa_handler = on_sigprof;
+	sigaction(SIGPROF, &sa, NULL);
+	sa.sa_handler = on_sigusr1;
+	sigaction(SIGUSR1, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN); // a closed socket shows up as a write error instead
+
+	struct itimerval timer = {{0, 1000}, {0, 1000}}; // a sample per millisecond of CPU time
+	setitimer(ITIMER_PROF, &timer, NULL);
+#endif
+
+	return events_schedule(&core->events, core->inst_count + TELEMETRY_CHECK, telemetry_check, t);
+}
+
+void telemetry_stop(rv32telemetry *t)
+{
+#ifndef _WIN32
+	struct itimerval timer = {{0, 0}, {0, 0}};
+	setitimer(ITIMER_PROF, &timer, NULL);
+#endif
+	events_cancel(&t->core->events, telemetry_check, t);
+	active = NULL;
+
+	if (t->out && t->out != stderr)
+		fclose(t->out);
+	t->out = NULL;
+}
+
+static uint64_t total_samples(rv32telemetry *t)
+{
+	uint64_t total = 0;
+	for (int i = 0; i < TIER_COUNT; i++)
+		total += t->samples[i];
+	return total;
+}
+
+// Write a snapshot of the run so far
+void telemetry_snapshot(rv32telemetry *t)
+{
+	double time = telemetry_now();
+	uint64_t count = t->core->inst_count;
+	double elapsed = time - t->start;
+	double since = time - t->last_time;
+
+	if (t->out == NULL)
+		return;
+
+	fprintf(t->out, "{\"time\": %.3f, \"instructions\": %llu, \"fast_forwarded\": %llu, \"mips\": %.2f, \"interval_mips\": %.2f",
+			elapsed, (unsigned long long)count, (unsigned long long)t->core->idle.skipped,
+			elapsed > 0 ? count / elapsed / 1e6 : 0.0, since > 0 ? (count - t->last_count) / since / 1e6 : 0.0);
+
+	uint64_t total = total_samples(t);
+	fprintf(t->out, ", \"tiers\": {");
+	for (int i = 0; i < TIER_COUNT; i++)
+		fprintf(t->out, "%s\"%s\": %.4f", i ? ", " : "", tier_names[i], total ? (double)t->samples[i] / total : 0.0);
+	fprintf(t->out, "}, \"pc\": \"0x%08x\", \"pending_events\": %d}\n", t->core->pc, t->core->events.count);
+
+	if (fflush(t->out) != 0)
+	{
+		// Nobody is listening any more
+		if (t->out != stderr)
+			fclose(t->out);
+		t->out = NULL;
+	}
+
+	t->last_time = time;
+	t->last_count = count;
+}
+
+// Summary of the whole run
+void telemetry_report(rv32telemetry *t, FILE *out)
+{
+	double elapsed = telemetry_now() - t->start;
+	uint64_t count = t->core->inst_count;
+	uint64_t skipped = t->core->idle.skipped;
+
+	fprintf(out, "Wall time %.3f s, %.2f MIPS", elapsed, elapsed > 0 ? count / elapsed / 1e6 : 0.0);
+	if (skipped)
+		fprintf(out, " (%.2f MIPS without fast-forwarded loops)", elapsed > 0 ? (count - skipped) / elapsed / 1e6 : 0.0);
+	fprintf(out, "\n");
+
+	uint64_t total = total_samples(t);
+	if (total)
+	{
+		fprintf(out, "Time per tier:");
+		for (int i = 0; i < TIER_COUNT; i++)
+		{
+			if (t->samples[i])
+				fprintf(out, " %s %.1f%%", tier_names[i], 100.0 * t->samples[i] / total);
+		}
+		fprintf(out, "\n");
+	}
+}
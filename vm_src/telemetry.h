@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "rv32i.h"
+
+// Run telemetry
+// Host wall time, guest MIPS and the share of time spent in each engine
+// tier, reported at exit and in periodic snapshots. The tier the core is in
+// (core->tier) is sampled by a profiling timer, so tracking it costs a store
+// at each tier switch and nothing per instruction. Snapshots are one JSON
+// object per line, written every interval seconds and whenever the process
+// gets SIGUSR1, to a file or a Unix socket ("unix:<path>").
+
+// Instructions between checks for a due snapshot
+#define TELEMETRY_CHECK (1 << 20)
+
+struct rv32telemetry
+{
+	rv32core *core;
+
+	double start;	  // host time the run started, in seconds
+	double interval;  // seconds between snapshots, 0 for SIGUSR1 only
+	double next_time; // next periodic snapshot
+
+	double last_time; // previous snapshot
+	uint64_t last_count;
+
+	FILE *out; // snapshot destination
+	volatile uint64_t samples[TIER_COUNT]; // profiling timer ticks per tier
+};
+typedef struct rv32telemetry rv32telemetry;
+
+int telemetry_start(rv32telemetry *t, rv32core *core, double interval, const char *dest);
+void telemetry_stop(rv32telemetry *t);
+void telemetry_snapshot(rv32telemetry *t);
+void telemetry_report(rv32telemetry *t, FILE *out);
+
+double telemetry_now(void);
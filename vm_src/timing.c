@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "rv32i.h"
+#include "instructions.h"
+#include "isa.h"
+#include "elfsym.h"
+#include "profile.h"
+#include "timing.h"
+
+// Presets
+// The figures come from each core's documentation where it gives them and
+// are rounded guesses otherwise, for the configurations named; they are a
+// starting point to adjust with key=value.
+static const timing_model presets[] = {
+	// lowRISC Ibex, 2 stages, fast multiplier
+	{.name = "ibex", .mhz = 50, .alu = 1, .mul = 3, .div = 37, .load = 2, .store = 2, .branch = 1, .jal = 2,
+	 .jalr = 2, .fpu = 1, .fdiv = 1, .csr = 1, .taken = 2, .flash_line = 4},
+	// OpenHW CV32E40P, 4 stages, with its FPU
+	{.name = "cv32e40p", .mhz = 100, .alu = 1, .mul = 1, .div = 35, .load = 1, .store = 1, .branch = 1, .jal = 2,
+	 .jalr = 2, .fpu = 1, .fdiv = 12, .csr = 1, .taken = 2, .load_use = 1, .flash_line = 4},
+	// SiFive E31, 5 stages, code in its instruction cache
+	{.name = "e31", .mhz = 320, .alu = 1, .mul = 1, .div = 33, .load = 1, .store = 1, .branch = 1, .jal = 1,
+	 .jalr = 2, .fpu = 1, .fdiv = 1, .csr = 1, .taken = 1, .load_use = 1, .flash_line = 4},
+	// PicoRV32, not pipelined, with the PCPI multiplier and divider
+	{.name = "picorv32", .mhz = 50, .alu = 3, .mul = 40, .div = 40, .load = 5, .store = 5, .branch = 3, .jal = 3,
+	 .jalr = 6, .fpu = 3, .fdiv = 3, .csr = 3, .taken = 2, .flash_line = 4},
+	// SERV, bit-serial, with its MDU
+	{.name = "serv", .mhz = 50, .alu = 35, .mul = 70, .div = 70, .load = 70, .store = 70, .branch = 67, .jal = 67,
+	 .jalr = 67, .fpu = 35, .fdiv = 35, .csr = 70, .flash_line = 4},
+	// WCH QingKe V2A of the CH32V003, 2 stages at 48 MHz, one flash wait state
+	{.name = "ch32v003", .mhz = 48, .alu = 1, .mul = 1, .div = 1, .load = 2, .store = 2, .branch = 1, .jal = 2,
+	 .jalr = 2, .fpu = 1, .fdiv = 1, .csr = 1, .taken = 1, .flash = 1, .flash_line = 4},
+};
+
+#define PRESET_COUNT (int)(sizeof(presets) / sizeof(presets[0]))
+
+// Parameters that can be changed after the preset
+static const struct
+{
+	const char *key;
+	size_t offset;
+} params[] = {
+	{"alu", offsetof(timing_model, alu)},
+	{"mul", offsetof(timing_model, mul)},
+	{"div", offsetof(timing_model, div)},
+	{"load", offsetof(timing_model, load)},
+	{"store", offsetof(timing_model, store)},
+	{"branch", offsetof(timing_model, branch)},
+	{"jal", offsetof(timing_model, jal)},
+	{"jalr", offsetof(timing_model, jalr)},
+	{"fpu", offsetof(timing_model, fpu)},
+	{"fdiv", offsetof(timing_model, fdiv)},
+	{"csr", offsetof(timing_model, csr)},
+	{"taken", offsetof(timing_model, taken)},
+	{"load_use", offsetof(timing_model, load_use)},
+	{"flash", offsetof(timing_model, flash)},
+	{"flash_line", offsetof(timing_model, flash_line)},
+};
+
+#define PARAM_COUNT (int)(sizeof(params) / sizeof(params[0]))
+
+// Model from a spec "preset[,key=value...]", mhz among the keys
+// Returns -1 for an unknown preset or key.
+int timing_start(rv32timing *t, const char *spec)
+{
+	memset(t, 0, sizeof(rv32timing));
+
+	size_t len = strcspn(spec, ",");
+	int p;
+	for (p = 0; p < PRESET_COUNT && (strlen(presets[p].name) != len || strncmp(spec, presets[p].name, len)); p++)
+		;
+	if (p == PRESET_COUNT)
+		return -1;
+	t->model = presets[p];
+
+	for (spec += len; *spec == ','; spec += len)
+	{
+		spec++;
+		len = strcspn(spec, ",");
+		const char *value = memchr(spec, '=', len);
+		if (value == NULL)
+			return -1;
+		size_t key_len = value - spec;
+		char *end;
+		double v = strtod(value + 1, &end);
+		if (end != spec + len || end == value + 1 || v < 0)
+			return -1;
+
+		if (key_len == 3 && !strncmp(spec, "mhz", 3))
+		{
+			t->model.mhz = v;
+			continue;
+		}
+		int k;
+		for (k = 0; k < PARAM_COUNT && (strlen(params[k].key) != key_len || strncmp(spec, params[k].key, key_len)); k++)
+			;
+		if (k == PARAM_COUNT)
+			return -1;
+		*(uint32_t *)((char *)&t->model + params[k].offset) = (uint32_t)v;
+	}
+
+	uint32_t line = t->model.flash_line;
+	if (line < 4 || (line & (line - 1)))
+		return -1;
+	return 0;
+}
+
+// Names of the presets, for an error message
+void timing_list(FILE *out)
+{
+	for (int p = 0; p < PRESET_COUNT; p++)
+		fprintf(out, "%s%s", p ? ", " : "", presets[p].name);
+	fprintf(out, "\n");
+}
+
+// Count n instructions executed in a row from pc, and whether the last one
+// went elsewhere than the next or faulted
+void timing_step(rv32timing *t, rv32core *core, uint32_t pc, uint64_t n, int fault)
+{
+	if (!n)
+		return;
+	profile_range(&t->counts, pc, n, 1);
+
+	uint32_t last = pc + 4 * (uint32_t)(n - 1);
+	int slot = profile_slot(last);
+	if (slot >= 0 && (core->pc != last + 4 || fault))
+		t->jumped[slot]++;
+}
+
+// Count the iterations of the loop at top the spin-loop skipper just skipped
+// Every one of them jumps back from the end of the loop, but for the last
+// when the loop was left.
+void timing_loop(rv32timing *t, rv32core *core, uint32_t top, uint64_t skipped)
+{
+	idle_loop *loop = idle_slot(&core->idle, top);
+	uint64_t iterations = skipped / loop->len;
+	uint64_t exited = (core->pc != top);
+
+	profile_range(&t->counts, top, loop->len, iterations);
+	int slot = profile_slot(top + 4 * (loop->len - 1));
+	if (slot >= 0)
+		t->jumped[slot] += iterations - exited;
+}
+
+// Cycles an instruction takes, stalls aside
+static uint32_t inst_cycles(const timing_model *m, int id)
+{
+	switch (isa_class(id))
+	{
+	case ISA_CLASS_LOAD:
+	case ISA_CLASS_FLOAD:  return m->load;
+	case ISA_CLASS_STORE:
+	case ISA_CLASS_FSTORE: return m->store;
+	case ISA_CLASS_BRANCH: return m->branch;
+	case ISA_CLASS_JUMP:   return id == ISA_JAL ? m->jal : m->jalr;
+	case ISA_CLASS_FARITH: return id == ISA_FDIV_S || id == ISA_FSQRT_S ? m->fdiv : m->fpu;
+	case ISA_CLASS_FBITS:
+	case ISA_CLASS_FTOX:   return m->fpu;
+	case ISA_CLASS_CSR:	   return m->csr;
+	default:
+		if (id >= ISA_MUL && id <= ISA_MULHU)
+			return m->mul;
+		if (id >= ISA_DIV && id <= ISA_REMU)
+			return m->div;
+		return m->alu;
+	}
+}
+
+// Whether next reads the register the load before it writes
+static int uses_load(uint32_t load, uint32_t next)
+{
+	int id = isa_decode(load);
+	int next_id = isa_decode(next);
+	uint32_t rd = get_rd(load);
+	if (next_id == ISA_UNKNOWN)
+		return 0;
+	int format = isa_table[next_id].format;
+
+	if (isa_class(id) == ISA_CLASS_LOAD)
+		return rd && ((isa_reads_rs1(format) && get_rs1(next) == rd) || (isa_reads_rs2(format) && get_rs2(next) == rd));
+
+	// flw, read by the float operands
+	switch (format)
+	{
+	case ISA_FMT_FR4:  return get_rs1(next) == rd || get_rs2(next) == rd || next >> 27 == rd;
+	case ISA_FMT_FR:
+	case ISA_FMT_FCMP: return get_rs1(next) == rd || get_rs2(next) == rd;
+	case ISA_FMT_FR1:
+	case ISA_FMT_FX:   return get_rs1(next) == rd;
+	case ISA_FMT_FS:   return get_rs2(next) == rd;
+	default:		   return 0;
+	}
+}
+
+// Instructions and cycles of an address or a function
+struct cycle_entry
+{
+	uint32_t addr;
+	const char *name;
+	uint64_t count;
+	uint64_t cycles;
+};
+typedef struct cycle_entry cycle_entry;
+
+static int more_cycles(const void *a, const void *b)
+{
+	const cycle_entry *x = a, *y = b;
+	if (x->cycles != y->cycles)
+		return x->cycles < y->cycles ? 1 : -1;
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static double percent(uint64_t count, uint64_t total)
+{
+	return total ? 100.0 * count / total : 0.0;
+}
+
+static double cpi(uint64_t cycles, uint64_t count)
+{
+	return count ? (double)cycles / count : 0.0;
+}
+
+// Write the estimate, overall and per function, most cycles first
+void timing_report(rv32timing *t, rv32core *core, FILE *out, elf_symbols *syms)
+{
+	const timing_model *m = &t->model;
+	uint64_t *counts = calloc(PROFILE_SLOTS, sizeof(uint64_t));
+	cycle_entry *funcs = malloc(PROFILE_SLOTS * sizeof(cycle_entry));
+	if (counts == NULL || funcs == NULL)
+	{
+		free(counts);
+		free(funcs);
+		return;
+	}
+
+	for (int region = 0; region < 2; region++)
+	{
+		int64_t *diff = region ? t->counts.ram : t->counts.rom;
+		int first = region ? ROM_SIZE / 4 : 0;
+		int n = region ? RAM_SIZE / 4 : ROM_SIZE / 4;
+		int64_t count = 0;
+		for (int i = 0; i < n; i++)
+		{
+			count += diff[i];
+			counts[first + i] = count > 0 ? count : 0;
+		}
+	}
+
+	uint64_t total = 0, execute = 0, taken = 0, load_use = 0, flash = 0;
+	int nfuncs = 0;
+
+	// RAM first, so addresses are in order and each function's are next to each other
+	for (int i = 0; i < PROFILE_SLOTS; i++)
+	{
+		int slot = i < RAM_SIZE / 4 ? ROM_SIZE / 4 + i : i - RAM_SIZE / 4;
+		uint64_t count = counts[slot];
+		if (!count)
+			continue;
+
+		uint32_t pc = profile_slot_pc(slot);
+		uint32_t inst = mem_read_32(core, pc);
+		int id = isa_decode(inst);
+		uint64_t cycles = count * inst_cycles(m, id);
+		execute += cycles;
+
+		if (isa_class(id) == ISA_CLASS_BRANCH)
+		{
+			taken += t->jumped[slot] * m->taken;
+			cycles += t->jumped[slot] * m->taken;
+		}
+
+		int next = profile_slot(pc + 4);
+		if ((isa_class(id) == ISA_CLASS_LOAD || isa_class(id) == ISA_CLASS_FLOAD) && next == slot + 1 &&
+			uses_load(inst, mem_read_32(core, pc + 4)))
+		{
+			load_use += count * m->load_use;
+			cycles += count * m->load_use;
+		}
+
+		if (inROM(pc) && m->flash)
+		{
+			// Fetches that didn't follow the one before in the same flash line
+			uint64_t after = 0;
+			if (pc & (m->flash_line - 1))
+			{
+				after = counts[slot - 1] > t->jumped[slot - 1] ? counts[slot - 1] - t->jumped[slot - 1] : 0;
+				if (after > count)
+					after = count;
+			}
+			flash += (count - after) * m->flash;
+			cycles += (count - after) * m->flash;
+		}
+
+		total += count;
+
+		uint32_t offset = 0;
+		const char *name = syms ? elfsym_function(syms, pc, &offset) : NULL;
+		if (name == NULL)
+			continue;
+		if (!nfuncs || funcs[nfuncs - 1].name != name || pc - offset != funcs[nfuncs - 1].addr)
+		{
+			funcs[nfuncs].addr = pc - offset;
+			funcs[nfuncs].name = name;
+			funcs[nfuncs].count = 0;
+			funcs[nfuncs].cycles = 0;
+			nfuncs++;
+		}
+		funcs[nfuncs - 1].count += count;
+		funcs[nfuncs - 1].cycles += cycles;
+	}
+
+	uint64_t cycles = execute + taken + load_use + flash;
+	fprintf(out, "Timing model %s: alu %u, mul %u, div %u, load %u, store %u, branch %u (+%u taken), jal %u, jalr %u,\n",
+			m->name, m->alu, m->mul, m->div, m->load, m->store, m->branch, m->taken, m->jal, m->jalr);
+	fprintf(out, "  fpu %u, fdiv %u, csr %u, load-use +%u, flash +%u per %u bytes, %g MHz\n", m->fpu, m->fdiv, m->csr,
+			m->load_use, m->flash, m->flash_line, m->mhz);
+	fprintf(out, "Estimated %llu cycles for %llu instructions, CPI %.3f", (unsigned long long)cycles,
+			(unsigned long long)total, cpi(cycles, total));
+	if (m->mhz > 0)
+		fprintf(out, ", %.3f ms", cycles / (m->mhz * 1000.0));
+	fprintf(out, "\n");
+	fprintf(out, "  %-18s %14llu %6.2f%%\n", "execution", (unsigned long long)execute, percent(execute, cycles));
+	fprintf(out, "  %-18s %14llu %6.2f%%\n", "taken branches", (unsigned long long)taken, percent(taken, cycles));
+	fprintf(out, "  %-18s %14llu %6.2f%%\n", "load-use stalls", (unsigned long long)load_use, percent(load_use, cycles));
+	fprintf(out, "  %-18s %14llu %6.2f%%\n", "flash wait states", (unsigned long long)flash, percent(flash, cycles));
+
+	if (nfuncs)
+	{
+		qsort(funcs, nfuncs, sizeof(cycle_entry), more_cycles);
+		fprintf(out, "\nFunctions\n");
+		fprintf(out, "%14s %7s %14s %7s  %-8s  %s\n", "cycles", "%", "instructions", "CPI", "address", "function");
+		for (int i = 0; i < nfuncs; i++)
+			fprintf(out, "%14llu %6.2f%% %14llu %7.3f  %08x  %s\n", (unsigned long long)funcs[i].cycles,
+					percent(funcs[i].cycles, cycles), (unsigned long long)funcs[i].count,
+					cpi(funcs[i].cycles, funcs[i].count), funcs[i].addr, funcs[i].name);
+	}
+
+	free(counts);
+	free(funcs);
+}
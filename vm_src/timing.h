@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "rv32i.h"
+#include "elfsym.h"
+#include "profile.h"
+
+// Cycle estimate
+// Instructions cost cycles by kind on a timing model of the target core,
+// given as a preset with optional changes ("ibex,div=18,flash=1"). While
+// running only two things are counted, both per address: how often each
+// instruction ran (the way the profiler does) and how often it went
+// somewhere other than the next instruction. The cycles are worked out from
+// them when reporting:
+//   - every instruction costs its kind's cycles, multiply and divide
+//     included, and a taken branch its penalty on top
+//   - a load followed by an instruction reading what it loaded stalls for
+//     load_use cycles
+//   - fetches from ROM wait flash cycles when they start a new flash line:
+//     at the start of each line, and wherever a jump lands
+// RAM code rewritten during the run is costed as it was last written.
+
+struct timing_model
+{
+	const char *name;
+	double mhz; // clock, to turn cycles into time
+
+	// Cycles per instruction of each kind
+	uint32_t alu; // ALU, upper immediates and Zba/Zbb
+	uint32_t mul;
+	uint32_t div; // division and remainder
+	uint32_t load;
+	uint32_t store;
+	uint32_t branch; // not taken
+	uint32_t jal;
+	uint32_t jalr;
+	uint32_t fpu;  // F extension, but for
+	uint32_t fdiv; // division and square root
+	uint32_t csr;
+
+	// Extra cycles
+	uint32_t taken;		 // taken branch
+	uint32_t load_use;	 // next instruction reading a loaded register
+	uint32_t flash;		 // wait states of a fetch starting a flash line
+	uint32_t flash_line; // bytes read from flash at once
+};
+typedef struct timing_model timing_model;
+
+struct rv32timing
+{
+	timing_model model;
+	rv32profile counts; // executions per address
+	uint64_t jumped[PROFILE_SLOTS]; // times each instruction didn't go on to the next, faults included
+};
+typedef struct rv32timing rv32timing;
+
+int timing_start(rv32timing *t, const char *spec);
+void timing_list(FILE *out);
+void timing_report(rv32timing *t, rv32core *core, FILE *out, elf_symbols *syms);
+
+void timing_step(rv32timing *t, rv32core *core, uint32_t pc, uint64_t n, int fault);
+void timing_loop(rv32timing *t, rv32core *core, uint32_t top, uint64_t skipped);
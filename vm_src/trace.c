@@ -0,0 +1,646 @@
+#define _CRT_SECURE_NO_WARNINGS // allow building on MSVC
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "rv32i.h"
+#include "instructions.h"
+#include "isa.h"
+#include "trace.h"
+
+// Block compression
+// LZ77 in the byte layout of an LZ4 block: a token with the literal count in
+// its high nibble and the match length - 4 in its low nibble (15 meaning more
+// length bytes follow, each adding up to 255), the literals, then a 16 bit
+// match offset. The last sequence has no match.
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16) // worst case compressed size
+
+static uint32_t read_32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint8_t *put_length(uint8_t *o, uint32_t len)
+{
+	for (len -= 15; len >= 255; len -= 255)
+		*o++ = 255;
+	*o++ = len;
+	return o;
+}
+
+static uint8_t *put_sequence(uint8_t *o, const uint8_t *lit, uint32_t nlit, uint32_t offset, uint32_t len)
+{
+	uint32_t m = len ? len - LZ_MIN_MATCH : 0;
+	*o++ = (nlit < 15 ? nlit : 15) << 4 | (m < 15 ? m : 15);
+	if (nlit >= 15)
+		o = put_length(o, nlit);
+	memcpy(o, lit, nlit);
+	o += nlit;
+
+	if (len)
+	{
+		*o++ = offset;
+		*o++ = offset >> 8;
+		if (m >= 15)
+			o = put_length(o, m);
+	}
+	return o;
+}
+
+static uint32_t lz_compress(const uint8_t *in, uint32_t size, uint8_t *out)
+{
+	uint32_t table[1 << LZ_HASH_BITS];
+	memset(table, 0xFF, sizeof(table));
+
+	uint8_t *o = out;
+	uint32_t anchor = 0;
+	uint32_t i = 0;
+	while (i + LZ_MIN_MATCH <= size)
+	{
+		uint32_t v = read_32(in + i);
+		uint32_t h = (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+		uint32_t cand = table[h];
+		table[h] = i;
+		if (cand == UINT32_MAX || i - cand > 0xFFFF || read_32(in + cand) != v)
+		{
+			i++;
+			continue;
+		}
+
+		uint32_t len = LZ_MIN_MATCH;
+		while (i + len < size && in[cand + len] == in[i + len])
+			len++;
+		o = put_sequence(o, in + anchor, i - anchor, i - cand, len);
+		i += len;
+		anchor = i;
+	}
+
+	o = put_sequence(o, in + anchor, size - anchor, 0, 0);
+	return (uint32_t)(o - out);
+}
+
+static int get_length(const uint8_t *in, uint32_t size, uint32_t *i, uint32_t *len)
+{
+	uint8_t b;
+	do
+	{
+		if (*i >= size)
+			return -1;
+		b = in[(*i)++];
+		*len += b;
+	} while (b == 255);
+	return 0;
+}
+
+// Returns -1 unless in decompresses to exactly raw bytes
+static int lz_decompress(const uint8_t *in, uint32_t size, uint8_t *out, uint32_t raw)
+{
+	uint32_t i = 0;
+	uint32_t o = 0;
+	while (i < size)
+	{
+		uint8_t token = in[i++];
+		uint32_t n = token >> 4;
+		if (n == 15 && get_length(in, size, &i, &n))
+			return -1;
+		if (n > size - i || n > raw - o)
+			return -1;
+		memcpy(out + o, in + i, n);
+		i += n;
+		o += n;
+		if (i == size)
+			break;
+
+		if (size - i < 2)
+			return -1;
+		uint32_t offset = in[i] | (in[i + 1] << 8);
+		i += 2;
+		n = (token & 15) + LZ_MIN_MATCH;
+		if ((token & 15) == 15 && get_length(in, size, &i, &n))
+			return -1;
+		if (offset == 0 || offset > o || n > raw - o)
+			return -1;
+		for (; n; n--, o++)
+			out[o] = out[o - offset];
+	}
+	return o == raw ? 0 : -1;
+}
+
+// Writing
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+// Compress a chunk and write it out as a block
+static void write_chunk(rv32trace *t, const uint8_t *data, uint32_t size)
+{
+	uint8_t header[8];
+	uint32_t stored = lz_compress(data, size, t->scratch);
+	if (stored >= size)
+	{
+		stored = size;
+		memcpy(t->scratch, data, size);
+	}
+
+	put_u32(header, size);
+	put_u32(header + 4, stored);
+	if (fwrite(header, 1, 8, t->out) != 8 || fwrite(t->scratch, 1, stored, t->out) != stored)
+		t->error = 1;
+	t->stored += 8 + stored;
+}
+
+#ifndef _WIN32
+static void wait_a_little(void)
+{
+	struct timespec ts = {0, 100000};
+	nanosleep(&ts, NULL);
+}
+
+// Writer thread, drains the ring until the trace is stopped
+static void *writer_main(void *arg)
+{
+	rv32trace *t = arg;
+	for (;;)
+	{
+		uint32_t tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+		if (tail == atomic_load_explicit(&t->head, memory_order_acquire))
+		{
+			if (atomic_load_explicit(&t->done, memory_order_acquire) &&
+				tail == atomic_load_explicit(&t->head, memory_order_acquire))
+				break;
+			wait_a_little();
+			continue;
+		}
+
+		uint32_t slot = tail % TRACE_RING;
+		write_chunk(t, t->ring + slot * TRACE_CHUNK, t->used[slot]);
+		atomic_store_explicit(&t->tail, tail + 1, memory_order_release);
+	}
+	return NULL;
+}
+#endif
+
+// Hand the current chunk to the writer and start the next one
+static void submit(rv32trace *t)
+{
+	t->raw += t->pos;
+#ifdef _WIN32
+	write_chunk(t, t->chunk, t->pos);
+#else
+	uint32_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+	t->used[head % TRACE_RING] = t->pos;
+	atomic_store_explicit(&t->head, head + 1, memory_order_release);
+
+	// Every chunk is waiting to be written, the disk can't keep up
+	if (head + 1 - atomic_load_explicit(&t->tail, memory_order_acquire) == TRACE_RING)
+	{
+		t->stalls++;
+		while (head + 1 - atomic_load_explicit(&t->tail, memory_order_acquire) == TRACE_RING)
+			wait_a_little();
+	}
+	t->chunk = t->ring + (head + 1) % TRACE_RING * TRACE_CHUNK;
+#endif
+	t->pos = 0;
+}
+
+// Make room for one more packet
+static inline void reserve(rv32trace *t)
+{
+	if (t->pos + TRACE_PACKET_MAX > TRACE_CHUNK)
+		submit(t);
+}
+
+static inline void put_byte(rv32trace *t, uint8_t b)
+{
+	t->chunk[t->pos++] = b;
+}
+
+static inline void put_varint(rv32trace *t, uint64_t v)
+{
+	for (; v >= 0x80; v >>= 7)
+		put_byte(t, (uint8_t)v | 0x80);
+	put_byte(t, (uint8_t)v);
+}
+
+static inline void put_signed(rv32trace *t, int32_t v)
+{
+	put_varint(t, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+// Write out pending branch outcomes, every other packet comes after them
+static inline void flush_branches(rv32trace *t)
+{
+	if (t->branch_count)
+	{
+		reserve(t);
+		put_byte(t, 0x80 | 1 << t->branch_count | t->branches);
+		t->branches = 0;
+		t->branch_count = 0;
+	}
+}
+
+static inline void put_branch(rv32trace *t, int taken)
+{
+	t->branches |= taken << t->branch_count;
+	if (++t->branch_count == 6)
+		flush_branches(t);
+}
+
+// Open path and write the header and the ROM
+// With memory set every load and store is recorded, and spin loops are run
+// instead of fast-forwarded so none of their accesses go missing.
+// Returns -1 if the file can't be written or memory runs out.
+int trace_start(rv32trace *t, rv32core *core, const char *path, int memory)
+{
+	memset(t, 0, sizeof(rv32trace));
+	t->ring = malloc(TRACE_RING * TRACE_CHUNK);
+	t->scratch = malloc(LZ_BOUND(TRACE_CHUNK));
+	t->out = fopen(path, "wb");
+	if (t->ring == NULL || t->scratch == NULL || t->out == NULL)
+	{
+		if (t->out)
+			fclose(t->out);
+		free(t->ring);
+		free(t->scratch);
+		return -1;
+	}
+	t->chunk = t->ring;
+
+	uint8_t header[24];
+	memcpy(header, TRACE_MAGIC, 8);
+	put_u32(header + 8, memory ? TRACE_MEMORY : 0);
+	put_u32(header + 12, core->pc);
+	put_u32(header + 16, (uint32_t)core->inst_count);
+	put_u32(header + 20, (uint32_t)(core->inst_count >> 32));
+	uint8_t rom_size[4];
+	put_u32(rom_size, ROM_SIZE);
+	if (fwrite(header, 1, 24, t->out) != 24 || fwrite(rom_size, 1, 4, t->out) != 4 ||
+		fwrite(core->rom, 1, ROM_SIZE, t->out) != ROM_SIZE)
+		t->error = 1;
+
+#ifndef _WIN32
+	if (pthread_create(&t->writer, NULL, writer_main, t))
+	{
+		fclose(t->out);
+		free(t->ring);
+		free(t->scratch);
+		return -1;
+	}
+#endif
+
+	core->trace = t;
+	if (memory)
+	{
+		core->trace_mem = t;
+		core->idle.off = 1;
+	}
+	return 0;
+}
+
+// Write the end packet and everything still buffered, and close the file
+// Returns -1 if anything couldn't be written.
+int trace_stop(rv32trace *t, rv32core *core, int fault)
+{
+	core->trace = NULL;
+	core->trace_mem = NULL;
+
+	flush_branches(t);
+	reserve(t);
+	put_byte(t, 0x04);
+	put_varint(t, core->inst_count);
+	put_signed(t, fault);
+	submit(t);
+
+#ifndef _WIN32
+	atomic_store_explicit(&t->done, 1, memory_order_release);
+	pthread_join(t->writer, NULL);
+#endif
+
+	if (fclose(t->out))
+		t->error = 1;
+	free(t->ring);
+	free(t->scratch);
+	return t->error ? -1 : 0;
+}
+
+void trace_report(rv32trace *t, FILE *out)
+{
+	fprintf(out, "Trace: %llu bytes of packets, %llu bytes written", (unsigned long long)t->raw,
+			(unsigned long long)t->stored);
+	if (t->stalls)
+		fprintf(out, ", the writer fell behind %llu times", (unsigned long long)t->stalls);
+	fprintf(out, "\n");
+}
+
+// Record how the n instructions executed in a row from pc ended
+void trace_step(rv32trace *t, rv32core *core, uint32_t pc, uint64_t n, int fault)
+{
+	if (!n)
+		return;
+	uint32_t last = pc + 4 * (uint32_t)(n - 1);
+
+	if (last - ROM_BASE < ROM_SIZE)
+	{
+		// The reader follows ROM code by itself, except where it branches
+		if (fault)
+			return;
+		int id = isa_decode(read_32(&core->rom[last - ROM_BASE]));
+		if (isa_class(id) == ISA_CLASS_BRANCH)
+			put_branch(t, core->pc != last + 4);
+		else if (id == ISA_JALR)
+		{
+			flush_branches(t);
+			reserve(t);
+			put_byte(t, 0x01);
+			put_signed(t, core->pc - last);
+		}
+		return;
+	}
+
+	flush_branches(t);
+	reserve(t);
+	put_byte(t, 0x02);
+	put_varint(t, n);
+	put_signed(t, core->pc - last);
+}
+
+// The spin loop at top was just fast-forwarded by skipped instructions
+void trace_skip(rv32trace *t, rv32core *core, uint32_t top, uint64_t skipped)
+{
+	flush_branches(t);
+	reserve(t);
+	put_byte(t, 0x03);
+	put_varint(t, core->inst_count - skipped);
+	put_varint(t, skipped);
+	put_signed(t, core->pc - top);
+}
+
+void trace_access(rv32trace *t, uint32_t addr, uint32_t value, uint8_t flags)
+{
+	flush_branches(t);
+	reserve(t);
+	put_byte(t, 0x10 | flags);
+	put_signed(t, addr - t->last_mem);
+	put_varint(t, value);
+	t->last_mem = addr;
+}
+
+// Reading
+
+struct trace_reader
+{
+	FILE *in;
+	uint8_t *raw;	 // current block, decompressed
+	uint8_t *stored; // current block as read
+	uint32_t size;
+	uint32_t pos;
+	uint32_t last_mem;
+	int error;
+};
+typedef struct trace_reader trace_reader;
+
+// Next byte of the packet stream, -1 at the end of the file or on errors
+static int next_byte(trace_reader *r)
+{
+	while (r->pos == r->size)
+	{
+		uint8_t header[8];
+		if (fread(header, 1, 8, r->in) != 8)
+			return -1;
+		uint32_t size = read_32(header);
+		uint32_t stored = read_32(header + 4);
+		if (size > TRACE_CHUNK || stored > size || fread(r->stored, 1, stored, r->in) != stored)
+		{
+			r->error = 1;
+			return -1;
+		}
+		if (stored == size)
+			memcpy(r->raw, r->stored, size);
+		else if (lz_decompress(r->stored, stored, r->raw, size))
+		{
+			r->error = 1;
+			return -1;
+		}
+		r->size = size;
+		r->pos = 0;
+	}
+	return r->raw[r->pos++];
+}
+
+static int peek_byte(trace_reader *r)
+{
+	int b = next_byte(r);
+	if (b >= 0)
+		r->pos--;
+	return b;
+}
+
+static uint64_t get_varint(trace_reader *r)
+{
+	uint64_t v = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		int b = next_byte(r);
+		if (b < 0)
+		{
+			r->error = 1;
+			return 0;
+		}
+		v |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			return v;
+	}
+	r->error = 1;
+	return v;
+}
+
+static int32_t get_signed(trace_reader *r)
+{
+	uint32_t v = (uint32_t)get_varint(r);
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static void print_access(trace_reader *r, FILE *out, int packet)
+{
+	static const char *sizes[4] = {"byte", "half", "word", "?"};
+
+	r->last_mem += get_signed(r);
+	uint32_t value = (uint32_t)get_varint(r);
+	fprintf(out, "    %s %s 0x%08x: 0x%08x\n", packet & TRACE_STORE ? "store" : "load", sizes[packet & 3],
+			r->last_mem, value);
+}
+
+// Print the instructions, memory accesses and skipped loops a trace recorded
+// Returns -1 if the trace is damaged or doesn't match its ROM.
+int trace_dump(const char *path, FILE *out)
+{
+	trace_reader r;
+	memset(&r, 0, sizeof(r));
+	r.in = fopen(path, "rb");
+	if (r.in == NULL)
+		return -1;
+
+	uint8_t header[28];
+	uint8_t *rom = NULL;
+	uint32_t rom_size = 0;
+	if (fread(header, 1, 28, r.in) == 28 && !memcmp(header, TRACE_MAGIC, 8))
+	{
+		rom_size = read_32(header + 24);
+		rom = malloc(rom_size);
+	}
+	r.raw = malloc(TRACE_CHUNK);
+	r.stored = malloc(TRACE_CHUNK);
+	if (rom == NULL || r.raw == NULL || r.stored == NULL || fread(rom, 1, rom_size, r.in) != rom_size)
+	{
+		fclose(r.in);
+		free(rom);
+		free(r.raw);
+		free(r.stored);
+		return -1;
+	}
+
+	uint32_t flags = read_32(header + 8);
+	uint32_t pc = read_32(header + 12);
+	uint64_t count = read_32(header + 16) | (uint64_t)read_32(header + 20) << 32;
+	uint8_t tnt = 1; // branch outcomes read but not followed yet, above a stop bit
+
+	// Loop skips and the end come after the packets of everything before them,
+	// but are only due once the instructions leading up to them have been walked
+	int due = 0;
+	uint64_t due_count = 0;
+	uint64_t skipped = 0;
+	int32_t arg = 0;
+
+	while (!r.error)
+	{
+		int packet = peek_byte(&r);
+		if (!due && tnt == 1 && (packet == 0x03 || packet == 0x04))
+		{
+			due = next_byte(&r);
+			due_count = get_varint(&r);
+			skipped = due == 0x03 ? get_varint(&r) : 0;
+			arg = get_signed(&r);
+			continue;
+		}
+
+		if (due && count >= due_count)
+		{
+			if (count > due_count)
+				r.error = 1;
+			else if (due == 0x04)
+			{
+				fprintf(out, "end, fault %d after %llu instructions\n", (int)arg, (unsigned long long)count);
+				break;
+			}
+			else
+			{
+				fprintf(out, "    %llu instructions fast-forwarded in the loop at 0x%08x\n", (unsigned long long)skipped, pc);
+				pc += arg;
+				count += skipped;
+				due = 0;
+			}
+			continue;
+		}
+
+		if (pc - ROM_BASE >= rom_size || (pc & 3))
+		{
+			// Code outside ROM, recorded as it ran
+			if (due || next_byte(&r) < 0)
+			{
+				r.error = 1;
+				break;
+			}
+			if (packet >= 0x10 && packet < 0x20)
+				print_access(&r, out, packet);
+			else if (packet == 0x02)
+			{
+				uint64_t n = get_varint(&r);
+				for (uint64_t i = 0; i < n; i++)
+					fprintf(out, "0x%08x\n", pc + 4 * (uint32_t)i);
+				pc += 4 * (uint32_t)(n - 1);
+				pc += get_signed(&r);
+				count += n;
+			}
+			else
+				r.error = 1;
+			continue;
+		}
+
+		uint32_t inst = read_32(&rom[pc - ROM_BASE]);
+		int id = isa_decode(inst);
+		char text[64];
+		isa_disasm(text, sizeof(text), inst, pc);
+		fprintf(out, "0x%08x %08x  %s\n", pc, inst, text);
+		count++;
+
+		switch (isa_class(id))
+		{
+
+		case ISA_CLASS_LOAD:
+		case ISA_CLASS_STORE:
+		case ISA_CLASS_FLOAD:
+		case ISA_CLASS_FSTORE:
+			if (flags & TRACE_MEMORY)
+			{
+				packet = next_byte(&r);
+				if (packet >= 0x10 && packet < 0x20)
+					print_access(&r, out, packet);
+				else
+					r.error = 1;
+			}
+			pc += 4;
+			break;
+
+		case ISA_CLASS_BRANCH:
+			if (tnt == 1)
+			{
+				packet = next_byte(&r);
+				if (packet < 0x82)
+				{
+					r.error = 1;
+					break;
+				}
+				tnt = packet & 0x7F;
+			}
+			pc += (tnt & 1) ? imm_type_b(inst) : 4;
+			// Drop the outcome, shifting the stop bit down with the rest
+			tnt >>= 1;
+			break;
+
+		case ISA_CLASS_JUMP:
+			if (id == ISA_JAL)
+				pc += imm_type_j(inst);
+			else
+			{
+				if (next_byte(&r) != 0x01)
+					r.error = 1;
+				pc += get_signed(&r);
+			}
+			break;
+
+		default:
+			pc += 4;
+			break;
+		}
+	}
+
+	fclose(r.in);
+	free(rom);
+	free(r.raw);
+	free(r.stored);
+	return r.error ? -1 : 0;
+}
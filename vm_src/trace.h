@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "rv32i.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <stdatomic.h>
+#define TRACE_ATOMIC _Atomic
+#else
+#define TRACE_ATOMIC // no writer thread, chunks are written as they fill up
+#endif
+
+// Execution trace
+// The PC stream of a run, and optionally every memory access with its value,
+// in a compact binary file. Code in ROM is not recorded at all: the trace
+// carries a copy of the ROM and a reader walks it, taking only the outcome of
+// each conditional branch (one bit) and the target of each indirect jump
+// (a varint relative to the jump) from the trace. Code running from RAM is
+// recorded as runs of instructions and where they went next.
+//
+// Packets are packed into chunks that are handed through a lock-free ring to
+// a writer thread, which compresses each chunk and writes it out, so the
+// emulating thread never waits for the disk unless the whole ring is full.
+//
+// File layout
+//   header: "RV32TRC1", u32 flags, u32 entry pc, u64 first inst_count,
+//           u32 ROM size, then the ROM
+//   blocks: u32 raw size, u32 stored size, then the LZ compressed chunk
+//           (stored size == raw size means the chunk is stored as is)
+// Packets, varints are LEB128 and signed values are zigzag encoded
+//   1 k bits      branch outcomes, k = 1..6 and the first branch in bit 0,
+//                 with a stop bit above them: 0x80 | 1 << k | bits
+//   0x01 d        indirect jump to its own address + d
+//   0x02 n d      n instructions from RAM, the last going to its address + d
+//   0x03 c n d    at inst_count c, a spin loop fast-forwarded by n
+//                 instructions, leaving pc at the loop top + d
+//   0x04 c f      end of the trace at inst_count c, with the fault code
+//   0x10 | a      memory access (a = TRACE_STORE if it is a store, plus log2
+//                 of the size), the address relative to the previous access
+//                 and the value
+
+#define TRACE_MAGIC "RV32TRC1"
+
+// Header flags
+#define TRACE_MEMORY 1 // memory accesses are recorded
+
+// Memory access packet flags
+#define TRACE_LOAD 0
+#define TRACE_STORE 4
+
+#define TRACE_CHUNK (64 * 1024) // bytes of packets per compressed block
+#define TRACE_RING 64			// chunks waiting for the writer
+#define TRACE_PACKET_MAX 32		// longest packet
+
+struct rv32trace
+{
+	uint8_t *ring; // TRACE_RING chunks
+	uint32_t used[TRACE_RING];
+	TRACE_ATOMIC uint32_t head; // chunks filled, written by the emulating thread
+	TRACE_ATOMIC uint32_t tail; // chunks written out, written by the writer thread
+	TRACE_ATOMIC int done;
+
+	uint8_t *chunk; // chunk being filled
+	uint32_t pos;
+
+	uint8_t branches;	  // outcomes not written yet, the first in bit 0
+	uint8_t branch_count;
+	uint32_t last_mem; // address of the previous memory access
+
+	FILE *out;
+	uint8_t *scratch; // compressed chunk
+	int error;
+	uint64_t raw;	 // bytes of packets
+	uint64_t stored; // bytes written out
+	uint64_t stalls; // times the ring was full
+
+#ifndef _WIN32
+	pthread_t writer;
+#endif
+};
+typedef struct rv32trace rv32trace;
+
+// Memory access hook for the engines, a single test when not tracing
+#define TRACE_ACCESS(core, addr, value, flags) \
+	do { if ((core)->trace_mem) trace_access((core)->trace_mem, addr, value, flags); } while (0)
+
+int trace_start(rv32trace *t, rv32core *core, const char *path, int memory);
+int trace_stop(rv32trace *t, rv32core *core, int fault);
+void trace_report(rv32trace *t, FILE *out);
+
+void trace_step(rv32trace *t, rv32core *core, uint32_t pc, uint64_t n, int fault);
+void trace_skip(rv32trace *t, rv32core *core, uint32_t top, uint64_t skipped);
+void trace_access(rv32trace *t, uint32_t addr, uint32_t value, uint8_t flags);
+
+int trace_dump(const char *path, FILE *out);